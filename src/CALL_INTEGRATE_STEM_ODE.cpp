@@ -7,17 +7,23 @@ using namespace Rcpp;
 //' Integrate a system of ODEs via external Xptr.
 //'
 //' @param init initial condition
+//' @param pars vector of parameters
 //' @param start time at left endpoint of interval
 //' @param end time at right endpoint
 //' @param step_size set automatically by caller, required argument not specified by user
 //' @param stem_ode_ptr external pointer for calling the ODE integrator
+//' @param set_ode_params_ptr external pointer to the ODE parameter setting function.
+//' @param ode_ctx_ptr external pointer to the functions for allocating and
+//'   releasing the integrator context
 //'
 //' @export
 // [[Rcpp::export]]
-void CALL_INTEGRATE_STEM_ODE(Rcpp::NumericVector& init, double start, double end, double step_size, SEXP stem_ode_ptr) {
+void CALL_INTEGRATE_STEM_ODE(Rcpp::NumericVector& init, const Rcpp::NumericVector& pars, double start, double end,
+                             double step_size, SEXP stem_ode_ptr, SEXP set_ode_params_ptr, SEXP ode_ctx_ptr) {
 
-        Rcpp::XPtr<ode_ptr> xpfun(stem_ode_ptr); // Receive the SEXP and put in Xptr
-        ode_ptr fun = *xpfun;                   // get function via pointer
+        // allocate an integrator context for this call
+        ode_context ctx(stem_ode_ptr, set_ode_params_ptr, ode_ctx_ptr);
 
-        fun(init, start, end, step_size);
-}
\ No newline at end of file
+        ctx.set_pars(pars.begin());
+        ctx.integrate(init.begin(), start, end, step_size);
+}
@@ -21,7 +21,6 @@ using namespace arma;
 void CALL_RATE_FCN(Rcpp::NumericVector& rates, const Rcpp::LogicalVector& inds,
                    const arma::rowvec& state, const Rcpp::NumericVector& parameters,
                    const Rcpp::NumericVector& constants, const arma::rowvec& tcovar, SEXP rate_ptr) {
-        Rcpp::XPtr<ratefcn_ptr> xpfun(rate_ptr);                // Receive the SEXP and put in Xptr
-        ratefcn_ptr fun = *xpfun;                               // get function via pointer
+        stem_rate_fcn fun(rate_ptr);                            // resolve the function via pointer
         fun(rates, inds, state, parameters, constants, tcovar); // evaluate the funtion
 }
\ No newline at end of file
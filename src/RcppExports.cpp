@@ -26,16 +26,19 @@ BEGIN_RCPP
 END_RCPP
 }
 // CALL_INTEGRATE_STEM_ODE
-void CALL_INTEGRATE_STEM_ODE(Rcpp::NumericVector& init, double start, double end, double step_size, SEXP stem_ode_ptr);
-RcppExport SEXP _stemr_CALL_INTEGRATE_STEM_ODE(SEXP initSEXP, SEXP startSEXP, SEXP endSEXP, SEXP step_sizeSEXP, SEXP stem_ode_ptrSEXP) {
+void CALL_INTEGRATE_STEM_ODE(Rcpp::NumericVector& init, const Rcpp::NumericVector& pars, double start, double end, double step_size, SEXP stem_ode_ptr, SEXP set_ode_params_ptr, SEXP ode_ctx_ptr);
+RcppExport SEXP _stemr_CALL_INTEGRATE_STEM_ODE(SEXP initSEXP, SEXP parsSEXP, SEXP startSEXP, SEXP endSEXP, SEXP step_sizeSEXP, SEXP stem_ode_ptrSEXP, SEXP set_ode_params_ptrSEXP, SEXP ode_ctx_ptrSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type init(initSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector& >::type pars(parsSEXP);
     Rcpp::traits::input_parameter< double >::type start(startSEXP);
     Rcpp::traits::input_parameter< double >::type end(endSEXP);
     Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
     Rcpp::traits::input_parameter< SEXP >::type stem_ode_ptr(stem_ode_ptrSEXP);
-    CALL_INTEGRATE_STEM_ODE(init, start, end, step_size, stem_ode_ptr);
+    Rcpp::traits::input_parameter< SEXP >::type set_ode_params_ptr(set_ode_params_ptrSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ode_ctx_ptr(ode_ctx_ptrSEXP);
+    CALL_INTEGRATE_STEM_ODE(init, pars, start, end, step_size, stem_ode_ptr, set_ode_params_ptr, ode_ctx_ptr);
     return R_NilValue;
 END_RCPP
 }
@@ -72,27 +75,30 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
-// CALL_SET_ODE_PARAMS
-void CALL_SET_ODE_PARAMS(Rcpp::NumericVector& p, SEXP set_ode_params_ptr);
-RcppExport SEXP _stemr_CALL_SET_ODE_PARAMS(SEXP pSEXP, SEXP set_ode_params_ptrSEXP) {
-BEGIN_RCPP
-    Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type p(pSEXP);
-    Rcpp::traits::input_parameter< SEXP >::type set_ode_params_ptr(set_ode_params_ptrSEXP);
-    CALL_SET_ODE_PARAMS(p, set_ode_params_ptr);
-    return R_NilValue;
-END_RCPP
-}
 // build_census_path
-arma::mat build_census_path(Rcpp::NumericMatrix& path, Rcpp::NumericVector& census_times, Rcpp::IntegerVector& census_columns);
-RcppExport SEXP _stemr_build_census_path(SEXP pathSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP) {
+arma::mat build_census_path(Rcpp::NumericMatrix& path, Rcpp::NumericVector& census_times, Rcpp::IntegerVector& census_columns, const Rcpp::Nullable<Rcpp::IntegerVector>& census_inds);
+RcppExport SEXP _stemr_build_census_path(SEXP pathSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP, SEXP census_indsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type path(pathSEXP);
     Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type census_times(census_timesSEXP);
     Rcpp::traits::input_parameter< Rcpp::IntegerVector& >::type census_columns(census_columnsSEXP);
-    rcpp_result_gen = Rcpp::wrap(build_census_path(path, census_times, census_columns));
+    Rcpp::traits::input_parameter< const Rcpp::Nullable<Rcpp::IntegerVector>& >::type census_inds(census_indsSEXP);
+    rcpp_result_gen = Rcpp::wrap(build_census_path(path, census_times, census_columns, census_inds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// census_row_indices
+Rcpp::IntegerVector census_row_indices(const Rcpp::NumericVector& path_times, const Rcpp::NumericVector& census_times, bool all_inside);
+RcppExport SEXP _stemr_census_row_indices(SEXP path_timesSEXP, SEXP census_timesSEXP, SEXP all_insideSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector& >::type path_times(path_timesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector& >::type census_times(census_timesSEXP);
+    Rcpp::traits::input_parameter< bool >::type all_inside(all_insideSEXP);
+    rcpp_result_gen = Rcpp::wrap(census_row_indices(path_times, census_times, all_inside));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -110,8 +116,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // census_latent_path
-void census_latent_path(const arma::mat& path, arma::mat& census_path, const arma::uvec& census_inds, const Rcpp::Nullable<Rcpp::IntegerVector>& event_inds, const arma::mat& flow_matrix, bool do_prevalence, const arma::mat& parmat, const arma::uvec& initdist_inds, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, arma::uvec row0);
-RcppExport SEXP _stemr_census_latent_path(SEXP pathSEXP, SEXP census_pathSEXP, SEXP census_indsSEXP, SEXP event_indsSEXP, SEXP flow_matrixSEXP, SEXP do_prevalenceSEXP, SEXP parmatSEXP, SEXP initdist_indsSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP row0SEXP) {
+void census_latent_path(const arma::mat& path, arma::mat& census_path, const arma::uvec& census_inds, const Rcpp::Nullable<Rcpp::IntegerVector>& event_inds, const arma::mat& flow_matrix, bool do_prevalence, const arma::mat& parmat, const arma::uvec& initdist_inds, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, arma::uvec row0, SEXP lna_workspace);
+RcppExport SEXP _stemr_census_latent_path(SEXP pathSEXP, SEXP census_pathSEXP, SEXP census_indsSEXP, SEXP event_indsSEXP, SEXP flow_matrixSEXP, SEXP do_prevalenceSEXP, SEXP parmatSEXP, SEXP initdist_indsSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP row0SEXP, SEXP lna_workspaceSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const arma::mat& >::type path(pathSEXP);
@@ -127,7 +133,8 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
     Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
     Rcpp::traits::input_parameter< arma::uvec >::type row0(row0SEXP);
-    census_latent_path(path, census_path, census_inds, event_inds, flow_matrix, do_prevalence, parmat, initdist_inds, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, row0);
+    Rcpp::traits::input_parameter< SEXP >::type lna_workspace(lna_workspaceSEXP);
+    census_latent_path(path, census_path, census_inds, event_inds, flow_matrix, do_prevalence, parmat, initdist_inds, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, row0, lna_workspace);
     return R_NilValue;
 END_RCPP
 }
@@ -452,8 +459,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // evaluate_d_measure_LNA
-void evaluate_d_measure_LNA(Rcpp::NumericMatrix& emitmat, const Rcpp::NumericMatrix& obsmat, const Rcpp::NumericMatrix& censusmat, const Rcpp::LogicalMatrix& measproc_indmat, const Rcpp::NumericMatrix& parameters, const Rcpp::IntegerVector& param_inds, const Rcpp::IntegerVector& const_inds, const Rcpp::IntegerVector& tcovar_inds, const Rcpp::LogicalVector& param_update_inds, const Rcpp::IntegerVector& census_indices, Rcpp::NumericVector& param_vec, SEXP d_meas_ptr);
-RcppExport SEXP _stemr_evaluate_d_measure_LNA(SEXP emitmatSEXP, SEXP obsmatSEXP, SEXP censusmatSEXP, SEXP measproc_indmatSEXP, SEXP parametersSEXP, SEXP param_indsSEXP, SEXP const_indsSEXP, SEXP tcovar_indsSEXP, SEXP param_update_indsSEXP, SEXP census_indicesSEXP, SEXP param_vecSEXP, SEXP d_meas_ptrSEXP) {
+void evaluate_d_measure_LNA(Rcpp::NumericMatrix& emitmat, const Rcpp::NumericMatrix& obsmat, const Rcpp::NumericMatrix& censusmat, const Rcpp::LogicalMatrix& measproc_indmat, const Rcpp::NumericMatrix& parameters, const Rcpp::IntegerVector& param_inds, const Rcpp::IntegerVector& const_inds, const Rcpp::IntegerVector& tcovar_inds, const Rcpp::LogicalVector& param_update_inds, const Rcpp::IntegerVector& census_indices, Rcpp::NumericVector& param_vec, SEXP d_meas_ptr, int start_ind);
+RcppExport SEXP _stemr_evaluate_d_measure_LNA(SEXP emitmatSEXP, SEXP obsmatSEXP, SEXP censusmatSEXP, SEXP measproc_indmatSEXP, SEXP parametersSEXP, SEXP param_indsSEXP, SEXP const_indsSEXP, SEXP tcovar_indsSEXP, SEXP param_update_indsSEXP, SEXP census_indicesSEXP, SEXP param_vecSEXP, SEXP d_meas_ptrSEXP, SEXP start_indSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type emitmat(emitmatSEXP);
@@ -468,7 +475,8 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type census_indices(census_indicesSEXP);
     Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type param_vec(param_vecSEXP);
     Rcpp::traits::input_parameter< SEXP >::type d_meas_ptr(d_meas_ptrSEXP);
-    evaluate_d_measure_LNA(emitmat, obsmat, censusmat, measproc_indmat, parameters, param_inds, const_inds, tcovar_inds, param_update_inds, census_indices, param_vec, d_meas_ptr);
+    Rcpp::traits::input_parameter< int >::type start_ind(start_indSEXP);
+    evaluate_d_measure_LNA(emitmat, obsmat, censusmat, measproc_indmat, parameters, param_inds, const_inds, tcovar_inds, param_update_inds, census_indices, param_vec, d_meas_ptr, start_ind);
     return R_NilValue;
 END_RCPP
 }
@@ -500,8 +508,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // integrate_odes
-Rcpp::List integrate_odes(const arma::rowvec& ode_times, const Rcpp::NumericMatrix& ode_pars, const Rcpp::IntegerVector& ode_param_inds, const Rcpp::IntegerVector& ode_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, double step_size, SEXP ode_pointer, SEXP set_pars_pointer);
-RcppExport SEXP _stemr_integrate_odes(SEXP ode_timesSEXP, SEXP ode_parsSEXP, SEXP ode_param_indsSEXP, SEXP ode_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP step_sizeSEXP, SEXP ode_pointerSEXP, SEXP set_pars_pointerSEXP) {
+Rcpp::List integrate_odes(const arma::rowvec& ode_times, const Rcpp::NumericMatrix& ode_pars, const Rcpp::IntegerVector& ode_param_inds, const Rcpp::IntegerVector& ode_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, double step_size, SEXP ode_pointer, SEXP set_pars_pointer, SEXP ctx_pointer);
+RcppExport SEXP _stemr_integrate_odes(SEXP ode_timesSEXP, SEXP ode_parsSEXP, SEXP ode_param_indsSEXP, SEXP ode_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP step_sizeSEXP, SEXP ode_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -519,7 +527,94 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
     Rcpp::traits::input_parameter< SEXP >::type ode_pointer(ode_pointerSEXP);
     Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
-    rcpp_result_gen = Rcpp::wrap(integrate_odes(ode_times, ode_pars, ode_param_inds, ode_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, step_size, ode_pointer, set_pars_pointer));
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    rcpp_result_gen = Rcpp::wrap(integrate_odes(ode_times, ode_pars, ode_param_inds, ode_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, step_size, ode_pointer, set_pars_pointer, ctx_pointer));
+    return rcpp_result_gen;
+END_RCPP
+}
+// integrate_odes_batch
+Rcpp::List integrate_odes_batch(const arma::rowvec& ode_times, const arma::cube& ode_pars, const arma::mat& draw_pars, const Rcpp::IntegerVector& ode_param_inds, const Rcpp::IntegerVector& ode_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, double step_size, SEXP ode_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, int n_threads);
+RcppExport SEXP _stemr_integrate_odes_batch(SEXP ode_timesSEXP, SEXP ode_parsSEXP, SEXP draw_parsSEXP, SEXP ode_param_indsSEXP, SEXP ode_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP step_sizeSEXP, SEXP ode_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::rowvec& >::type ode_times(ode_timesSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type ode_pars(ode_parsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type draw_pars(draw_parsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type ode_param_inds(ode_param_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type ode_tcovar_inds(ode_tcovar_indsSEXP);
+    Rcpp::traits::input_parameter< const int >::type init_start(init_startSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type param_update_inds(param_update_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type stoich_matrix(stoich_matrixSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ode_pointer(ode_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(integrate_odes_batch(ode_times, ode_pars, draw_pars, ode_param_inds, ode_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, step_size, ode_pointer, set_pars_pointer, ctx_pointer, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// lna_ess_block_update
+bool lna_ess_block_update(arma::mat& path_draws, arma::mat& latent_path, Rcpp::NumericVector& data_log_lik, arma::mat& draws_prop, const arma::mat& ess_draws, const arma::uvec& ess_inds, const arma::uvec& ess_times, double bracket_width, arma::vec& ess_steps, arma::vec& ess_angles, int step_ind, arma::mat& pathmat_prop, Rcpp::NumericMatrix& censusmat, Rcpp::NumericMatrix& emitmat, const Rcpp::NumericMatrix& obsmat, const Rcpp::LogicalMatrix& measproc_indmat, const arma::rowvec& lna_times, const Rcpp::NumericMatrix& parmat, Rcpp::NumericVector& param_vec, const Rcpp::IntegerVector& param_inds, const Rcpp::IntegerVector& const_inds, const Rcpp::IntegerVector& tcovar_inds, const arma::uvec& initdist_inds, const Rcpp::LogicalVector& param_update_inds, const Rcpp::IntegerVector& census_indices, const Rcpp::Nullable<Rcpp::IntegerVector>& event_inds, const arma::mat& flow_matrix, const arma::mat& stoich_matrix, bool do_prevalence, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, arma::vec& svd_d, arma::mat& svd_U, arma::mat& svd_V, std::string diffusion_sqrt, Rcpp::Nullable<Rcpp::List> lna_cache, SEXP lna_workspace, int restart_ind, int emit_start, double prefix_log_lik, Rcpp::Nullable<Rcpp::NumericVector> obs_log_liks, double inv_temp, double step_size, SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, SEXP d_meas_pointer);
+RcppExport SEXP _stemr_lna_ess_block_update(SEXP path_drawsSEXP, SEXP latent_pathSEXP, SEXP data_log_likSEXP, SEXP draws_propSEXP, SEXP ess_drawsSEXP, SEXP ess_indsSEXP, SEXP ess_timesSEXP, SEXP bracket_widthSEXP, SEXP ess_stepsSEXP, SEXP ess_anglesSEXP, SEXP step_indSEXP, SEXP pathmat_propSEXP, SEXP censusmatSEXP, SEXP emitmatSEXP, SEXP obsmatSEXP, SEXP measproc_indmatSEXP, SEXP lna_timesSEXP, SEXP parmatSEXP, SEXP param_vecSEXP, SEXP param_indsSEXP, SEXP const_indsSEXP, SEXP tcovar_indsSEXP, SEXP initdist_indsSEXP, SEXP param_update_indsSEXP, SEXP census_indicesSEXP, SEXP event_indsSEXP, SEXP flow_matrixSEXP, SEXP stoich_matrixSEXP, SEXP do_prevalenceSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP svd_dSEXP, SEXP svd_USEXP, SEXP svd_VSEXP, SEXP diffusion_sqrtSEXP, SEXP lna_cacheSEXP, SEXP lna_workspaceSEXP, SEXP restart_indSEXP, SEXP emit_startSEXP, SEXP prefix_log_likSEXP, SEXP obs_log_liksSEXP, SEXP inv_tempSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP d_meas_pointerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< arma::mat& >::type path_draws(path_drawsSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type latent_path(latent_pathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type data_log_lik(data_log_likSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type draws_prop(draws_propSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type ess_draws(ess_drawsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type ess_inds(ess_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type ess_times(ess_timesSEXP);
+    Rcpp::traits::input_parameter< double >::type bracket_width(bracket_widthSEXP);
+    Rcpp::traits::input_parameter< arma::vec& >::type ess_steps(ess_stepsSEXP);
+    Rcpp::traits::input_parameter< arma::vec& >::type ess_angles(ess_anglesSEXP);
+    Rcpp::traits::input_parameter< int >::type step_ind(step_indSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type pathmat_prop(pathmat_propSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type censusmat(censusmatSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type emitmat(emitmatSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type obsmat(obsmatSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalMatrix& >::type measproc_indmat(measproc_indmatSEXP);
+    Rcpp::traits::input_parameter< const arma::rowvec& >::type lna_times(lna_timesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type parmat(parmatSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type param_vec(param_vecSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type param_inds(param_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type const_inds(const_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type tcovar_inds(tcovar_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type initdist_inds(initdist_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type param_update_inds(param_update_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type census_indices(census_indicesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::Nullable<Rcpp::IntegerVector>& >::type event_inds(event_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type flow_matrix(flow_matrixSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type stoich_matrix(stoich_matrixSEXP);
+    Rcpp::traits::input_parameter< bool >::type do_prevalence(do_prevalenceSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< arma::vec& >::type svd_d(svd_dSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type svd_U(svd_USEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type svd_V(svd_VSEXP);
+    Rcpp::traits::input_parameter< std::string >::type diffusion_sqrt(diffusion_sqrtSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::List> >::type lna_cache(lna_cacheSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type lna_workspace(lna_workspaceSEXP);
+    Rcpp::traits::input_parameter< int >::type restart_ind(restart_indSEXP);
+    Rcpp::traits::input_parameter< int >::type emit_start(emit_startSEXP);
+    Rcpp::traits::input_parameter< double >::type prefix_log_lik(prefix_log_likSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type obs_log_liks(obs_log_liksSEXP);
+    Rcpp::traits::input_parameter< double >::type inv_temp(inv_tempSEXP);
+    Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type lna_pointer(lna_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type d_meas_pointer(d_meas_pointerSEXP);
+    rcpp_result_gen = Rcpp::wrap(lna_ess_block_update(path_draws, latent_path, data_log_lik, draws_prop, ess_draws, ess_inds, ess_times, bracket_width, ess_steps, ess_angles, step_ind, pathmat_prop, censusmat, emitmat, obsmat, measproc_indmat, lna_times, parmat, param_vec, param_inds, const_inds, tcovar_inds, initdist_inds, param_update_inds, census_indices, event_inds, flow_matrix, stoich_matrix, do_prevalence, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, svd_d, svd_U, svd_V, diffusion_sqrt, lna_cache, lna_workspace, restart_ind, emit_start, prefix_log_lik, obs_log_liks, inv_temp, step_size, lna_pointer, set_pars_pointer, ctx_pointer, d_meas_pointer));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -541,9 +636,60 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// lna_particle_filter
+double lna_particle_filter(arma::mat& pathmat, arma::mat& draws, const Rcpp::NumericMatrix& obsmat, const Rcpp::LogicalMatrix& measproc_indmat, const Rcpp::NumericMatrix& censusmat, const arma::rowvec& lna_times, const Rcpp::NumericMatrix& lna_pars, const Rcpp::IntegerVector& param_inds, const Rcpp::IntegerVector& const_inds, const Rcpp::IntegerVector& tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const Rcpp::IntegerVector& census_indices, const Rcpp::Nullable<Rcpp::IntegerVector>& event_inds, const arma::mat& stoich_matrix, bool do_prevalence, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, std::string diffusion_sqrt, int n_particles, double step_size, SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, SEXP d_meas_pointer, int n_threads);
+RcppExport SEXP _stemr_lna_particle_filter(SEXP pathmatSEXP, SEXP drawsSEXP, SEXP obsmatSEXP, SEXP measproc_indmatSEXP, SEXP censusmatSEXP, SEXP lna_timesSEXP, SEXP lna_parsSEXP, SEXP param_indsSEXP, SEXP const_indsSEXP, SEXP tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP census_indicesSEXP, SEXP event_indsSEXP, SEXP stoich_matrixSEXP, SEXP do_prevalenceSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP diffusion_sqrtSEXP, SEXP n_particlesSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP d_meas_pointerSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< arma::mat& >::type pathmat(pathmatSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type draws(drawsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type obsmat(obsmatSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalMatrix& >::type measproc_indmat(measproc_indmatSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type censusmat(censusmatSEXP);
+    Rcpp::traits::input_parameter< const arma::rowvec& >::type lna_times(lna_timesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type lna_pars(lna_parsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type param_inds(param_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type const_inds(const_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type tcovar_inds(tcovar_indsSEXP);
+    Rcpp::traits::input_parameter< const int >::type init_start(init_startSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type param_update_inds(param_update_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type census_indices(census_indicesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::Nullable<Rcpp::IntegerVector>& >::type event_inds(event_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type stoich_matrix(stoich_matrixSEXP);
+    Rcpp::traits::input_parameter< bool >::type do_prevalence(do_prevalenceSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< std::string >::type diffusion_sqrt(diffusion_sqrtSEXP);
+    Rcpp::traits::input_parameter< int >::type n_particles(n_particlesSEXP);
+    Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type lna_pointer(lna_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type d_meas_pointer(d_meas_pointerSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(lna_particle_filter(pathmat, draws, obsmat, measproc_indmat, censusmat, lna_times, lna_pars, param_inds, const_inds, tcovar_inds, init_start, param_update_inds, census_indices, event_inds, stoich_matrix, do_prevalence, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, diffusion_sqrt, n_particles, step_size, lna_pointer, set_pars_pointer, ctx_pointer, d_meas_pointer, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// make_lna_workspace
+SEXP make_lna_workspace(int n_events, int n_comps, int n_threads);
+RcppExport SEXP _stemr_make_lna_workspace(SEXP n_eventsSEXP, SEXP n_compsSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type n_events(n_eventsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_comps(n_compsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(make_lna_workspace(n_events, n_comps, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
 // map_draws_2_lna
-void map_draws_2_lna(arma::mat& pathmat, const arma::mat& draws, const arma::rowvec& lna_times, const Rcpp::NumericMatrix& lna_pars, Rcpp::NumericVector& lna_param_vec, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, arma::vec& svd_d, arma::mat& svd_U, arma::mat& svd_V, double step_size, SEXP lna_pointer, SEXP set_pars_pointer);
-RcppExport SEXP _stemr_map_draws_2_lna(SEXP pathmatSEXP, SEXP drawsSEXP, SEXP lna_timesSEXP, SEXP lna_parsSEXP, SEXP lna_param_vecSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP svd_dSEXP, SEXP svd_USEXP, SEXP svd_VSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP) {
+void map_draws_2_lna(arma::mat& pathmat, const arma::mat& draws, const arma::rowvec& lna_times, const Rcpp::NumericMatrix& lna_pars, Rcpp::NumericVector& lna_param_vec, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, arma::vec& svd_d, arma::mat& svd_U, arma::mat& svd_V, double step_size, SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, std::string diffusion_sqrt, Rcpp::Nullable<Rcpp::List> lna_cache, int start_ind, SEXP lna_workspace);
+RcppExport SEXP _stemr_map_draws_2_lna(SEXP pathmatSEXP, SEXP drawsSEXP, SEXP lna_timesSEXP, SEXP lna_parsSEXP, SEXP lna_param_vecSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP svd_dSEXP, SEXP svd_USEXP, SEXP svd_VSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP diffusion_sqrtSEXP, SEXP lna_cacheSEXP, SEXP start_indSEXP, SEXP lna_workspaceSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< arma::mat& >::type pathmat(pathmatSEXP);
@@ -566,13 +712,18 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
     Rcpp::traits::input_parameter< SEXP >::type lna_pointer(lna_pointerSEXP);
     Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
-    map_draws_2_lna(pathmat, draws, lna_times, lna_pars, lna_param_vec, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, svd_d, svd_U, svd_V, step_size, lna_pointer, set_pars_pointer);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< std::string >::type diffusion_sqrt(diffusion_sqrtSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::List> >::type lna_cache(lna_cacheSEXP);
+    Rcpp::traits::input_parameter< int >::type start_ind(start_indSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type lna_workspace(lna_workspaceSEXP);
+    map_draws_2_lna(pathmat, draws, lna_times, lna_pars, lna_param_vec, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, svd_d, svd_U, svd_V, step_size, lna_pointer, set_pars_pointer, ctx_pointer, diffusion_sqrt, lna_cache, start_ind, lna_workspace);
     return R_NilValue;
 END_RCPP
 }
 // map_pars_2_ode
-void map_pars_2_ode(arma::mat& pathmat, const arma::rowvec& ode_times, const Rcpp::NumericMatrix& ode_pars, Rcpp::NumericVector& ode_param_vec, const Rcpp::IntegerVector& ode_param_inds, const Rcpp::IntegerVector& ode_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, double step_size, SEXP ode_pointer, SEXP set_pars_pointer);
-RcppExport SEXP _stemr_map_pars_2_ode(SEXP pathmatSEXP, SEXP ode_timesSEXP, SEXP ode_parsSEXP, SEXP ode_param_vecSEXP, SEXP ode_param_indsSEXP, SEXP ode_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP step_sizeSEXP, SEXP ode_pointerSEXP, SEXP set_pars_pointerSEXP) {
+void map_pars_2_ode(arma::mat& pathmat, const arma::rowvec& ode_times, const Rcpp::NumericMatrix& ode_pars, Rcpp::NumericVector& ode_param_vec, const Rcpp::IntegerVector& ode_param_inds, const Rcpp::IntegerVector& ode_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, double step_size, SEXP ode_pointer, SEXP set_pars_pointer, SEXP ctx_pointer);
+RcppExport SEXP _stemr_map_pars_2_ode(SEXP pathmatSEXP, SEXP ode_timesSEXP, SEXP ode_parsSEXP, SEXP ode_param_vecSEXP, SEXP ode_param_indsSEXP, SEXP ode_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP step_sizeSEXP, SEXP ode_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< arma::mat& >::type pathmat(pathmatSEXP);
@@ -591,10 +742,39 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
     Rcpp::traits::input_parameter< SEXP >::type ode_pointer(ode_pointerSEXP);
     Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
-    map_pars_2_ode(pathmat, ode_times, ode_pars, ode_param_vec, ode_param_inds, ode_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, step_size, ode_pointer, set_pars_pointer);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    map_pars_2_ode(pathmat, ode_times, ode_pars, ode_param_vec, ode_param_inds, ode_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, step_size, ode_pointer, set_pars_pointer, ctx_pointer);
     return R_NilValue;
 END_RCPP
 }
+// map_pars_2_sens
+arma::cube map_pars_2_sens(const arma::mat& pathmat, const arma::rowvec& times, const Rcpp::NumericMatrix& pars, const arma::cube& dpars, const Rcpp::IntegerVector& tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, bool log_scale, double step_size, SEXP proc_pointer, SEXP sens_pointer, SEXP set_pars_pointer, SEXP ctx_pointer);
+RcppExport SEXP _stemr_map_pars_2_sens(SEXP pathmatSEXP, SEXP timesSEXP, SEXP parsSEXP, SEXP dparsSEXP, SEXP tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP log_scaleSEXP, SEXP step_sizeSEXP, SEXP proc_pointerSEXP, SEXP sens_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type pathmat(pathmatSEXP);
+    Rcpp::traits::input_parameter< const arma::rowvec& >::type times(timesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type pars(parsSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type dpars(dparsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type tcovar_inds(tcovar_indsSEXP);
+    Rcpp::traits::input_parameter< const int >::type init_start(init_startSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type param_update_inds(param_update_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type stoich_matrix(stoich_matrixSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< bool >::type log_scale(log_scaleSEXP);
+    Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type proc_pointer(proc_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type sens_pointer(sens_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    rcpp_result_gen = Rcpp::wrap(map_pars_2_sens(pathmat, times, pars, dpars, tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, log_scale, step_size, proc_pointer, sens_pointer, set_pars_pointer, ctx_pointer));
+    return rcpp_result_gen;
+END_RCPP
+}
 // comp_chol
 void comp_chol(arma::mat& C, arma::mat& M);
 RcppExport SEXP _stemr_comp_chol(SEXP CSEXP, SEXP MSEXP) {
@@ -606,6 +786,70 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// adapt_kernel_cov
+void adapt_kernel_cov(arma::vec& kernel_mean, arma::mat& kernel_cov, arma::mat& kernel_chol, arma::mat& kernel_cov_chol, arma::vec& kernel_resid, const arma::vec& pars_est, double gain, double scaling);
+RcppExport SEXP _stemr_adapt_kernel_cov(SEXP kernel_meanSEXP, SEXP kernel_covSEXP, SEXP kernel_cholSEXP, SEXP kernel_cov_cholSEXP, SEXP kernel_residSEXP, SEXP pars_estSEXP, SEXP gainSEXP, SEXP scalingSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< arma::vec& >::type kernel_mean(kernel_meanSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type kernel_cov(kernel_covSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type kernel_chol(kernel_cholSEXP);
+    Rcpp::traits::input_parameter< arma::mat& >::type kernel_cov_chol(kernel_cov_cholSEXP);
+    Rcpp::traits::input_parameter< arma::vec& >::type kernel_resid(kernel_residSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type pars_est(pars_estSEXP);
+    Rcpp::traits::input_parameter< double >::type gain(gainSEXP);
+    Rcpp::traits::input_parameter< double >::type scaling(scalingSEXP);
+    adapt_kernel_cov(kernel_mean, kernel_cov, kernel_chol, kernel_cov_chol, kernel_resid, pars_est, gain, scaling);
+    return R_NilValue;
+END_RCPP
+}
+// open_mcmc_store
+SEXP open_mcmc_store(std::string sample_file, int n_cols, int capacity, int chunk_size, int offset);
+RcppExport SEXP _stemr_open_mcmc_store(SEXP sample_fileSEXP, SEXP n_colsSEXP, SEXP capacitySEXP, SEXP chunk_sizeSEXP, SEXP offsetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type sample_file(sample_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type n_cols(n_colsSEXP);
+    Rcpp::traits::input_parameter< int >::type capacity(capacitySEXP);
+    Rcpp::traits::input_parameter< int >::type chunk_size(chunk_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type offset(offsetSEXP);
+    rcpp_result_gen = Rcpp::wrap(open_mcmc_store(sample_file, n_cols, capacity, chunk_size, offset));
+    return rcpp_result_gen;
+END_RCPP
+}
+// write_mcmc_record
+void write_mcmc_record(SEXP store_pointer, const Rcpp::List& fields);
+RcppExport SEXP _stemr_write_mcmc_record(SEXP store_pointerSEXP, SEXP fieldsSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store_pointer(store_pointerSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type fields(fieldsSEXP);
+    write_mcmc_record(store_pointer, fields);
+    return R_NilValue;
+END_RCPP
+}
+// flush_mcmc_store
+int flush_mcmc_store(SEXP store_pointer);
+RcppExport SEXP _stemr_flush_mcmc_store(SEXP store_pointerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store_pointer(store_pointerSEXP);
+    rcpp_result_gen = Rcpp::wrap(flush_mcmc_store(store_pointer));
+    return rcpp_result_gen;
+END_RCPP
+}
+// close_mcmc_store
+void close_mcmc_store(SEXP store_pointer);
+RcppExport SEXP _stemr_close_mcmc_store(SEXP store_pointerSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store_pointer(store_pointerSEXP);
+    close_mcmc_store(store_pointer);
+    return R_NilValue;
+END_RCPP
+}
 // rmvtn
 arma::mat rmvtn(int n, const arma::rowvec& mu, const arma::mat& sigma);
 RcppExport SEXP _stemr_rmvtn(SEXP nSEXP, SEXP muSEXP, SEXP sigmaSEXP) {
@@ -657,8 +901,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // propose_lna
-Rcpp::List propose_lna(const arma::rowvec& lna_times, const Rcpp::NumericVector& lna_draws, const Rcpp::NumericMatrix& lna_pars, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, int max_attempts, double step_size, SEXP lna_pointer, SEXP set_pars_pointer);
-RcppExport SEXP _stemr_propose_lna(SEXP lna_timesSEXP, SEXP lna_drawsSEXP, SEXP lna_parsSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP max_attemptsSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP) {
+Rcpp::List propose_lna(const arma::rowvec& lna_times, const Rcpp::NumericVector& lna_draws, const Rcpp::NumericMatrix& lna_pars, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, int max_attempts, double step_size, SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, std::string diffusion_sqrt);
+RcppExport SEXP _stemr_propose_lna(SEXP lna_timesSEXP, SEXP lna_drawsSEXP, SEXP lna_parsSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP max_attemptsSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP diffusion_sqrtSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -678,13 +922,15 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
     Rcpp::traits::input_parameter< SEXP >::type lna_pointer(lna_pointerSEXP);
     Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
-    rcpp_result_gen = Rcpp::wrap(propose_lna(lna_times, lna_draws, lna_pars, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, max_attempts, step_size, lna_pointer, set_pars_pointer));
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< std::string >::type diffusion_sqrt(diffusion_sqrtSEXP);
+    rcpp_result_gen = Rcpp::wrap(propose_lna(lna_times, lna_draws, lna_pars, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, max_attempts, step_size, lna_pointer, set_pars_pointer, ctx_pointer, diffusion_sqrt));
     return rcpp_result_gen;
 END_RCPP
 }
 // propose_lna_approx
-Rcpp::List propose_lna_approx(const arma::rowvec& lna_times, const Rcpp::NumericVector& lna_draws, const Rcpp::NumericMatrix& lna_pars, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, int max_attempts, int ess_updates, int ess_warmup, double lna_bracket_width, double step_size, SEXP lna_pointer, SEXP set_pars_pointer);
-RcppExport SEXP _stemr_propose_lna_approx(SEXP lna_timesSEXP, SEXP lna_drawsSEXP, SEXP lna_parsSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP max_attemptsSEXP, SEXP ess_updatesSEXP, SEXP ess_warmupSEXP, SEXP lna_bracket_widthSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP) {
+Rcpp::List propose_lna_approx(const arma::rowvec& lna_times, const Rcpp::NumericVector& lna_draws, const Rcpp::NumericMatrix& lna_pars, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, int max_attempts, int ess_updates, int ess_warmup, double lna_bracket_width, double step_size, SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, std::string diffusion_sqrt);
+RcppExport SEXP _stemr_propose_lna_approx(SEXP lna_timesSEXP, SEXP lna_drawsSEXP, SEXP lna_parsSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP max_attemptsSEXP, SEXP ess_updatesSEXP, SEXP ess_warmupSEXP, SEXP lna_bracket_widthSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP diffusion_sqrtSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -707,7 +953,38 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
     Rcpp::traits::input_parameter< SEXP >::type lna_pointer(lna_pointerSEXP);
     Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
-    rcpp_result_gen = Rcpp::wrap(propose_lna_approx(lna_times, lna_draws, lna_pars, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, max_attempts, ess_updates, ess_warmup, lna_bracket_width, step_size, lna_pointer, set_pars_pointer));
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< std::string >::type diffusion_sqrt(diffusion_sqrtSEXP);
+    rcpp_result_gen = Rcpp::wrap(propose_lna_approx(lna_times, lna_draws, lna_pars, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, max_attempts, ess_updates, ess_warmup, lna_bracket_width, step_size, lna_pointer, set_pars_pointer, ctx_pointer, diffusion_sqrt));
+    return rcpp_result_gen;
+END_RCPP
+}
+// propose_lna_batch
+Rcpp::List propose_lna_batch(const arma::rowvec& lna_times, const arma::cube& lna_draws, const arma::cube& lna_pars, const arma::mat& draw_pars, const Rcpp::IntegerVector& lna_param_inds, const Rcpp::IntegerVector& lna_tcovar_inds, const int init_start, const Rcpp::LogicalVector& param_update_inds, const arma::mat& stoich_matrix, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, double step_size, SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer, std::string diffusion_sqrt, int n_threads);
+RcppExport SEXP _stemr_propose_lna_batch(SEXP lna_timesSEXP, SEXP lna_drawsSEXP, SEXP lna_parsSEXP, SEXP draw_parsSEXP, SEXP lna_param_indsSEXP, SEXP lna_tcovar_indsSEXP, SEXP init_startSEXP, SEXP param_update_indsSEXP, SEXP stoich_matrixSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP step_sizeSEXP, SEXP lna_pointerSEXP, SEXP set_pars_pointerSEXP, SEXP ctx_pointerSEXP, SEXP diffusion_sqrtSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::rowvec& >::type lna_times(lna_timesSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type lna_draws(lna_drawsSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type lna_pars(lna_parsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type draw_pars(draw_parsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type lna_param_inds(lna_param_indsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type lna_tcovar_inds(lna_tcovar_indsSEXP);
+    Rcpp::traits::input_parameter< const int >::type init_start(init_startSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type param_update_inds(param_update_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type stoich_matrix(stoich_matrixSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< double >::type step_size(step_sizeSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type lna_pointer(lna_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type set_pars_pointer(set_pars_pointerSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ctx_pointer(ctx_pointerSEXP);
+    Rcpp::traits::input_parameter< std::string >::type diffusion_sqrt(diffusion_sqrtSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(propose_lna_batch(lna_times, lna_draws, lna_pars, draw_pars, lna_param_inds, lna_tcovar_inds, init_start, param_update_inds, stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, step_size, lna_pointer, set_pars_pointer, ctx_pointer, diffusion_sqrt, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -749,21 +1026,22 @@ BEGIN_RCPP
 END_RCPP
 }
 // retrieve_census_path
-void retrieve_census_path(arma::mat& censusmat, Rcpp::NumericMatrix& path, Rcpp::NumericVector& census_times, Rcpp::IntegerVector& census_columns);
-RcppExport SEXP _stemr_retrieve_census_path(SEXP censusmatSEXP, SEXP pathSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP) {
+void retrieve_census_path(arma::mat& censusmat, Rcpp::NumericMatrix& path, Rcpp::NumericVector& census_times, Rcpp::IntegerVector& census_columns, const Rcpp::Nullable<Rcpp::IntegerVector>& census_inds);
+RcppExport SEXP _stemr_retrieve_census_path(SEXP censusmatSEXP, SEXP pathSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP, SEXP census_indsSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< arma::mat& >::type censusmat(censusmatSEXP);
     Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type path(pathSEXP);
     Rcpp::traits::input_parameter< Rcpp::NumericVector& >::type census_times(census_timesSEXP);
     Rcpp::traits::input_parameter< Rcpp::IntegerVector& >::type census_columns(census_columnsSEXP);
-    retrieve_census_path(censusmat, path, census_times, census_columns);
+    Rcpp::traits::input_parameter< const Rcpp::Nullable<Rcpp::IntegerVector>& >::type census_inds(census_indsSEXP);
+    retrieve_census_path(censusmat, path, census_times, census_columns, census_inds);
     return R_NilValue;
 END_RCPP
 }
 // simulate_gillespie
-arma::mat simulate_gillespie(const arma::mat& flow, const Rcpp::NumericVector& parameters, const Rcpp::NumericVector& constants, const arma::mat& tcovar, double t_max, const arma::rowvec& init_states, const Rcpp::LogicalMatrix& rate_adjmat, const arma::mat& tcovar_adjmat, const arma::mat& tcovar_changemat, const Rcpp::IntegerVector init_dims, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, SEXP rate_ptr);
-RcppExport SEXP _stemr_simulate_gillespie(SEXP flowSEXP, SEXP parametersSEXP, SEXP constantsSEXP, SEXP tcovarSEXP, SEXP t_maxSEXP, SEXP init_statesSEXP, SEXP rate_adjmatSEXP, SEXP tcovar_adjmatSEXP, SEXP tcovar_changematSEXP, SEXP init_dimsSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP rate_ptrSEXP) {
+arma::mat simulate_gillespie(const arma::mat& flow, const Rcpp::NumericVector& parameters, const Rcpp::NumericVector& constants, const arma::mat& tcovar, double t_max, const arma::rowvec& init_states, const Rcpp::LogicalMatrix& rate_adjmat, const arma::mat& tcovar_adjmat, const arma::mat& tcovar_changemat, const Rcpp::IntegerVector init_dims, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, SEXP rate_ptr, Rcpp::Nullable<Rcpp::NumericVector> census_times, Rcpp::Nullable<Rcpp::IntegerVector> census_columns);
+RcppExport SEXP _stemr_simulate_gillespie(SEXP flowSEXP, SEXP parametersSEXP, SEXP constantsSEXP, SEXP tcovarSEXP, SEXP t_maxSEXP, SEXP init_statesSEXP, SEXP rate_adjmatSEXP, SEXP tcovar_adjmatSEXP, SEXP tcovar_changematSEXP, SEXP init_dimsSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP rate_ptrSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -782,7 +1060,39 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
     Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
     Rcpp::traits::input_parameter< SEXP >::type rate_ptr(rate_ptrSEXP);
-    rcpp_result_gen = Rcpp::wrap(simulate_gillespie(flow, parameters, constants, tcovar, t_max, init_states, rate_adjmat, tcovar_adjmat, tcovar_changemat, init_dims, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, rate_ptr));
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type census_times(census_timesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type census_columns(census_columnsSEXP);
+    rcpp_result_gen = Rcpp::wrap(simulate_gillespie(flow, parameters, constants, tcovar, t_max, init_states, rate_adjmat, tcovar_adjmat, tcovar_changemat, init_dims, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, rate_ptr, census_times, census_columns));
+    return rcpp_result_gen;
+END_RCPP
+}
+// simulate_gillespie_batch
+Rcpp::List simulate_gillespie_batch(const arma::mat& flow, const Rcpp::NumericMatrix& parameters, const Rcpp::NumericVector& constants, const arma::cube& tcovar, double t_max, const arma::mat& init_states, const Rcpp::LogicalMatrix& rate_adjmat, const arma::mat& tcovar_adjmat, const arma::mat& tcovar_changemat, const Rcpp::IntegerVector init_dims, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, SEXP rate_ptr, Rcpp::Nullable<Rcpp::NumericVector> census_times, Rcpp::Nullable<Rcpp::IntegerVector> census_columns, int max_attempts, std::string ssa_algorithm, int n_threads);
+RcppExport SEXP _stemr_simulate_gillespie_batch(SEXP flowSEXP, SEXP parametersSEXP, SEXP constantsSEXP, SEXP tcovarSEXP, SEXP t_maxSEXP, SEXP init_statesSEXP, SEXP rate_adjmatSEXP, SEXP tcovar_adjmatSEXP, SEXP tcovar_changematSEXP, SEXP init_dimsSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP rate_ptrSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP, SEXP max_attemptsSEXP, SEXP ssa_algorithmSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type flow(flowSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type parameters(parametersSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector& >::type constants(constantsSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type tcovar(tcovarSEXP);
+    Rcpp::traits::input_parameter< double >::type t_max(t_maxSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type init_states(init_statesSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalMatrix& >::type rate_adjmat(rate_adjmatSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type tcovar_adjmat(tcovar_adjmatSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type tcovar_changemat(tcovar_changematSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector >::type init_dims(init_dimsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type rate_ptr(rate_ptrSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type census_times(census_timesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type census_columns(census_columnsSEXP);
+    Rcpp::traits::input_parameter< int >::type max_attempts(max_attemptsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type ssa_algorithm(ssa_algorithmSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(simulate_gillespie_batch(flow, parameters, constants, tcovar, t_max, init_states, rate_adjmat, tcovar_adjmat, tcovar_changemat, init_dims, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, rate_ptr, census_times, census_columns, max_attempts, ssa_algorithm, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -802,16 +1112,84 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// simulate_tauleap_batch
+Rcpp::List simulate_tauleap_batch(const arma::mat& flow, const Rcpp::NumericMatrix& parameters, const Rcpp::NumericVector& constants, const arma::cube& tcovar, double t_max, const arma::mat& init_states, const arma::vec& census_times, const arma::uvec& census_columns, const Rcpp::LogicalVector& forcing_inds, const arma::uvec& forcing_tcov_inds, const arma::mat& forcings_out, const arma::cube& forcing_transfers, SEXP rate_ptr, int max_attempts, double epsilon, int n_critical, int n_threads);
+RcppExport SEXP _stemr_simulate_tauleap_batch(SEXP flowSEXP, SEXP parametersSEXP, SEXP constantsSEXP, SEXP tcovarSEXP, SEXP t_maxSEXP, SEXP init_statesSEXP, SEXP census_timesSEXP, SEXP census_columnsSEXP, SEXP forcing_indsSEXP, SEXP forcing_tcov_indsSEXP, SEXP forcings_outSEXP, SEXP forcing_transfersSEXP, SEXP rate_ptrSEXP, SEXP max_attemptsSEXP, SEXP epsilonSEXP, SEXP n_criticalSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type flow(flowSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericMatrix& >::type parameters(parametersSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::NumericVector& >::type constants(constantsSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type tcovar(tcovarSEXP);
+    Rcpp::traits::input_parameter< double >::type t_max(t_maxSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type init_states(init_statesSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type census_times(census_timesSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type census_columns(census_columnsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::LogicalVector& >::type forcing_inds(forcing_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type forcing_tcov_inds(forcing_tcov_indsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type forcings_out(forcings_outSEXP);
+    Rcpp::traits::input_parameter< const arma::cube& >::type forcing_transfers(forcing_transfersSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type rate_ptr(rate_ptrSEXP);
+    Rcpp::traits::input_parameter< int >::type max_attempts(max_attemptsSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< int >::type n_critical(n_criticalSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(simulate_tauleap_batch(flow, parameters, constants, tcovar, t_max, init_states, census_times, census_columns, forcing_inds, forcing_tcov_inds, forcings_out, forcing_transfers, rate_ptr, max_attempts, epsilon, n_critical, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// stemr_alloc_count
+double stemr_alloc_count(bool enable);
+RcppExport SEXP _stemr_stemr_alloc_count(SEXP enableSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type enable(enableSEXP);
+    rcpp_result_gen = Rcpp::wrap(stemr_alloc_count(enable));
+    return rcpp_result_gen;
+END_RCPP
+}
+// stemr_profile_enable
+bool stemr_profile_enable(bool enable);
+RcppExport SEXP _stemr_stemr_profile_enable(SEXP enableSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type enable(enableSEXP);
+    rcpp_result_gen = Rcpp::wrap(stemr_profile_enable(enable));
+    return rcpp_result_gen;
+END_RCPP
+}
+// stemr_profile_reset
+void stemr_profile_reset();
+RcppExport SEXP _stemr_stemr_profile_reset() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    stemr_profile_reset();
+    return R_NilValue;
+END_RCPP
+}
+// stemr_profile_counters
+Rcpp::List stemr_profile_counters();
+RcppExport SEXP _stemr_stemr_profile_counters() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(stemr_profile_counters());
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
     {"_stemr_CALL_D_MEASURE", (DL_FUNC) &_stemr_CALL_D_MEASURE, 9},
-    {"_stemr_CALL_INTEGRATE_STEM_ODE", (DL_FUNC) &_stemr_CALL_INTEGRATE_STEM_ODE, 5},
+    {"_stemr_CALL_INTEGRATE_STEM_ODE", (DL_FUNC) &_stemr_CALL_INTEGRATE_STEM_ODE, 8},
     {"_stemr_CALL_RATE_FCN", (DL_FUNC) &_stemr_CALL_RATE_FCN, 7},
     {"_stemr_CALL_R_MEASURE", (DL_FUNC) &_stemr_CALL_R_MEASURE, 8},
-    {"_stemr_CALL_SET_ODE_PARAMS", (DL_FUNC) &_stemr_CALL_SET_ODE_PARAMS, 2},
-    {"_stemr_build_census_path", (DL_FUNC) &_stemr_build_census_path, 3},
+    {"_stemr_build_census_path", (DL_FUNC) &_stemr_build_census_path, 4},
+    {"_stemr_census_row_indices", (DL_FUNC) &_stemr_census_row_indices, 3},
     {"_stemr_census_incidence", (DL_FUNC) &_stemr_census_incidence, 3},
-    {"_stemr_census_latent_path", (DL_FUNC) &_stemr_census_latent_path, 13},
+    {"_stemr_census_latent_path", (DL_FUNC) &_stemr_census_latent_path, 14},
     {"_stemr_compute_incidence", (DL_FUNC) &_stemr_compute_incidence, 3},
     {"_stemr_convert_lna2", (DL_FUNC) &_stemr_convert_lna2, 4},
     {"_stemr_pars2lnapars", (DL_FUNC) &_stemr_pars2lnapars, 2},
@@ -839,26 +1217,43 @@ static const R_CallMethodDef CallEntries[] = {
     {"_stemr_draw_normals2", (DL_FUNC) &_stemr_draw_normals2, 1},
     {"_stemr_sample_unit_sphere", (DL_FUNC) &_stemr_sample_unit_sphere, 1},
     {"_stemr_evaluate_d_measure", (DL_FUNC) &_stemr_evaluate_d_measure, 8},
-    {"_stemr_evaluate_d_measure_LNA", (DL_FUNC) &_stemr_evaluate_d_measure_LNA, 12},
+    {"_stemr_evaluate_d_measure_LNA", (DL_FUNC) &_stemr_evaluate_d_measure_LNA, 13},
     {"_stemr_find_interval", (DL_FUNC) &_stemr_find_interval, 4},
     {"_stemr_insert_tparam", (DL_FUNC) &_stemr_insert_tparam, 4},
-    {"_stemr_integrate_odes", (DL_FUNC) &_stemr_integrate_odes, 14},
+    {"_stemr_integrate_odes", (DL_FUNC) &_stemr_integrate_odes, 15},
+    {"_stemr_integrate_odes_batch", (DL_FUNC) &_stemr_integrate_odes_batch, 17},
+    {"_stemr_lna_ess_block_update", (DL_FUNC) &_stemr_lna_ess_block_update, 49},
     {"_stemr_lna_incid2prev", (DL_FUNC) &_stemr_lna_incid2prev, 8},
-    {"_stemr_map_draws_2_lna", (DL_FUNC) &_stemr_map_draws_2_lna, 20},
-    {"_stemr_map_pars_2_ode", (DL_FUNC) &_stemr_map_pars_2_ode, 16},
+    {"_stemr_lna_particle_filter", (DL_FUNC) &_stemr_lna_particle_filter, 28},
+    {"_stemr_make_lna_workspace", (DL_FUNC) &_stemr_make_lna_workspace, 3},
+    {"_stemr_map_draws_2_lna", (DL_FUNC) &_stemr_map_draws_2_lna, 25},
+    {"_stemr_map_pars_2_ode", (DL_FUNC) &_stemr_map_pars_2_ode, 17},
+    {"_stemr_map_pars_2_sens", (DL_FUNC) &_stemr_map_pars_2_sens, 18},
     {"_stemr_comp_chol", (DL_FUNC) &_stemr_comp_chol, 2},
+    {"_stemr_adapt_kernel_cov", (DL_FUNC) &_stemr_adapt_kernel_cov, 8},
+    {"_stemr_open_mcmc_store", (DL_FUNC) &_stemr_open_mcmc_store, 5},
+    {"_stemr_write_mcmc_record", (DL_FUNC) &_stemr_write_mcmc_record, 2},
+    {"_stemr_flush_mcmc_store", (DL_FUNC) &_stemr_flush_mcmc_store, 1},
+    {"_stemr_close_mcmc_store", (DL_FUNC) &_stemr_close_mcmc_store, 1},
     {"_stemr_rmvtn", (DL_FUNC) &_stemr_rmvtn, 3},
     {"_stemr_dmvtn", (DL_FUNC) &_stemr_dmvtn, 4},
     {"_stemr_normalise", (DL_FUNC) &_stemr_normalise, 2},
     {"_stemr_normalise2", (DL_FUNC) &_stemr_normalise2, 2},
-    {"_stemr_propose_lna", (DL_FUNC) &_stemr_propose_lna, 16},
-    {"_stemr_propose_lna_approx", (DL_FUNC) &_stemr_propose_lna_approx, 19},
+    {"_stemr_propose_lna", (DL_FUNC) &_stemr_propose_lna, 18},
+    {"_stemr_propose_lna_approx", (DL_FUNC) &_stemr_propose_lna_approx, 21},
+    {"_stemr_propose_lna_batch", (DL_FUNC) &_stemr_propose_lna_batch, 19},
     {"_stemr_propose_mvnmh", (DL_FUNC) &_stemr_propose_mvnmh, 4},
     {"_stemr_rate_update_event", (DL_FUNC) &_stemr_rate_update_event, 3},
     {"_stemr_rate_update_tcovar", (DL_FUNC) &_stemr_rate_update_tcovar, 3},
-    {"_stemr_retrieve_census_path", (DL_FUNC) &_stemr_retrieve_census_path, 4},
-    {"_stemr_simulate_gillespie", (DL_FUNC) &_stemr_simulate_gillespie, 15},
+    {"_stemr_retrieve_census_path", (DL_FUNC) &_stemr_retrieve_census_path, 5},
+    {"_stemr_simulate_gillespie", (DL_FUNC) &_stemr_simulate_gillespie, 17},
+    {"_stemr_simulate_gillespie_batch", (DL_FUNC) &_stemr_simulate_gillespie_batch, 20},
     {"_stemr_simulate_r_measure", (DL_FUNC) &_stemr_simulate_r_measure, 6},
+    {"_stemr_simulate_tauleap_batch", (DL_FUNC) &_stemr_simulate_tauleap_batch, 17},
+    {"_stemr_stemr_alloc_count", (DL_FUNC) &_stemr_stemr_alloc_count, 1},
+    {"_stemr_stemr_profile_enable", (DL_FUNC) &_stemr_stemr_profile_enable, 1},
+    {"_stemr_stemr_profile_reset", (DL_FUNC) &_stemr_stemr_profile_reset, 0},
+    {"_stemr_stemr_profile_counters", (DL_FUNC) &_stemr_stemr_profile_counters, 0},
     {NULL, NULL, 0}
 };
 
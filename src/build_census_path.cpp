@@ -1,6 +1,7 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_census.h"
 
 using namespace arma;
 using namespace Rcpp;
@@ -11,34 +12,91 @@ using namespace Rcpp;
 //' @param census_times vector of census times.
 //' @param census_columns vector of column indices to be censused (C++ indexing
 //'   beginning at 0).
+//' @param census_inds optional vector of the rows of the path at the census
+//'   times (C++ indexing beginning at 0), as returned by
+//'   \code{census_row_indices}. If the times in the path are the same for many
+//'   calls, e.g., for the time-varying covariates, the rows may be computed once
+//'   and reused.
 //'
 //' @return matrix containing the compartment counts at census times.
 //' @export
 // [[Rcpp::export]]
 arma::mat build_census_path(Rcpp::NumericMatrix& path,
-                            Rcpp::NumericVector& census_times, 
-                            Rcpp::IntegerVector& census_columns) {
+                            Rcpp::NumericVector& census_times,
+                            Rcpp::IntegerVector& census_columns,
+                            const Rcpp::Nullable<Rcpp::IntegerVector>& census_inds = R_NilValue) {
 
         // get dimensions
         int n_census_times = census_times.size();
-        int n_comps = census_columns.size();
-
-        Rcpp::IntegerVector path_dims = path.attr("dim");
-
-        // get path matrix pointers
-        arma::mat path_mat(path.begin(), path_dims[0], path_dims[1], false);
+        int n_comps        = census_columns.size();
+        int n_rows         = path.nrow();
 
         // initialize census matrix
         arma::mat census_matrix(n_census_times, n_comps + 1);
-        census_matrix.col(0) = Rcpp::as<arma::colvec>(census_times);
+        std::copy(census_times.begin(), census_times.end(), census_matrix.begin());
+
+        try{
+                for(int c = 0; c < n_comps; ++c) {
+                        if(census_columns[c] < 0 || census_columns[c] >= path.ncol()) {
+                                throw std::runtime_error("The census columns must be columns of the path.");
+                        }
+                }
+
+                // rows of the path at the census times, read from the time column in place
+                Rcpp::IntegerVector row_inds;
+                if(census_inds.isNotNull()) {
+                        row_inds = Rcpp::IntegerVector(census_inds.get());
+                        if(row_inds.size() != n_census_times) {
+                                throw std::runtime_error("There must be one census index per census time.");
+                        }
+                } else {
+                        row_inds = Rcpp::IntegerVector(n_census_times);
+                        census_row_inds(path.begin(), n_rows, census_times.begin(), n_census_times, false, row_inds.begin());
+                }
 
-        // get vector of times in the path matrix and the census time indices
-        Rcpp::NumericVector timevec = path(_,0);
-        Rcpp::IntegerVector census_inds(n_census_times);
-        census_inds = find_interval(census_times, timevec, false, false) - 1; // rightmost_closed = true, all.inside = true
+                for(int k = 0; k < n_census_times; ++k) {
+                        if(row_inds[k] < 0 || row_inds[k] >= n_rows) {
+                                throw std::runtime_error("The census times must not precede the first time in the path.");
+                        }
+                }
 
-        // fill out the census matrix
-        census_matrix.cols(1, n_comps) = path_mat.submat(Rcpp::as<arma::uvec>(census_inds), Rcpp::as<arma::uvec>(census_columns));
+                // fill out the census matrix
+                census_gather(path.begin(), n_rows, census_columns.begin(), n_comps, row_inds.begin(),
+                              n_census_times, census_matrix.memptr());
+
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
 
         return census_matrix;
-}
\ No newline at end of file
+}
+
+//' Find the rows of a path at a sequence of census times.
+//'
+//' For each census time, finds the last row of the path at or before it, in a
+//' single pass over the times in the path if the census times are sorted. The
+//' rows may be supplied to \code{build_census_path} and
+//' \code{retrieve_census_path} when many paths with the same times are
+//' censused.
+//'
+//' @param path_times vector of sorted times in the path, i.e., its first column.
+//' @param census_times vector of census times.
+//' @param all_inside should the rows be clamped to exclude the last row of the
+//'   path, as in \code{retrieve_census_path}? Defaults to FALSE.
+//'
+//' @return vector of row indices (C++ indexing beginning at 0), -1 for census
+//'   times before the first time in the path.
+//' @export
+// [[Rcpp::export]]
+Rcpp::IntegerVector census_row_indices(const Rcpp::NumericVector& path_times,
+                                       const Rcpp::NumericVector& census_times,
+                                       bool all_inside = false) {
+
+        Rcpp::IntegerVector inds(census_times.size());
+        census_row_inds(path_times.begin(), path_times.size(), census_times.begin(), census_times.size(),
+                        all_inside, inds.begin());
+
+        return inds;
+}
@@ -6,6 +6,11 @@ using namespace Rcpp;
 
 //' Construct a matrix containing the incidence counts at a sequence of census times.
 //'
+//' The incidence in each row of the incidence matrix is added to the census
+//' interval it falls in, in a single pass over the incidence matrix, so that
+//' the cost is linear in its number of rows rather than in the product of the
+//' numbers of rows and census times.
+//'
 //' @param incid_mat matrix with incidence counts
 //' @param census_times vector of census times
 //' @param interval_inds interval indices, generated by a call to findInterval with left.open=T
@@ -16,17 +21,30 @@ using namespace Rcpp;
 arma::mat census_incidence(const arma::mat& incid_mat, const arma::vec& census_times, const arma::uvec& interval_inds) {
 
         int n_times  = census_times.n_elem;
+        int n_rows   = incid_mat.n_rows;
         int n_events = incid_mat.n_cols - 1;
-        arma::uvec col_inds = Rcpp::as<arma::uvec>(Rcpp::wrap(Rcpp::seq(1,n_events)));
         arma::mat censusmat(n_times, incid_mat.n_cols, arma::fill::zeros);
         censusmat.col(0) = census_times;
 
-        // get interval indices
-        for(int k=0; k<n_times; ++k) {
-                censusmat(k, arma::span(1, n_events)) =
-                        arma::sum(incid_mat(arma::find(interval_inds==k), col_inds), 0);
+        try{
+                if((int)interval_inds.n_elem != n_rows) {
+                        throw std::runtime_error("There must be one interval index per row of the incidence matrix.");
+                }
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+
+        // accumulate the incidence in each census interval, rows after the last census time are dropped
+        for(int e = 1; e <= n_events; ++e) {
+                const double* incid = incid_mat.colptr(e);
+                double* census      = censusmat.colptr(e);
+
+                for(int i = 0; i < n_rows; ++i) {
+                        if(interval_inds[i] < (arma::uword)n_times) census[interval_inds[i]] += incid[i];
+                }
         }
 
         return censusmat;
 }
-
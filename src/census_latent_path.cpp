@@ -1,5 +1,7 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include <RcppArmadillo.h>
+#include "stemr_lna.h"
+#include "stemr_forcings.h"
 
 using namespace arma;
 using namespace Rcpp;
@@ -18,6 +20,9 @@ using namespace Rcpp;
 //'   time-varying covariance matrix a forcing is applied.
 //' @param parmat matrix with parameters, constants, and time varying
 //'   covariates and parameters.
+//' @param lna_workspace optional workspace returned by make_lna_workspace, in
+//'   which the forcing operators and the census increments are kept across
+//'   calls instead of being allocated in each call.
 //'
 //' @return matrix containing the compartment counts at census times.
 //' @export
@@ -35,69 +40,97 @@ void census_latent_path(
                 const arma::uvec& forcing_tcov_inds,
                 const arma::mat& forcings_out,
                 const arma::cube& forcing_transfers,
-                arma::uvec row0 = 0) {
+                arma::uvec row0 = 0,
+                SEXP lna_workspace = R_NilValue) {
+
+        profile_scope scope(PROFILE_CENSUS_LATENT_PATH);
 
         // get dimensions
         int n_census_times  = census_inds.n_elem;
         int n_comps         = flow_matrix.n_cols;
         int n_rates         = flow_matrix.n_rows;
-        int n_forcings      = forcing_tcov_inds.n_elem;
 
-        // for use with forcings
-        double forcing_flow = 0;
-        arma::vec forcing_distvec(n_comps, arma::fill::zeros);
+        // use the workspace if supplied, otherwise allocate one for this call
+        std::unique_ptr<lna_scratch> ws_local;
+        lna_scratch& ws = lna_workspace_ref(lna_workspace, ws_local, n_rates, n_comps);
+
+        // forcings compiled into sparse transfer operators, held by the workspace
+        forcing_engine& forcings = ws.forcing_ops(forcing_tcov_inds, forcings_out, forcing_transfers);
+
+        // incidence indices, not copied
+        Rcpp::IntegerVector incid_inds;
+        if(event_inds.isNotNull()) incid_inds = Rcpp::IntegerVector(event_inds.get());
+        int n_census_events = incid_inds.size();
+
+        // events whose increments over the census intervals are needed, all of
+        // them for the prevalence, otherwise only the censused ones
+        std::vector<char>& needed = ws.census_needed;
+        needed.assign(n_rates, do_prevalence);
+        for(int j = 0; j < n_census_events; ++j) needed[incid_inds[j] - 1] = 1;
 
-        // get incidence indices
-        if (event_inds.isNotNull()) {
+        // increments of the events over each census interval, with the events
+        // in the rows, obtained in a single pass down each column of the path.
+        // The running sum is restarted at each census index, rather than
+        // differencing the cumulative sum, so the increments do not lose
+        // precision to the cumulative incidence.
+        int n_intervals = std::max(n_census_times - 1, 0);
+        arma::mat& increments = ws.census_increments;
+        increments.set_size(n_rates, n_intervals);
 
-                // convert incidence indices to an arma::uvec
-                arma::uvec incid_inds = Rcpp::as<arma::uvec>(event_inds);
+        for(int e = 0; e < n_rates; ++e) {
 
-                // get indices in the census_path matrix to keep incidence
-                int n_census_events = incid_inds.n_elem;
-                int incid_start = flow_matrix.n_cols + 1;
+                if(!needed[e]) continue;
+
+                const double* event_col = path.colptr(e + 1);
+                int r = census_inds[0] + 1;
 
-                // census the incidence increments
                 for(int k = 1; k < n_census_times; ++k) {
 
-                        for(int j = 0; j < n_census_events; ++j) {
-                                census_path(k-1, incid_start + j) =
-                                        arma::sum(path(arma::span(census_inds[k-1]+1, census_inds[k]), incid_inds[j]));
-                        }
+                        double incid = 0;
+                        for(int r_end = static_cast<int>(census_inds[k]); r <= r_end; ++r) incid += event_col[r];
 
+                        increments(e, k-1) = incid;
                 }
         }
 
+        // census the incidence increments
+        int incid_start = n_comps + 1;
+
+        for(int j = 0; j < n_census_events; ++j) {
+
+                const double* incid_row = increments.memptr() + (incid_inds[j] - 1);
+                double* census_col      = census_path.colptr(incid_start + j);
+
+                for(int k = 0; k < n_intervals; ++k) census_col[k] = incid_row[k * n_rates];
+        }
+
         // compute the prevalence if called for
         if(do_prevalence) {
 
-              // initialize the state and increment vectors
-              arma::rowvec state(n_comps);
-              arma::rowvec increment(n_rates, arma::fill::zeros);
-
-              state = parmat.submat(row0, initdist_inds);
+              // initialize the state
+              arma::vec& state = ws.census_state;
+              state.set_size(n_comps);
+              for(int c=0; c < n_comps; ++c) state[c] = parmat(row0[0], initdist_inds[c]);
 
               for(int k=1; k < n_census_times-1; ++k) {
 
-                    // numbers of transitions
-                    increment = arma::sum(path(arma::span(census_inds[k-1] + 1, census_inds[k]),
-                                               arma::span(1, n_rates)), 0);
-
                     // new state
-                    state += increment * flow_matrix;
+                    const double* increment = increments.colptr(k-1);
+
+                    for(int e=0; e < n_rates; ++e) {
+                          if(increment[e] != 0) {
+                                for(int c=0; c < n_comps; ++c) state[c] += increment[e] * flow_matrix(e, c);
+                          }
+                    }
 
                     // save state
-                    census_path(k-1, arma::span(1, n_comps)) = state;
+                    for(int c=0; c < n_comps; ++c) census_path(k-1, c+1) = state[c];
 
                     // apply forcings if called for - applied after censusing the path
                     if(forcing_inds[k]) {
 
                           // distribute the forcings proportionally to the compartment counts in the applicable states
-                          for(int s=0; s < n_forcings; ++s) {
-                                forcing_flow     = parmat(k, forcing_tcov_inds[s]);
-                                forcing_distvec  = forcing_flow * normalise(forcings_out.col(s) % state, 1);
-                                state           += forcing_transfers.slice(s) * forcing_distvec;
-                          }
+                          forcings.apply(state.memptr(), parmat, k);
                     }
               }
         }
@@ -1,18 +1,23 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include <RcppArmadillo.h>
+#include "stemr_rng.h"
 
 using namespace Rcpp;
 using namespace arma;
 
 //' Draw new N(0,1) values and fill a vector.
 //'
+//' The draws are generated by stemr's counter-based RNG, seeded from R's RNG
+//' so that they are reproducible under \code{set.seed}, and written directly
+//' into the vector.
+//'
 //' @param v vector to fill with new N(0,1) draws
 //'
 //' @return draw new values in place
 //' @export
 // [[Rcpp::export]]
 void draw_normals(arma::vec& v) {
-      std::copy_n(Rcpp::rnorm(v.n_elem).begin(), v.n_elem, v.begin());
+      fill_normals(v.memptr(), v.n_elem);
 }
 
 //' Draw new N(0,1) values and fill a matrix.
@@ -23,7 +28,7 @@ void draw_normals(arma::vec& v) {
 //' @export
 // [[Rcpp::export]]
 void draw_normals2(arma::mat& M) {
-      std::copy_n(Rcpp::rnorm(M.n_elem).begin(), M.n_elem, M.begin());
+      fill_normals(M.memptr(), M.n_elem);
 }
 
 //' Sample the unit sphere.
@@ -34,6 +39,6 @@ void draw_normals2(arma::mat& M) {
 //' @export
 // [[Rcpp::export]]
 void sample_unit_sphere(arma::vec& v) {
-      std::copy_n(Rcpp::rnorm(v.n_elem).begin(), v.n_elem, v.begin());
-      v = arma::normalise(v, 2);
+      fill_normals(v.memptr(), v.n_elem);
+      v /= arma::norm(v, 2);
 }
@@ -28,9 +28,12 @@ void evaluate_d_measure(Rcpp::NumericMatrix& emitmat, const Rcpp::NumericMatrix&
         // get dimensions
         Rcpp::IntegerVector emit_dims = emitmat.attr("dim");
 
+        // resolve the density once, rather than for each observation time
+        d_measure_ptr fun = *Rcpp::XPtr<d_measure_ptr>(d_meas_ptr);
+
         // evaluate the densities
         for(int j=0; j < emit_dims[0]; ++j) {
-                // args: emitmat, emit_inds, record_ind, record, state, parameters, constants, tcovar, pointer
-                CALL_D_MEASURE(emitmat, measproc_indmat.row(j), j, obsmat.row(j), statemat.row(j), parameters, constants, tcovar_censusmat.row(j), d_meas_ptr);
+                // args: emitmat, emit_inds, record_ind, record, state, parameters, constants, tcovar
+                fun(emitmat, measproc_indmat.row(j), j, obsmat.row(j), statemat.row(j), parameters, constants, tcovar_censusmat.row(j));
         }
 }
\ No newline at end of file
@@ -24,7 +24,11 @@ using namespace Rcpp;
 //'   should be updated.
 //' @param census_indices vector of indices when the LNA path has been censused.
 //' @param param_vec vector for keeping the current lna parameters
-//' @param d_meas_ptr external pointer to measurement process density function
+//' @param d_meas_ptr external pointer to measurement process density function,
+//'   either evaluated one observation time at a time, or column-batched over
+//'   all observation times
+//' @param start_ind index of the first observation time at which the density
+//'   should be evaluated, the rows of emitmat for earlier times are left as is.
 //'
 //' @export
 // [[Rcpp::export]]
@@ -34,7 +38,9 @@ void evaluate_d_measure_LNA(
                 const Rcpp::NumericMatrix& parameters, const Rcpp::IntegerVector& param_inds,
                 const Rcpp::IntegerVector& const_inds, const Rcpp::IntegerVector& tcovar_inds,
                 const Rcpp::LogicalVector& param_update_inds, const Rcpp::IntegerVector& census_indices,
-                Rcpp::NumericVector& param_vec, SEXP d_meas_ptr) {
+                Rcpp::NumericVector& param_vec, SEXP d_meas_ptr, int start_ind = 0) {
+
+        profile_scope scope(PROFILE_EVALUATE_D_MEASURE_LNA);
 
         // get constants
         int n_obstimes   = obsmat.nrow();
@@ -44,9 +50,55 @@ void evaluate_d_measure_LNA(
         std::copy(parameters.row(0).begin(), 
                   parameters.row(0).end(), 
                   param_vec.begin());
+
+        // recover the time-varying covariates/parameters at the first evaluated time
+        for(int j=start_ind-1; j >= 0; --j) {
+                if(param_update_inds[j]) {
+                      std::copy(parameters.row(census_indices[j+1]).end() - n_tcovar,
+                                parameters.row(census_indices[j+1]).end(),
+                                param_vec.end() - n_tcovar);
+                      break;
+                }
+        }
         
+        // column-batched density, evaluated in a single call given the rows of
+        // the parameter matrix with the time-varying covariates at each time
+        if(R_ExternalPtrTag(d_meas_ptr) == Rf_install("d_measure_batch")) {
+
+                Rcpp::XPtr<d_measure_batch_ptr> xpfun(d_meas_ptr);
+                d_measure_batch_ptr fun = *xpfun;
+
+                std::vector<double> pars(param_inds.size());
+                std::vector<double> consts(const_inds.size());
+                for(int k=0; k < param_inds.size(); ++k) pars[k] = param_vec[param_inds[k]];
+                for(int k=0; k < const_inds.size(); ++k) consts[k] = param_vec[const_inds[k]];
+
+                // row of the parameter matrix holding the time-varying covariates
+                int tcovar_row = 0;
+                for(int j=start_ind-1; j >= 0; --j) {
+                        if(param_update_inds[j]) {
+                                tcovar_row = census_indices[j+1];
+                                break;
+                        }
+                }
+
+                std::vector<int> tcovar_rows(n_obstimes);
+                for(int j=start_ind; j < n_obstimes; ++j) {
+                        if(param_update_inds[j]) tcovar_row = census_indices[j+1];
+                        tcovar_rows[j] = tcovar_row;
+                }
+
+                fun(emitmat, measproc_indmat, obsmat, censusmat, pars.data(), consts.data(),
+                    parameters, tcovar_rows.data(), tcovar_inds.begin(), start_ind);
+
+                return;
+        }
+
+        // resolve the density once, rather than for each observation time
+        d_measure_ptr fun = *Rcpp::XPtr<d_measure_ptr>(d_meas_ptr);
+
         // evaluate the densities
-        for(int j=0; j < n_obstimes; ++j) {
+        for(int j=start_ind; j < n_obstimes; ++j) {
 
                 // update the model parameters if called for
                 // measurement process is right continuous, hence indexing by j+1, not j
@@ -56,9 +108,8 @@ void evaluate_d_measure_LNA(
                                 param_vec.end() - n_tcovar);
                 }
 
-                // args: emitmat, emit_inds, record_ind, record, state, parameters, constants, tcovar, pointer
-                CALL_D_MEASURE(emitmat, measproc_indmat.row(j), j, obsmat.row(j), censusmat.row(j),
-                               param_vec[param_inds], param_vec[const_inds], 
-                               param_vec[tcovar_inds], d_meas_ptr);
+                // args: emitmat, emit_inds, record_ind, record, state, parameters, constants, tcovar
+                fun(emitmat, measproc_indmat.row(j), j, obsmat.row(j), censusmat.row(j),
+                    param_vec[param_inds], param_vec[const_inds], param_vec[tcovar_inds]);
         }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_forcings.h"
 
 using namespace Rcpp;
 using namespace arma;
@@ -24,6 +25,8 @@ using namespace arma;
 //' @param ode_pointer external pointer to ode integration function.
 //' @param set_pars_pointer external pointer to the function for setting the ode
 //'   parameters.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
 //'
 //' @return List containing the ODE incidence and prevalence paths.
 //'
@@ -42,24 +45,29 @@ Rcpp::List integrate_odes(const arma::rowvec& ode_times,
                        const arma::cube& forcing_transfers,
                        double step_size,
                        SEXP ode_pointer,
-                       SEXP set_pars_pointer) {
+                       SEXP set_pars_pointer,
+                       SEXP ctx_pointer) {
+
+        profile_scope scope(PROFILE_INTEGRATE_ODES);
 
         // get the dimensions of various objects
         int n_events = stoich_matrix.n_cols;         // number of transition events, e.g., S2I, I2R
         int n_comps  = stoich_matrix.n_rows;         // number of model compartments (all strata)
         int n_times  = ode_times.n_elem;             // number of times at which the ODEs must be evaluated
         int n_tcovar = ode_tcovar_inds.size();   // number of time-varying covariates or parameters
-        int n_forcings = forcing_tcov_inds.n_elem;   // number of forcings
         
-        // for use with forcings
-        double forcing_flow = 0;
-        arma::vec forcing_distvec(n_comps, arma::fill::zeros);
+        // forcings compiled into sparse transfer operators
+        forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers);
         
         // initialize the objects used in each time interval
         double t_L = 0;
         double t_R = 0;
+
+        // allocate the integrator context for this call
+        ode_context ctx(ode_pointer, set_pars_pointer, ctx_pointer);
+
         Rcpp::NumericVector current_params = ode_pars.row(0);   // vector for storing the current parameter values
-        CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+        ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
         
         // initial state vector - copy elements from the current parameter vector
         arma::vec init_volumes(current_params.begin() + init_start, n_comps);
@@ -67,6 +75,17 @@ Rcpp::List integrate_odes(const arma::rowvec& ode_times,
         // initialize the ODE objects - the vector for storing the current state
         Rcpp::NumericVector ode_state_vec(n_events);   // vector to store the ODEs
 
+        // Between the times where the parameters are updated or forcings are
+        // applied, resetting the ODEs and setting the compartment volumes at
+        // each time leaves the path unchanged. If the compiled code supports it,
+        // the cumulative incidence over each such segment is integrated in a
+        // single sweep, keeping the adapted step size, and the increments are
+        // differences of the cumulative incidence at consecutive times.
+        bool single_sweep = ctx.can_integrate_times();
+        arma::mat sweep_path;                        // cumulative incidence at the times in a segment
+        int seg_start = 0;                           // index of the first time in the current segment
+        int seg_end   = 0;                           // index of the last time in the current segment
+
         // matrix in which to store the ODE path
         arma::mat incid_path(n_events+1, n_times, arma::fill::zeros); // incidence path
         arma::mat prev_path(n_comps+1, n_times, arma::fill::zeros);   // prevalence path (compartment volumes)
@@ -78,12 +97,7 @@ Rcpp::List integrate_odes(const arma::rowvec& ode_times,
         if(forcing_inds[0]) {
               
               // distribute the forcings proportionally to the compartment counts in the applicable states
-              for(int j=0; j < n_forcings; ++j) {
-                    
-                    forcing_flow       = ode_pars(0, forcing_tcov_inds[j]);
-                    forcing_distvec    = forcing_flow * normalise(forcings_out.col(j) % init_volumes, 1);
-                    init_volumes      += forcing_transfers.slice(j) * forcing_distvec;
-              }
+              forcings.apply(init_volumes.memptr(), ode_pars, 0);
         }
 
         // iterate over the time sequence, solving the ODEs over each interval
@@ -93,9 +107,31 @@ Rcpp::List integrate_odes(const arma::rowvec& ode_times,
                 t_L = ode_times[j];
                 t_R = ode_times[j+1];
 
-                // Reset the ODE state vector and integrate the ODEs over the next interval
-                std::fill(ode_state_vec.begin(), ode_state_vec.end(), 0.0);
-                CALL_INTEGRATE_STEM_ODE(ode_state_vec, t_L, t_R, step_size, ode_pointer);
+                if(single_sweep) {
+
+                        // integrate over the next segment if the current one is finished
+                        if(j == seg_end) {
+                                seg_start = j;
+                                seg_end   = j + 1;
+                                while(seg_end < (n_times-1) && !param_update_inds[seg_end] && !forcing_inds[seg_end]) ++seg_end;
+
+                                sweep_path.set_size(n_events, seg_end - seg_start + 1);
+                                std::fill(ode_state_vec.begin(), ode_state_vec.end(), 0.0);
+                                ctx.integrate_times(ode_state_vec.begin(), ode_times.memptr() + seg_start,
+                                                    seg_end - seg_start + 1, step_size, sweep_path.memptr());
+                        }
+
+                        // incidence over the interval
+                        for(int k=0; k < n_events; ++k) {
+                                ode_state_vec[k] = sweep_path(k, j - seg_start + 1) - sweep_path(k, j - seg_start);
+                        }
+
+                } else {
+
+                        // Reset the ODE state vector and integrate the ODEs over the next interval
+                        std::fill(ode_state_vec.begin(), ode_state_vec.end(), 0.0);
+                        ctx.integrate(ode_state_vec.begin(), t_L, t_R, step_size);
+                }
 
                 // compute the compartment volumes
                 init_volumes += stoich_matrix * Rcpp::as<arma::vec>(ode_state_vec);
@@ -108,12 +144,7 @@ Rcpp::List integrate_odes(const arma::rowvec& ode_times,
                 if(forcing_inds[j+1]) {
                       
                       // distribute the forcings proportionally to the compartment counts in the applicable states
-                      for(int s=0; s < n_forcings; ++s) {
-                            
-                            forcing_flow       = ode_pars(j+1, forcing_tcov_inds[s]);
-                            forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                            init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                      }
+                      forcings.apply(init_volumes.memptr(), ode_pars, j+1);
                 }
 
                 // ensure the initial volumes are non-negative
@@ -142,8 +173,9 @@ Rcpp::List integrate_odes(const arma::rowvec& ode_times,
                 // copy the compartment volumes to the current parameters
                 std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
                 
-                // set the ODE parameters and reset the ODE state vector
-                CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+                // set the ODE parameters and reset the ODE state vector, within a
+                // segment the volumes at its start are still in use
+                if(!single_sweep || j+1 == seg_end) ctx.set_pars(current_params.begin());
         }
         
         // return the paths
@@ -0,0 +1,264 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include "stemr_types.h"
+#include "stemr_utils.h"
+#include "stemr_forcings.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace Rcpp;
+using namespace arma;
+
+// Integrate the ODEs for a single parameter draw. Mirrors integrate_odes, but
+// only uses armadillo objects so that it may be called from a worker thread,
+// and writes the paths into slices of preallocated cubes, with the times in
+// the rows. Returns false if the compartment volumes became negative.
+static bool ode_path(ode_context& ctx,
+                     arma::mat& incid_path,
+                     arma::mat& prev_path,
+                     arma::vec& current_params,
+                     arma::vec& ode_state_vec,
+                     arma::mat& sweep_path,
+                     const arma::rowvec& ode_times,
+                     const arma::mat& ode_pars,
+                     const double* draw_pars,
+                     int n_draw_pars,
+                     int n_tcovar,
+                     int init_start,
+                     const std::vector<int>& param_update_inds,
+                     const arma::mat& stoich_matrix,
+                     const std::vector<int>& forcing_inds,
+                     const arma::uvec& forcing_tcov_inds,
+                     const arma::mat& forcings_out,
+                     const arma::cube& forcing_transfers,
+                     double step_size) {
+
+        int n_events   = stoich_matrix.n_cols;
+        int n_comps    = stoich_matrix.n_rows;
+        int n_times    = ode_times.n_elem;
+
+        // forcings compiled into sparse transfer operators
+        forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers);
+
+        // parameters and initial volumes for this draw
+        current_params = ode_pars.row(0).t();
+        std::copy(draw_pars, draw_pars + n_draw_pars, current_params.begin());
+        ctx.set_pars(current_params.memptr());
+
+        arma::vec init_volumes(current_params.memptr() + init_start, n_comps);
+
+        // single sweeps between parameter updates and forcings, as in integrate_odes
+        bool single_sweep = ctx.can_integrate_times();
+        int seg_start = 0;
+        int seg_end   = 0;
+
+        incid_path.col(0) = ode_times.t();
+        prev_path.col(0)  = ode_times.t();
+        incid_path(0, arma::span(1, n_events)).zeros();
+        prev_path(0, arma::span(1, n_comps)) = init_volumes.t();
+
+        // apply forcings if called for - applied after censusing at the first time
+        if(forcing_inds[0]) {
+                forcings.apply(init_volumes.memptr(), ode_pars, 0);
+        }
+
+        for(int j=0; j < (n_times-1); ++j) {
+
+                if(single_sweep) {
+
+                        // integrate over the next segment if the current one is finished
+                        if(j == seg_end) {
+                                seg_start = j;
+                                seg_end   = j + 1;
+                                while(seg_end < (n_times-1) && !param_update_inds[seg_end] && !forcing_inds[seg_end]) ++seg_end;
+
+                                sweep_path.set_size(n_events, seg_end - seg_start + 1);
+                                ode_state_vec.zeros();
+                                ctx.integrate_times(ode_state_vec.memptr(), ode_times.memptr() + seg_start,
+                                                    seg_end - seg_start + 1, step_size, sweep_path.memptr());
+                        }
+
+                        // incidence over the interval
+                        ode_state_vec = sweep_path.col(j - seg_start + 1) - sweep_path.col(j - seg_start);
+
+                } else {
+                        ode_state_vec.zeros();
+                        ctx.integrate(ode_state_vec.memptr(), ode_times[j], ode_times[j+1], step_size);
+                }
+
+                // compute the compartment volumes and save the increment and volumes
+                init_volumes += stoich_matrix * ode_state_vec;
+                incid_path(j+1, arma::span(1, n_events)) = ode_state_vec.t();
+                prev_path(j+1, arma::span(1, n_comps))   = init_volumes.t();
+
+                // apply forcings if called for - applied after censusing the path
+                if(forcing_inds[j+1]) {
+                        forcings.apply(init_volumes.memptr(), ode_pars, j+1);
+                }
+
+                // the compartment volumes must be non-negative
+                if(any(init_volumes < 0)) return false;
+
+                // update the time-varying covariates and parameters
+                if(param_update_inds[j+1]) {
+                        for(int c = current_params.n_elem - n_tcovar; c < (int)current_params.n_elem; ++c) {
+                                current_params[c] = ode_pars(j+1, c);
+                        }
+                }
+
+                // copy the compartment volumes to the current parameters
+                std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
+
+                // within a segment the volumes at its start are still in use
+                if(!single_sweep || j+1 == seg_end) ctx.set_pars(current_params.memptr());
+        }
+
+        return true;
+}
+
+//' Integrate the ODEs for a batch of parameter draws.
+//'
+//' Obtains the deterministic paths for many parameter draws, e.g., for
+//' posterior predictive checks or for sampling from the prior, in a single
+//' call. The integrator functions are resolved once and each thread uses its
+//' own integrator context, so the draws are distributed over a pool of threads.
+//' The paths are written into preallocated arrays and no intermediate R objects
+//' are created for each draw.
+//'
+//' @param ode_times vector of interval endpoint times
+//' @param ode_pars array of matrices of parameters, constants, and time-varying
+//'   covariates at each of the ode_times, either with a single slice shared by
+//'   all draws or with one slice per draw
+//' @param draw_pars matrix with one row per draw of the parameters and initial
+//'   compartment volumes, copied into the first columns of the first row of the
+//'   parameter matrix
+//' @param ode_param_inds indices of the parameters
+//' @param ode_tcovar_inds indices of the time-varying covariates
+//' @param init_start index in the parameter vector where the initial compartment
+//'   volumes start
+//' @param param_update_inds logical vector indicating at which of the times the
+//'   ode parameters need to be updated.
+//' @param stoich_matrix stoichiometry matrix giving the changes to compartments
+//'   from each reaction
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_tcov_inds indices of the time-varying covariates for the
+//'   forcings
+//' @param forcings_out matrix indicating the compartments that forcings flow out
+//'   of
+//' @param forcing_transfers array of forcing transfer matrices
+//' @param step_size initial step size for the ODE solver
+//' @param ode_pointer external pointer to ode integration function.
+//' @param set_pars_pointer external pointer to the function for setting the ode
+//'   parameters.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
+//' @param n_threads number of threads
+//'
+//' @return List containing arrays with the ODE incidence and prevalence paths,
+//'   with one slice per draw laid out as in the output of
+//'   \code{integrate_odes}, and a logical vector indicating which draws were
+//'   integrated successfully. Slices for the failed draws are filled with NA.
+//' @export
+// [[Rcpp::export]]
+Rcpp::List integrate_odes_batch(const arma::rowvec& ode_times,
+                                const arma::cube& ode_pars,
+                                const arma::mat& draw_pars,
+                                const Rcpp::IntegerVector& ode_param_inds,
+                                const Rcpp::IntegerVector& ode_tcovar_inds,
+                                const int init_start,
+                                const Rcpp::LogicalVector& param_update_inds,
+                                const arma::mat& stoich_matrix,
+                                const Rcpp::LogicalVector& forcing_inds,
+                                const arma::uvec& forcing_tcov_inds,
+                                const arma::mat& forcings_out,
+                                const arma::cube& forcing_transfers,
+                                double step_size,
+                                SEXP ode_pointer,
+                                SEXP set_pars_pointer,
+                                SEXP ctx_pointer,
+                                int n_threads = 1) {
+
+        int n_draws  = draw_pars.n_rows;
+        int n_events = stoich_matrix.n_cols;
+        int n_comps  = stoich_matrix.n_rows;
+        int n_times  = ode_times.n_elem;
+        int n_tcovar = ode_tcovar_inds.size();
+
+        try{
+                if(ode_pars.n_slices != 1 && (int)ode_pars.n_slices != n_draws) {
+                        throw std::runtime_error("ode_pars must have either one slice or one slice per draw.");
+                }
+                if(draw_pars.n_cols > ode_pars.n_cols) {
+                        throw std::runtime_error("draw_pars has more columns than ode_pars.");
+                }
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+
+#ifdef _OPENMP
+        if(n_threads < 1) n_threads = omp_get_max_threads();
+#else
+        n_threads = 1;
+#endif
+        if(n_threads > n_draws) n_threads = std::max(n_draws, 1);
+
+        // resolve the integrator functions on the main thread
+        ode_context fcns(ode_pointer, set_pars_pointer, ctx_pointer);
+
+        // indicators copied out of the R vectors
+        std::vector<int> update_inds(param_update_inds.begin(), param_update_inds.end());
+        std::vector<int> force_inds(forcing_inds.begin(), forcing_inds.end());
+
+        // draw parameters stored by row for contiguous access
+        arma::mat draw_pars_t = draw_pars.t();
+
+        // preallocated paths, one slice per draw
+        arma::cube incid_paths(n_times, n_events + 1, n_draws);
+        arma::cube prev_paths(n_times, n_comps + 1, n_draws);
+        std::vector<int> success(n_draws, 0);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+        {
+                // integrator context and scratch for this thread
+                ode_context ctx(fcns.integrator, fcns.par_setter, fcns.ctx_fcns, fcns.times_integrator, fcns.counter);
+                arma::vec current_params(ode_pars.n_cols);
+                arma::vec ode_state_vec(n_events);
+                arma::mat sweep_path;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+                for(int k=0; k < n_draws; ++k) {
+
+                        arma::mat incid_path(incid_paths.slice(k).memptr(), n_times, n_events + 1, false, true);
+                        arma::mat prev_path(prev_paths.slice(k).memptr(), n_times, n_comps + 1, false, true);
+
+                        try{
+                                success[k] = ode_path(ctx, incid_path, prev_path, current_params,
+                                                      ode_state_vec, sweep_path, ode_times,
+                                                      ode_pars.slice(ode_pars.n_slices == 1 ? 0 : k),
+                                                      draw_pars_t.colptr(k), draw_pars.n_cols,
+                                                      n_tcovar, init_start, update_inds, stoich_matrix,
+                                                      force_inds, forcing_tcov_inds, forcings_out,
+                                                      forcing_transfers, step_size);
+                        } catch(...) {
+                                success[k] = 0;
+                        }
+
+                        if(!success[k]) {
+                                incid_path.fill(NA_REAL);
+                                prev_path.fill(NA_REAL);
+                        }
+                }
+        }
+
+        return Rcpp::List::create(Rcpp::Named("incid_paths") = incid_paths,
+                                  Rcpp::Named("prev_paths")  = prev_paths,
+                                  Rcpp::Named("success")     = Rcpp::LogicalVector(success.begin(), success.end()));
+}
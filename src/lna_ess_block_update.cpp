@@ -0,0 +1,258 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include "stemr_types.h"
+#include "stemr_utils.h"
+#include "stemr_lna.h"
+#include "stemr_rng.h"
+
+using namespace Rcpp;
+using namespace arma;
+
+//' Update a block of LNA perturbations via elliptical slice sampling.
+//'
+//' Carries out a complete elliptical slice sampling update of the perturbations
+//' in one block of an LNA ESS schedule with the initial state held fixed. Each
+//' proposal is mapped to an LNA path, censused, and the density of the data is
+//' evaluated, without returning to R until the update is complete. The draws,
+//' latent path, and data log-likelihood are updated in place if the bracket
+//' does not shrink to zero.
+//'
+//' @param path_draws matrix of current LNA perturbations, updated in place
+//' @param latent_path matrix with the current LNA path, updated in place
+//' @param data_log_lik current data log-likelihood, updated in place
+//' @param draws_prop matrix for the proposed perturbations, must contain the
+//'   current perturbations outside of the block
+//' @param ess_draws matrix of N(0,1) draws defining the ellipse
+//' @param ess_inds C++ style row indices of the perturbations in the block
+//' @param ess_times C++ style column (interval) indices of the perturbations
+//'   in the block
+//' @param bracket_width initial width of the ESS bracket
+//' @param ess_steps vector with the numbers of ESS steps, the element at
+//'   step_ind is incremented with each shrinkage of the bracket
+//' @param ess_angles vector of ESS angles, the final angle is stored at
+//'   step_ind if the update is accepted
+//' @param step_ind C++ style index of the current ESS update
+//' @param pathmat_prop matrix for the proposed LNA path, must contain the
+//'   current path before interval restart_ind
+//' @param censusmat census matrix
+//' @param emitmat matrix of emission log-densities
+//' @param obsmat matrix containing the data
+//' @param measproc_indmat logical matrix indicating which compartments are
+//'   observed at every observation time
+//' @param lna_times vector of interval endpoint times
+//' @param parmat matrix of parameters, initial volumes, constants, and
+//'   time-varying covariates at each of the lna_times
+//' @param param_vec vector for storing the LNA parameters
+//' @param param_inds indices for the model parameters
+//' @param const_inds indices for the constants
+//' @param tcovar_inds indices for the time-varying covariates
+//' @param initdist_inds indices of the initial compartment volumes
+//' @param param_update_inds logical vector indicating at which of the times the
+//'   LNA parameters need to be updated
+//' @param census_indices vector of indices when the LNA path is censused
+//' @param event_inds vector of column indices in the path matrix for events
+//'   that should be censused
+//' @param flow_matrix flow matrix for the LNA
+//' @param stoich_matrix stoichiometry matrix
+//' @param do_prevalence should the prevalence be computed
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied
+//' @param forcing_tcov_inds indices of the time-varying covariates for the
+//'   forcings
+//' @param forcings_out matrix with outflow from forcings
+//' @param forcing_transfers forcing transfer matrices
+//' @param svd_d,svd_U,svd_V objects for decomposing the diffusion matrix
+//' @param diffusion_sqrt method for computing the square root of the diffusion
+//'   matrix
+//' @param lna_cache optional LNA moment cache, see map_draws_2_lna
+//' @param lna_workspace optional LNA workspace, see map_draws_2_lna
+//' @param restart_ind index of the first interval in the block, the path is
+//'   only recomputed from there on
+//' @param emit_start C++ style index of the first observation affected by the
+//'   update
+//' @param prefix_log_lik log-likelihood of the observations before emit_start
+//' @param obs_log_liks optional vector of the log-likelihood contributions of
+//'   the observations under the current path, updated in place
+//' @param inv_temp inverse temperature of the likelihood of the data
+//' @param step_size initial step size for the ODE solver
+//' @param lna_pointer external pointer to LNA integration function
+//' @param set_pars_pointer external pointer to the function for setting the
+//'   LNA parameters
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context
+//' @param d_meas_pointer external pointer to measurement process density
+//'   function
+//'
+//' @return logical indicating whether the draws, path, and log-likelihood were
+//'   updated
+//' @export
+// [[Rcpp::export]]
+bool lna_ess_block_update(arma::mat& path_draws,
+                          arma::mat& latent_path,
+                          Rcpp::NumericVector& data_log_lik,
+                          arma::mat& draws_prop,
+                          const arma::mat& ess_draws,
+                          const arma::uvec& ess_inds,
+                          const arma::uvec& ess_times,
+                          double bracket_width,
+                          arma::vec& ess_steps,
+                          arma::vec& ess_angles,
+                          int step_ind,
+                          arma::mat& pathmat_prop,
+                          Rcpp::NumericMatrix& censusmat,
+                          Rcpp::NumericMatrix& emitmat,
+                          const Rcpp::NumericMatrix& obsmat,
+                          const Rcpp::LogicalMatrix& measproc_indmat,
+                          const arma::rowvec& lna_times,
+                          const Rcpp::NumericMatrix& parmat,
+                          Rcpp::NumericVector& param_vec,
+                          const Rcpp::IntegerVector& param_inds,
+                          const Rcpp::IntegerVector& const_inds,
+                          const Rcpp::IntegerVector& tcovar_inds,
+                          const arma::uvec& initdist_inds,
+                          const Rcpp::LogicalVector& param_update_inds,
+                          const Rcpp::IntegerVector& census_indices,
+                          const Rcpp::Nullable<Rcpp::IntegerVector>& event_inds,
+                          const arma::mat& flow_matrix,
+                          const arma::mat& stoich_matrix,
+                          bool do_prevalence,
+                          const Rcpp::LogicalVector& forcing_inds,
+                          const arma::uvec& forcing_tcov_inds,
+                          const arma::mat& forcings_out,
+                          const arma::cube& forcing_transfers,
+                          arma::vec& svd_d,
+                          arma::mat& svd_U,
+                          arma::mat& svd_V,
+                          std::string diffusion_sqrt,
+                          Rcpp::Nullable<Rcpp::List> lna_cache,
+                          SEXP lna_workspace,
+                          int restart_ind,
+                          int emit_start,
+                          double prefix_log_lik,
+                          Rcpp::Nullable<Rcpp::NumericVector> obs_log_liks,
+                          double inv_temp,
+                          double step_size,
+                          SEXP lna_pointer,
+                          SEXP set_pars_pointer,
+                          SEXP ctx_pointer,
+                          SEXP d_meas_pointer) {
+
+        profile_scope scope(PROFILE_LNA_ESS_BLOCK_UPDATE);
+
+        // dimensions
+        int n_obs   = obsmat.nrow();
+        int n_meas  = measproc_indmat.ncol();
+
+        // armadillo views of the census and parameter matrices
+        arma::mat census_arma(censusmat.begin(), censusmat.nrow(), censusmat.ncol(), false, true);
+        arma::mat parmat_arma(const_cast<double*>(parmat.begin()), parmat.nrow(), parmat.ncol(), false, true);
+        arma::uvec census_inds = Rcpp::as<arma::uvec>(census_indices);
+
+        // current block of perturbations and the ellipse
+        arma::mat draws_cur = path_draws.submat(ess_inds, ess_times);
+        arma::mat draws_ess = ess_draws.submat(ess_inds, ess_times);
+
+        // log-likelihood contributions of the observations under the proposal
+        arma::vec obs_liks(n_obs, arma::fill::zeros);
+
+        // workspace for mapping the proposals to LNA paths
+        std::unique_ptr<lna_scratch> ws_local;
+        lna_scratch& ws = lna_workspace_ref(lna_workspace, ws_local, stoich_matrix.n_cols, stoich_matrix.n_rows);
+
+        // tolerance for the bracket width
+        double bracket_tol = std::sqrt(arma::datum::eps);
+
+        // stream for the threshold and the angles, seeded from R's RNG
+        philox_rng rng(draw_rng_seed(), 0);
+
+        // choose a likelihood threshold
+        double threshold = data_log_lik[0] + std::log(rng.unif()) / inv_temp;
+
+        // initial proposal, which also defines a bracket
+        double pos   = rng.unif();
+        double lower = -bracket_width * pos;
+        double upper = lower + bracket_width;
+        double theta = lower + (upper - lower) * rng.unif();
+
+        // map a point on the ellipse to a path and evaluate the data log-likelihood
+        double data_log_lik_prop = 0;
+
+        while(true) {
+
+                // construct the proposal
+                draws_prop.submat(ess_inds, ess_times) = cos(theta) * draws_cur + sin(theta) * draws_ess;
+
+                try{
+                        // map draws onto a latent path
+                        lna_path_from_draws(pathmat_prop, draws_prop, lna_times, parmat, param_vec,
+                                            param_inds, tcovar_inds, initdist_inds[0], param_update_inds,
+                                            stoich_matrix, forcing_inds, forcing_tcov_inds, forcings_out,
+                                            forcing_transfers, svd_d, svd_U, svd_V, step_size,
+                                            lna_pointer, set_pars_pointer, ctx_pointer,
+                                            diffusion_sqrt, lna_cache, restart_ind, ws);
+
+                        census_latent_path(pathmat_prop, census_arma, census_inds, event_inds,
+                                           flow_matrix, do_prevalence, parmat_arma, initdist_inds,
+                                           forcing_inds, forcing_tcov_inds, forcings_out,
+                                           forcing_transfers, arma::uvec(1, arma::fill::zeros));
+
+                        // evaluate the density of the incidence counts
+                        evaluate_d_measure_LNA(emitmat, obsmat, censusmat, measproc_indmat, parmat,
+                                               param_inds, const_inds, tcovar_inds, param_update_inds,
+                                               census_indices, param_vec, d_meas_pointer, emit_start);
+
+                        // compute the data log likelihood
+                        data_log_lik_prop = prefix_log_lik;
+
+                        for(int j = emit_start; j < n_obs; ++j) {
+                                obs_liks[j] = 0;
+                                for(int c = 0; c < n_meas; ++c) {
+                                        if(measproc_indmat(j, c)) obs_liks[j] += emitmat(j, c + 1);
+                                }
+                                data_log_lik_prop += obs_liks[j];
+                        }
+
+                        if(std::isnan(data_log_lik_prop)) data_log_lik_prop = -arma::datum::inf;
+
+                } catch(std::exception &err) {
+
+                        // if proposal failed data_log_lik_prop is -Inf
+                        data_log_lik_prop = -arma::datum::inf;
+                }
+
+                // stop if accepted or if the bracket has shrunk to zero
+                if(data_log_lik_prop >= threshold || (upper - lower) <= bracket_tol) break;
+
+                // increment the number of ESS steps
+                ess_steps[step_ind] += 1;
+
+                // shrink the bracket
+                if(theta < 0) {
+                        lower = theta;
+                } else {
+                        upper = theta;
+                }
+
+                // sample a new point
+                theta = lower + (upper - lower) * rng.unif();
+        }
+
+        // if the bracket width is not equal to zero, update the draws, path, and dat log likelihood
+        if((upper - lower) > bracket_tol) {
+
+                path_draws.submat(ess_inds, ess_times) = draws_prop.submat(ess_inds, ess_times);
+                latent_path     = pathmat_prop;
+                data_log_lik[0] = data_log_lik_prop;
+
+                if(obs_log_liks.isNotNull()) {
+                        Rcpp::NumericVector obs_log_liks_cur(obs_log_liks.get());
+                        std::copy(obs_liks.begin() + emit_start, obs_liks.end(), obs_log_liks_cur.begin() + emit_start);
+                }
+
+                // record the final angle
+                ess_angles[step_ind] = theta;
+
+                return true;
+        }
+
+        return false;
+}
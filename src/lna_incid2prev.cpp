@@ -1,5 +1,6 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include <RcppArmadillo.h>
+#include "stemr_forcings.h"
 using namespace arma;
 using namespace Rcpp;
 
@@ -31,11 +32,9 @@ arma::mat lna_incid2prev(const arma::mat& path,
       int n_times = path.n_rows;
       int n_comps = flow_matrix.n_cols;
       int n_rates = flow_matrix.n_rows;
-      int n_forcings = forcing_tcov_inds.n_elem;
       
-      // for use with forcings
-      double forcing_flow = 0;
-      arma::rowvec forcing_distvec(n_comps, arma::fill::zeros);
+      // forcings compiled into sparse transfer operators
+      forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers);
       
       // initialize an object for the coverted path
       arma::mat conv_path(n_times, n_comps+1, arma::fill::zeros);
@@ -48,12 +47,7 @@ arma::mat lna_incid2prev(const arma::mat& path,
       if(forcing_inds[0]) {
             
             // distribute the forcings proportionally to the compartment counts in the applicable states
-            for(int s=0; s < n_forcings; ++s) {
-                  
-                  forcing_flow     = forcing_matrix(0, forcing_tcov_inds[s]);
-                  forcing_distvec  = (forcing_flow * normalise(forcings_out.col(s) % volumes.t(), 1)).t();
-                  volumes         += (forcing_transfers.slice(s) * forcing_distvec.t()).t();
-            }
+            forcings.apply(volumes.memptr(), forcing_matrix, 0);
       }
       
       // Loop through the path to compute the compartment counts
@@ -66,11 +60,7 @@ arma::mat lna_incid2prev(const arma::mat& path,
             if(forcing_inds[k]) {
                   
                   // distribute the forcings proportionally to the compartment counts in the applicable states
-                  for(int s=0; s < n_forcings; ++s) {
-                        forcing_flow     = forcing_matrix(k, forcing_tcov_inds[s]);
-                        forcing_distvec  = (forcing_flow * normalise(forcings_out.col(s) % volumes.t(), 1)).t();
-                        volumes         += (forcing_transfers.slice(s) * forcing_distvec.t()).t();
-                  }
+                  forcings.apply(volumes.memptr(), forcing_matrix, k);
             }
       }
       
@@ -0,0 +1,499 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#define ARMA_DONT_PRINT_ERRORS
+#include "stemr_types.h"
+#include "stemr_utils.h"
+#include "stemr_lna.h"
+#include "stemr_forcings.h"
+#include "stemr_rng.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace Rcpp;
+using namespace arma;
+
+// Propagate a particle over the LNA intervals first_int, ..., last_int - 1,
+// which end at an observation time. The LNA ODEs are integrated from the
+// compartment volumes of the particle, as in lna_path_from_draws, with the
+// perturbations drawn from the particle's stream. The perturbations and the
+// increments are stored in the columns of draws_hist and incid_hist, and the
+// incidence (and the prevalence, if called for) at the observation time is
+// written to the particle's row in the census matrix, whose elements are
+// census_stride apart. param_vec must contain the LNA parameters at the left
+// endpoint of the first interval. Only armadillo objects are touched, so that
+// the function may be called from a worker thread. Returns false if the
+// integration or the decomposition of the diffusion matrix failed, or if the
+// path had negative increments or compartment volumes.
+static bool lna_particle_block(ode_context& ctx,
+                               lna_scratch& ws,
+                               forcing_engine& forcings,
+                               arma::vec& svd_d,
+                               arma::mat& svd_U,
+                               arma::mat& svd_V,
+                               arma::vec& param_vec,
+                               double* volumes,
+                               double* census_row,
+                               int census_stride,
+                               int first_int,
+                               int last_int,
+                               philox_rng& rng,
+                               double* draws_hist,
+                               double* incid_hist,
+                               const arma::rowvec& lna_times,
+                               const arma::mat& lna_pars,
+                               int n_tcovar,
+                               int init_start,
+                               const std::vector<int>& update_inds,
+                               const std::vector<int>& force_inds,
+                               const std::vector<int>& incid_events,
+                               int incid_start,
+                               bool do_prevalence,
+                               const std::string& diffusion_sqrt,
+                               double step_size) {
+
+        int n_events   = ws.lna_drift.n_elem;
+        int n_comps    = ws.init_volumes.n_elem;
+        int n_incid    = incid_events.size();
+
+        arma::vec& lna_drift     = ws.lna_drift;
+        arma::mat& lna_diffusion = ws.lna_diffusion;
+
+        for(int e = 0; e < n_incid; ++e) census_row[(incid_start + e) * census_stride] = 0;
+
+        for(int j = first_int; j < last_int; ++j) {
+
+                // set the LNA parameters with the volumes of the particle
+                std::copy(volumes, volumes + n_comps, param_vec.begin() + init_start);
+                ctx.set_pars(param_vec.memptr());
+
+                // integrate the LNA ODEs over the interval
+                ws.lna_state.zeros();
+                ctx.integrate(ws.lna_state.memptr(), lna_times[j], lna_times[j+1], step_size);
+
+                std::copy(ws.lna_state.begin(), ws.lna_state.begin() + n_events, lna_drift.begin());
+                std::copy(ws.lna_state.begin() + n_events, ws.lna_state.end(), lna_diffusion.begin());
+
+                for(int c = 0; c < n_events; ++c) {
+                        for(int r = c + 1; r < n_events; ++r) lna_diffusion(r, c) = lna_diffusion(c, r);
+                }
+
+                if(lna_drift.has_nan() || lna_diffusion.has_nan()) return false;
+
+                if(!lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt, ws.sqrt_work, ws.perm, ws.sqrt_blocks)) {
+                        return false;
+                }
+
+                // draw the perturbations and compute the LNA increment
+                double* draws_j = draws_hist + j * n_events;
+                double* incid_j = incid_hist + j * n_events;
+
+                for(int r = 0; r < n_events; ++r) draws_j[r] = rng.normal();
+
+                for(int r = 0; r < n_events; ++r) {
+                        double log_lna = lna_drift[r];
+                        for(int c = 0; c < n_events; ++c) log_lna += svd_U(r, c) * draws_j[c];
+
+                        incid_j[r] = std::expm1(log_lna);
+                        if(incid_j[r] < 0) return false;
+                }
+
+                // update the compartment volumes
+                for(int e = 0; e < n_events; ++e) {
+                        if(incid_j[e] != 0) {
+                                for(arma::sp_mat::const_iterator it = ws.stoich_sparse.begin_col(e); it != ws.stoich_sparse.end_col(e); ++it) {
+                                        volumes[it.row()] += (*it) * incid_j[e];
+                                }
+                        }
+                }
+
+                for(int c = 0; c < n_comps; ++c) {
+                        if(volumes[c] < 0) return false;
+                }
+
+                // census the incidence, and the prevalence at the observation time
+                for(int e = 0; e < n_incid; ++e) {
+                        census_row[(incid_start + e) * census_stride] += incid_j[incid_events[e]];
+                }
+
+                if(do_prevalence && j + 1 == last_int) {
+                        for(int c = 0; c < n_comps; ++c) census_row[(c + 1) * census_stride] = volumes[c];
+                }
+
+                // apply forcings if called for - applied after censusing the path
+                if(force_inds[j+1]) {
+                        forcings.apply(volumes, lna_pars, j+1);
+
+                        for(int c = 0; c < n_comps; ++c) {
+                                if(volumes[c] < 0) return false;
+                        }
+                }
+
+                // update the time-varying covariates and parameters
+                if(update_inds[j+1]) {
+                        for(int c = param_vec.n_elem - n_tcovar; c < static_cast<int>(param_vec.n_elem); ++c) {
+                                param_vec[c] = lna_pars(j+1, c);
+                        }
+                }
+        }
+
+        return true;
+}
+
+//' Estimate the likelihood of the data under the LNA with a particle filter.
+//'
+//' Runs a bootstrap particle filter over the LNA. Between consecutive
+//' observation times, each particle is propagated over the LNA intervals with
+//' the LNA ODEs integrated from its own compartment volumes and perturbations
+//' drawn from its own Philox stream, so the particles are distributed over a
+//' pool of threads and the estimate does not depend on the number of threads.
+//' At each observation time, the particles are weighted by the density of the
+//' data, evaluated on the main thread via the measurement process pointer
+//' (column-batched over the particles if available), and resampled by
+//' systematic resampling. The product of the average weights is an unbiased
+//' estimate of the likelihood, which can be used in particle marginal
+//' Metropolis-Hastings.
+//'
+//' If the estimate is finite, a path is drawn from the particle approximation
+//' of the smoothing distribution by tracing back the ancestry of a particle,
+//' and its increments and perturbations are written to pathmat and draws.
+//'
+//' @param pathmat matrix where the LNA path should be stored
+//' @param draws matrix where the N(0,1) perturbations of the path should be
+//'   stored
+//' @param obsmat matrix containing the data
+//' @param measproc_indmat logical matrix indicating which compartments are
+//'   observed at every observation time
+//' @param censusmat census matrix, used for its layout and census times
+//' @param lna_times vector of interval endpoint times
+//' @param lna_pars numeric matrix of parameters, constants, and time-varying
+//'   covariates at each of the lna_times
+//' @param param_inds indices for the model parameters
+//' @param const_inds indices for the constants
+//' @param tcovar_inds indices for the time-varying covariates
+//' @param init_start index in the parameter vector where the initial compartment
+//'   volumes start
+//' @param param_update_inds logical vector indicating at which of the times the
+//'   LNA parameters need to be updated.
+//' @param census_indices vector of indices when the LNA path is censused
+//' @param event_inds vector of column indices in the path matrix for events
+//'   that should be censused
+//' @param stoich_matrix stoichiometry matrix giving the changes to compartments
+//'   from each reaction
+//' @param do_prevalence should the prevalence be computed
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_tcov_inds indices of the time-varying covariates for the
+//'   forcings
+//' @param forcings_out matrix with outflow from forcings
+//' @param forcing_transfers forcing transfer matrices
+//' @param diffusion_sqrt method for computing the square root of the diffusion
+//'   matrix, either "svd", "eigen", or "chol"
+//' @param n_particles number of particles
+//' @param step_size initial step size for the ODE solver
+//' @param lna_pointer external pointer to LNA integration function.
+//' @param set_pars_pointer external pointer to the function for setting the LNA
+//'   parameters.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
+//' @param d_meas_pointer external pointer to measurement process density
+//'   function
+//' @param n_threads number of threads
+//'
+//' @return estimate of the log-likelihood of the data, -Inf if every particle
+//'   failed at some observation time
+//' @export
+// [[Rcpp::export]]
+double lna_particle_filter(arma::mat& pathmat,
+                           arma::mat& draws,
+                           const Rcpp::NumericMatrix& obsmat,
+                           const Rcpp::LogicalMatrix& measproc_indmat,
+                           const Rcpp::NumericMatrix& censusmat,
+                           const arma::rowvec& lna_times,
+                           const Rcpp::NumericMatrix& lna_pars,
+                           const Rcpp::IntegerVector& param_inds,
+                           const Rcpp::IntegerVector& const_inds,
+                           const Rcpp::IntegerVector& tcovar_inds,
+                           const int init_start,
+                           const Rcpp::LogicalVector& param_update_inds,
+                           const Rcpp::IntegerVector& census_indices,
+                           const Rcpp::Nullable<Rcpp::IntegerVector>& event_inds,
+                           const arma::mat& stoich_matrix,
+                           bool do_prevalence,
+                           const Rcpp::LogicalVector& forcing_inds,
+                           const arma::uvec& forcing_tcov_inds,
+                           const arma::mat& forcings_out,
+                           const arma::cube& forcing_transfers,
+                           std::string diffusion_sqrt,
+                           int n_particles,
+                           double step_size,
+                           SEXP lna_pointer,
+                           SEXP set_pars_pointer,
+                           SEXP ctx_pointer,
+                           SEXP d_meas_pointer,
+                           int n_threads = 1) {
+
+        profile_scope scope(PROFILE_LNA_PARTICLE_FILTER);
+
+        // dimensions
+        int n_events     = stoich_matrix.n_cols;
+        int n_comps      = stoich_matrix.n_rows;
+        int n_times      = lna_times.n_elem;
+        int n_obs        = obsmat.nrow();
+        int n_meas       = measproc_indmat.ncol();
+        int n_tcovar     = tcovar_inds.size();
+        int n_census_col = censusmat.ncol();
+        int incid_start  = n_comps + 1;
+
+        try{
+                if(n_particles < 1) {
+                        throw std::runtime_error("The number of particles must be positive.");
+                }
+                if(census_indices.size() != n_obs + 1) {
+                        throw std::runtime_error("There must be one more census index than observation times.");
+                }
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+
+#ifdef _OPENMP
+        if(n_threads < 1) n_threads = omp_get_max_threads();
+#else
+        n_threads = 1;
+#endif
+        if(n_threads > n_particles) n_threads = n_particles;
+
+        // armadillo view of the parameter matrix and indicators copied out of the R vectors
+        arma::mat lna_pars_arma(const_cast<double*>(lna_pars.begin()), lna_pars.nrow(), lna_pars.ncol(), false, true);
+        std::vector<int> update_inds(param_update_inds.begin(), param_update_inds.end());
+        std::vector<int> force_inds(forcing_inds.begin(), forcing_inds.end());
+
+        // events whose incidence is censused
+        std::vector<int> incid_events;
+        if(event_inds.isNotNull()) {
+                Rcpp::IntegerVector incid_inds(event_inds.get());
+                for(int e = 0; e < incid_inds.size(); ++e) incid_events.push_back(incid_inds[e] - 1);
+        }
+
+        // resolve the integrator functions and allocate the objects for each
+        // thread, including the forcing operators kept in its workspace
+        ode_context fcns(lna_pointer, set_pars_pointer, ctx_pointer);
+
+        std::vector<std::unique_ptr<ode_context> > contexts(n_threads);
+        std::vector<std::unique_ptr<lna_scratch> > scratch(n_threads);
+        std::vector<arma::vec> svd_d(n_threads), param_vecs(n_threads);
+        std::vector<arma::mat> svd_U(n_threads), svd_V(n_threads);
+
+        for(int t = 0; t < n_threads; ++t) {
+                contexts[t].reset(new ode_context(fcns.integrator, fcns.par_setter, fcns.ctx_fcns,
+                                                  fcns.times_integrator, fcns.counter));
+                scratch[t].reset(new lna_scratch(n_events, n_comps));
+                scratch[t]->stoich_ops(stoich_matrix);
+                scratch[t]->forcing_ops(forcing_tcov_inds, forcings_out, forcing_transfers);
+                svd_d[t].zeros(n_events);
+                svd_U[t].zeros(n_events, n_events);
+                svd_V[t].zeros(n_events, n_events);
+        }
+
+        // LNA parameters at the start of each block of intervals
+        arma::vec block_params = lna_pars_arma.row(0).t();
+
+        // initial compartment volumes of the particles
+        arma::vec init_volumes = block_params.subvec(init_start, init_start + n_comps - 1);
+        if(force_inds[0]) {
+                scratch[0]->forcings->apply(init_volumes.memptr(), lna_pars_arma, 0);
+        }
+
+        arma::mat volumes(n_comps, n_particles);
+        arma::mat volumes_resampled(n_comps, n_particles);
+        volumes.each_col() = init_volumes;
+
+        // perturbations and increments of each particle, and the ancestry
+        arma::cube draws_hist(n_events, n_times - 1, n_particles, arma::fill::zeros);
+        arma::cube incid_hist(n_events, n_times - 1, n_particles, arma::fill::zeros);
+        arma::imat ancestors(n_particles, n_obs);
+        std::vector<int> alive(n_particles, 1);
+        arma::vec log_weights(n_particles);
+        arma::vec cum_weights(n_particles);
+
+        // objects for evaluating the measurement process density at each observation time
+        bool batch_density = R_ExternalPtrTag(d_meas_pointer) == Rf_install("d_measure_batch");
+
+        Rcpp::NumericMatrix particle_census(n_particles, n_census_col);
+        Rcpp::NumericMatrix particle_emit(n_particles, n_meas + 1);
+        Rcpp::NumericMatrix particle_obs(n_particles, obsmat.ncol());
+        Rcpp::LogicalMatrix particle_meas(n_particles, n_meas);
+        Rcpp::NumericVector census_state(n_census_col);
+        Rcpp::NumericVector meas_params = lna_pars.row(0);
+        std::vector<int> tcovar_rows(n_particles, 0);
+        std::vector<double> pars(param_inds.size()), consts(const_inds.size());
+
+        // seed for the particle streams
+        uint64_t seed = draw_rng_seed();
+
+        double log_lik = 0;
+
+        for(int b = 0; b <= n_obs; ++b) {
+
+                // intervals in the block, the last block follows the final observation
+                int first_int = b == 0 ? 0 : census_indices[b];
+                int last_int  = b == n_obs ? n_times - 1 : census_indices[b+1];
+
+                // propagate the particles
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic)
+#endif
+                for(int p = 0; p < n_particles; ++p) {
+
+#ifdef _OPENMP
+                        int thread = omp_get_thread_num();
+#else
+                        int thread = 0;
+#endif
+                        if(!alive[p]) continue;
+
+                        philox_rng rng(seed, static_cast<uint64_t>(b) * n_particles + p);
+                        param_vecs[thread] = block_params;
+
+                        try{
+                                alive[p] = lna_particle_block(*contexts[thread], *scratch[thread],
+                                                              *scratch[thread]->forcings, svd_d[thread],
+                                                              svd_U[thread], svd_V[thread], param_vecs[thread],
+                                                              volumes.colptr(p), particle_census.begin() + p,
+                                                              n_particles, first_int, last_int, rng,
+                                                              draws_hist.slice(p).memptr(), incid_hist.slice(p).memptr(),
+                                                              lna_times, lna_pars_arma, n_tcovar, init_start,
+                                                              update_inds, force_inds, incid_events,
+                                                              incid_start, do_prevalence, diffusion_sqrt, step_size);
+                        } catch(...) {
+                                alive[p] = 0;
+                        }
+                }
+
+                // LNA parameters at the start of the next block
+                for(int j = first_int + 1; j <= last_int; ++j) {
+                        if(update_inds[j]) {
+                                block_params.tail(n_tcovar) = lna_pars_arma.row(j).tail(n_tcovar).t();
+                        }
+                }
+
+                if(b == n_obs) break;
+
+                // parameters of the measurement process, as in evaluate_d_measure_LNA
+                if(param_update_inds[b]) {
+                        std::copy(lna_pars.row(census_indices[b+1]).end() - n_tcovar,
+                                  lna_pars.row(census_indices[b+1]).end(),
+                                  meas_params.end() - n_tcovar);
+                        std::fill(tcovar_rows.begin(), tcovar_rows.end(), census_indices[b+1]);
+                }
+
+                // weight the particles by the density of the data
+                for(int p = 0; p < n_particles; ++p) particle_census(p, 0) = censusmat(b, 0);
+
+                if(batch_density) {
+
+                        Rcpp::XPtr<d_measure_batch_ptr> xpfun(d_meas_pointer);
+                        d_measure_batch_ptr fun = *xpfun;
+
+                        for(int k = 0; k < param_inds.size(); ++k) pars[k] = meas_params[param_inds[k]];
+                        for(int k = 0; k < const_inds.size(); ++k) consts[k] = meas_params[const_inds[k]];
+
+                        for(int p = 0; p < n_particles; ++p) {
+                                for(int c = 0; c < obsmat.ncol(); ++c) particle_obs(p, c) = obsmat(b, c);
+                                for(int c = 0; c < n_meas; ++c) particle_meas(p, c) = alive[p] && measproc_indmat(b, c);
+                        }
+
+                        fun(particle_emit, particle_meas, particle_obs, particle_census, pars.data(), consts.data(),
+                            lna_pars, tcovar_rows.data(), tcovar_inds.begin(), 0);
+
+                } else {
+
+                        Rcpp::XPtr<d_measure_ptr> xpfun(d_meas_pointer);
+                        d_measure_ptr fun = *xpfun;
+
+                        Rcpp::NumericVector record    = obsmat.row(b);
+                        Rcpp::LogicalVector emit_inds = measproc_indmat.row(b);
+                        Rcpp::NumericVector meas_pars = meas_params[param_inds];
+                        Rcpp::NumericVector meas_cons = meas_params[const_inds];
+                        Rcpp::NumericVector meas_tcov = meas_params[tcovar_inds];
+
+                        for(int p = 0; p < n_particles; ++p) {
+                                if(!alive[p]) continue;
+                                for(int c = 0; c < n_census_col; ++c) census_state[c] = particle_census(p, c);
+                                fun(particle_emit, emit_inds, p, record, census_state, meas_pars, meas_cons, meas_tcov);
+                        }
+                }
+
+                for(int p = 0; p < n_particles; ++p) {
+                        log_weights[p] = 0;
+                        if(!alive[p]) {
+                                log_weights[p] = -arma::datum::inf;
+                                continue;
+                        }
+                        for(int c = 0; c < n_meas; ++c) {
+                                if(measproc_indmat(b, c)) log_weights[p] += particle_emit(p, c + 1);
+                        }
+                        if(std::isnan(log_weights[p])) log_weights[p] = -arma::datum::inf;
+                }
+
+                // likelihood increment, the log of the average weight
+                double max_weight = log_weights.max();
+                if(!std::isfinite(max_weight)) return -arma::datum::inf;
+
+                double weight_sum = 0;
+                for(int p = 0; p < n_particles; ++p) {
+                        weight_sum    += std::exp(log_weights[p] - max_weight);
+                        cum_weights[p] = weight_sum;
+                }
+                log_lik += max_weight + std::log(weight_sum / n_particles);
+
+                // systematic resampling, skipped if the weights are all equal
+                if(log_weights.min() == max_weight) {
+                        for(int p = 0; p < n_particles; ++p) ancestors(p, b) = p;
+                        continue;
+                }
+
+                double u = R::unif_rand() / n_particles;
+                int anc = 0;
+                for(int p = 0; p < n_particles; ++p) {
+                        double target = (u + static_cast<double>(p) / n_particles) * weight_sum;
+                        while(anc < n_particles - 1 && cum_weights[anc] < target) ++anc;
+
+                        ancestors(p, b) = anc;
+                        volumes_resampled.col(p) = volumes.col(anc);
+                }
+
+                volumes.swap(volumes_resampled);
+                std::fill(alive.begin(), alive.end(), 1);
+        }
+
+        // pick a particle that survived the final intervals
+        std::vector<int> survivors;
+        for(int p = 0; p < n_particles; ++p) {
+                if(alive[p]) survivors.push_back(p);
+        }
+        if(survivors.empty()) return -arma::datum::inf;
+
+        int slot = survivors[std::min(static_cast<int>(R::unif_rand() * survivors.size()),
+                                      static_cast<int>(survivors.size()) - 1)];
+
+        // trace back its ancestry, copying the perturbations and increments of each block
+        for(int b = n_obs; b >= 0; --b) {
+
+                int first_int = b == 0 ? 0 : census_indices[b];
+                int last_int  = b == n_obs ? n_times - 1 : census_indices[b+1];
+
+                for(int j = first_int; j < last_int; ++j) {
+                        for(int r = 0; r < n_events; ++r) {
+                                draws(r, j)        = draws_hist(r, j, slot);
+                                pathmat(j+1, r+1)  = incid_hist(r, j, slot);
+                        }
+                }
+
+                if(b > 0) slot = ancestors(slot, b - 1);
+        }
+
+        return log_lik;
+}
@@ -2,73 +2,54 @@
 #define ARMA_DONT_PRINT_ERRORS
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_lna.h"
+#include "stemr_forcings.h"
 
 using namespace Rcpp;
 using namespace arma;
 
-//' Map N(0,1) stochastic perturbations to an LNA path.
-//'
-//' @param pathmat matrix where the LNA path should be stored
-//' @param draws matrix of N(0,1) draws to be mapped to an LNA path
-//' @param lna_times vector of interval endpoint times
-//' @param lna_pars numeric matrix of parameters, constants, and time-varying
-//'   covariates at each of the lna_times
-//' @param init_start index in the parameter vector where the initial compartment
-//'   volumes start
-//' @param param_update_inds logical vector indicating at which of the times the
-//'   LNA parameters need to be updated.
-//' @param stoich_matrix stoichiometry matrix giving the changes to compartments
-//'   from each reaction
-//' @param forcing_inds logical vector of indicating at which times in the
-//'   time-varying covariance matrix a forcing is applied.
-//' @param forcing_matrix matrix containing the forcings.
-//' @param svd_d vector in which to store SVD singular values
-//' @param svd_U matrix in which to store the U matrix of the SVD
-//' @param svd_V matrix in which to store the V matrix of the SVD
-//' @param step_size initial step size for the ODE solver (adapted internally,
-//' but too large of an initial step can lead to failure in stiff systems).
-//' @param lna_pointer external pointer to LNA integration function.
-//' @param set_pars_pointer external pointer to the function for setting the LNA
-//'   parameters.
-//'
-//' @return fill out pathmat with the LNA path corresponding to the stochastic
-//'   perturbations.
-//'
-//' @export
-// [[Rcpp::export]]
-void map_draws_2_lna(arma::mat& pathmat,
-                     const arma::mat& draws,
-                     const arma::rowvec& lna_times,
-                     const Rcpp::NumericMatrix& lna_pars,
-                     Rcpp::NumericVector& lna_param_vec,
-                     const Rcpp::IntegerVector& lna_param_inds,
-                     const Rcpp::IntegerVector& lna_tcovar_inds,
-                     const int init_start,
-                     const Rcpp::LogicalVector& param_update_inds,
-                     const arma::mat& stoich_matrix,
-                     const Rcpp::LogicalVector& forcing_inds,
-                     const arma::uvec& forcing_tcov_inds,
-                     const arma::mat& forcings_out,
-                     const arma::cube& forcing_transfers,
-                     arma::vec& svd_d,
-                     arma::mat& svd_U,
-                     arma::mat& svd_V,
-                     double step_size,
-                     SEXP lna_pointer,
-                     SEXP set_pars_pointer) {
+// Map N(0,1) stochastic perturbations to an LNA path, see map_draws_2_lna. Throws
+// a std::runtime_error if the integration or the decomposition of the diffusion
+// matrix fails, or if the path has negative increments or compartment volumes.
+// The objects used in each interval, the integrator context, and the forcing
+// operators are taken from the workspace, so after the first call nothing is
+// allocated outside of the ODE integration and the LAPACK decompositions of
+// the diffusion matrix ("svd" and "eigen").
+void lna_path_from_draws(arma::mat& pathmat,
+                         const arma::mat& draws,
+                         const arma::rowvec& lna_times,
+                         const Rcpp::NumericMatrix& lna_pars,
+                         Rcpp::NumericVector& lna_param_vec,
+                         const Rcpp::IntegerVector& lna_param_inds,
+                         const Rcpp::IntegerVector& lna_tcovar_inds,
+                         const int init_start,
+                         const Rcpp::LogicalVector& param_update_inds,
+                         const arma::mat& stoich_matrix,
+                         const Rcpp::LogicalVector& forcing_inds,
+                         const arma::uvec& forcing_tcov_inds,
+                         const arma::mat& forcings_out,
+                         const arma::cube& forcing_transfers,
+                         arma::vec& svd_d,
+                         arma::mat& svd_U,
+                         arma::mat& svd_V,
+                         double step_size,
+                         SEXP lna_pointer,
+                         SEXP set_pars_pointer,
+                         SEXP ctx_pointer,
+                         std::string diffusion_sqrt,
+                         Rcpp::Nullable<Rcpp::List> lna_cache,
+                         int start_ind,
+                         lna_scratch& ws) {
 
         // get the dimensions of various objects
         int n_events = stoich_matrix.n_cols;         // number of transition events, e.g., S2I, I2R
         int n_comps  = stoich_matrix.n_rows;         // number of model compartments (all strata)
-        int n_odes   = n_events + n_events*n_events; // number of ODEs
         int n_times  = lna_times.n_elem;             // number of times at which the LNA must be evaluated
         int n_tcovar = lna_tcovar_inds.size();       // number of time-varying covariates or parameters
-        int n_forcings = forcing_tcov_inds.n_elem;   // number of forcings
-        
-        // for use with forcings
-        double forcing_flow = 0;
-        arma::vec forcing_distvec(n_comps, arma::fill::zeros);
-        
+
+        // forcings compiled into sparse transfer operators, held by the workspace
+        forcing_engine& forcings = ws.forcing_ops(forcing_tcov_inds, forcings_out, forcing_transfers);
+
         // initialize the objects used in each time interval
         double t_L = 0;
         double t_R = 0;
@@ -76,144 +57,135 @@ void map_draws_2_lna(arma::mat& pathmat,
         // vector of parameters, initial compartment columes, constants, and time-varying covariates
         std::copy(lna_pars.row(0).begin(), lna_pars.row(0).end(), lna_param_vec.begin());
 
+        // the stoichiometry matrix is mostly zeros in stratified models, so the
+        // compartment volumes are updated with its sparse representation
+        const arma::sp_mat& stoich_sparse = ws.stoich_ops(stoich_matrix);
+
         // initial state vector - copy elements from the current parameter vector
-        arma::vec init_volumes(lna_param_vec.begin() + init_start, n_comps);
+        arma::vec& init_volumes = ws.init_volumes;
+        std::copy(lna_param_vec.begin() + init_start, lna_param_vec.begin() + init_start + n_comps, init_volumes.begin());
 
-        // set the parameters in the odeintr namespace
-        CALL_SET_ODE_PARAMS(lna_param_vec, set_pars_pointer); 
+        // the integrator context, kept in the workspace across calls
+        ode_context& ctx = ws.context(lna_pointer, set_pars_pointer, ctx_pointer);
 
-        // initialize the LNA objects
-        bool good_svd = true;
+        // set the parameters in the integrator context
+        ctx.set_pars(lna_param_vec.begin());
 
-        Rcpp::NumericVector lna_state_vec(n_odes); // the vector for storing the current state of the LNA ODEs
+        // cache of the moments in each interval
+        lna_moment_cache moment_cache(lna_cache, lna_param_vec.size(), n_events, n_times - 1);
 
-        arma::vec lna_drift(n_events, arma::fill::zeros);               // incidence mean vector (log scale)
-        arma::mat lna_diffusion(n_events, n_events, arma::fill::zeros); // diffusion matrix
+        // initialize the LNA objects
+        bool good_svd = true;
+        bool good_integration = true;
 
-        arma::vec log_lna(n_events, arma::fill::zeros);  // LNA increment, log scale
-        arma::vec nat_lna(n_events, arma::fill::zeros);  // LNA increment, natural scale
+        arma::vec& lna_state_vec = ws.lna_state;     // the vector for storing the current state of the LNA ODEs
+        arma::vec& lna_drift     = ws.lna_drift;     // incidence mean vector (log scale)
+        arma::mat& lna_diffusion = ws.lna_diffusion; // diffusion matrix
+        arma::vec& log_lna       = ws.log_lna;       // LNA increment, log scale
+        arma::vec& nat_lna       = ws.nat_lna;       // LNA increment, natural scale
 
         // apply forcings if called for - applied after censusing at the first time
         if(forcing_inds[0]) {
-              
+
               // distribute the forcings proportionally to the compartment counts in the applicable states
-              for(int j=0; j < n_forcings; ++j) {
-                    
-                    forcing_flow       = lna_pars(0, forcing_tcov_inds[j]);
-                    forcing_distvec    = forcing_flow * normalise(forcings_out.col(j) % init_volumes, 1);
-                    init_volumes      += forcing_transfers.slice(j) * forcing_distvec;
-              }
+              forcings.apply(init_volumes.memptr(), lna_pars, 0);
         }
 
         // iterate over the time sequence, solving the LNA over each interval
         for(int j=0; j < (n_times-1); ++j) {
 
-                // set the times of the interval endpoints
-                t_L = lna_times[j];
-                t_R = lna_times[j+1];
+                if(j < start_ind) {
+
+                        // the interval is unchanged, replay the increment in pathmat
+                        for(int k=0; k < n_events; ++k) nat_lna[k] = pathmat(j+1, k+1);
 
-                // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
-                std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-                CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+                } else {
 
-                // transfer the elements of the lna_state_vec to the process objects
-                std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
-                std::copy(lna_state_vec.begin() + n_events, lna_state_vec.end(), lna_diffusion.begin());
+                        // set the times of the interval endpoints
+                        t_L = lna_times[j];
+                        t_R = lna_times[j+1];
 
-                // ensure symmetry of the diffusion matrix
-                lna_diffusion = arma::symmatu(lna_diffusion);
+                        // reuse the drift and diffusion square root if the path has not
+                        // diverged from the cached one, otherwise recompute and cache them
+                        if(!moment_cache.lookup(j, t_L, t_R, lna_param_vec.begin(), lna_drift, svd_U)) {
 
-                // map the stochastic perturbation to the LNA path on its natural scale
-                try{
-                        if(lna_drift.has_nan() || lna_diffusion.has_nan()) {
-                                good_svd = false;
+                                // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
+                                lna_state_vec.zeros();
+                                ctx.integrate(lna_state_vec.memptr(), t_L, t_R, step_size);
+
+                                // transfer the elements of the lna_state_vec to the process objects
+                                std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
+                                std::copy(lna_state_vec.begin() + n_events, lna_state_vec.end(), lna_diffusion.begin());
+
+                                // ensure symmetry of the diffusion matrix
+                                for(int c=0; c < n_events; ++c) {
+                                        for(int r=c+1; r < n_events; ++r) lna_diffusion(r, c) = lna_diffusion(c, r);
+                                }
+
+                                if(lna_drift.has_nan() || lna_diffusion.has_nan()) {
+                                        good_integration = false;
+                                } else {
+                                        good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt,
+                                                                      ws.sqrt_work, ws.perm, ws.sqrt_blocks);
+                                        if(good_svd) moment_cache.store(j, t_L, t_R, lna_param_vec.begin(), lna_drift, svd_U);
+                                }
+                        }
+
+                        // map the stochastic perturbation to the LNA path on its natural scale
+                        if(!good_integration) {
                                 throw std::runtime_error("Integration failed.");
-                        } else {
-                                good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
                         }
 
                         if(!good_svd) {
                                 throw std::runtime_error("SVD failed.");
-
-                        } else {
-                                svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                                svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                                svd_U *= svd_V.t();                                 // complete svd_sqrt
-                                svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-
-                                log_lna = lna_drift + svd_U * draws.col(j);         // map the LNA draws
                         }
 
-                } catch(std::exception & err) {
-
-                        // reinstatiate the SVD objects
-                        arma::vec svd_d(n_events, arma::fill::zeros);
-                        arma::mat svd_U(n_events, n_events, arma::fill::zeros);
-                        arma::mat svd_V(n_events, n_events, arma::fill::zeros);
+                        // map the LNA draws and compute the LNA increment
+                        const double* draws_j = draws.colptr(j);
+                        for(int r=0; r < n_events; ++r) {
+                                log_lna[r] = lna_drift[r];
+                                for(int c=0; c < n_events; ++c) log_lna[r] += svd_U(r, c) * draws_j[c];
 
-                        // forward the exception
-                        forward_exception_to_r(err);
+                                nat_lna[r] = std::expm1(log_lna[r]);
 
-                } catch(...) {
-                        ::Rf_error("c++ exception (unknown reason)");
+                                // save the LNA increment
+                                pathmat(j+1, r+1) = nat_lna[r];
+                        }
                 }
 
-                // compute the LNA increment
-                nat_lna = arma::vec(expm1(Rcpp::NumericVector(log_lna.begin(), log_lna.end())));
-
-                // save the LNA increment
-                pathmat(j+1, arma::span(1, n_events)) = nat_lna.t();
-
                 // update the initial volumes
-                init_volumes += stoich_matrix * nat_lna;
-
-                // if any increments or volumes are negative, throw an error
-                try{
-                        if(any(nat_lna < 0)) {
-                                throw std::runtime_error("Negative increment.");
-                        }
-
-                        if(any(init_volumes < 0)) {
-                                throw std::runtime_error("Negative compartment volumes.");
+                for(int e=0; e < n_events; ++e) {
+                        if(nat_lna[e] != 0) {
+                                for(arma::sp_mat::const_iterator it = stoich_sparse.begin_col(e); it != stoich_sparse.end_col(e); ++it) {
+                                        init_volumes[it.row()] += (*it) * nat_lna[e];
+                                }
                         }
+                }
 
-                } catch(std::runtime_error &err) {
-
-                        forward_exception_to_r(err);
+                // if any increments or volumes are negative, throw an error
+                if(nat_lna.min() < 0) {
+                        throw std::runtime_error("Negative increment.");
+                }
 
-                } catch(...) {
-                        ::Rf_error("c++ exception (unknown reason)");
+                if(init_volumes.min() < 0) {
+                        throw std::runtime_error("Negative compartment volumes.");
                 }
-                
+
                 // apply forcings if called for - applied after censusing the path
                 if(forcing_inds[j+1]) {
-                      
+
                       // distribute the forcings proportionally to the compartment counts in the applicable states
-                      for(int s=0; s < n_forcings; ++s) {
-                            
-                            forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                            forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                            init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                      }
-                      
+                      forcings.apply(init_volumes.memptr(), lna_pars, j+1);
+
                       // throw errors for negative negative volumes
-                      try{
-                            if(any(init_volumes < 0)) {
-                                  throw std::runtime_error("Negative compartment volumes.");
-                            }
-                            
-                      } catch(std::exception &err) {
-                            
-                            forward_exception_to_r(err);
-                            
-                      } catch(...) {
-                            ::Rf_error("c++ exception (unknown reason)");
+                      if(init_volumes.min() < 0) {
+                            throw std::runtime_error("Negative compartment volumes.");
                       }
                 }
 
                 // update the parameters if they need to be updated
                 if(param_update_inds[j+1]) {
-                      
+
                       // time-varying covariates and parameters
                       std::copy(lna_pars.row(j+1).end() - n_tcovar,
                                 lna_pars.row(j+1).end(),
@@ -224,6 +196,150 @@ void map_draws_2_lna(arma::mat& pathmat,
                 std::copy(init_volumes.begin(), init_volumes.end(), lna_param_vec.begin() + init_start);
 
                 // set the lna parameters and reset the LNA state vector
-                CALL_SET_ODE_PARAMS(lna_param_vec, set_pars_pointer);
+                ctx.set_pars(lna_param_vec.begin());
+        }
+
+        ctx.report_counts();
+}
+
+//' Allocate a workspace for mapping perturbations to LNA paths.
+//'
+//' The workspace holds the objects used in each interval of the LNA, and is
+//' allocated once, e.g., per call to fit_stem, and passed to map_draws_2_lna so
+//' that repeated calls do not allocate. The forcing operators and the sparse
+//' stoichiometry matrix compiled in the workspace are recompiled if a call
+//' passes different forcings or stoichiometry.
+//'
+//' @param n_events number of transition events in the LNA
+//' @param n_comps number of model compartments
+//' @param n_threads number of threads over which the blocks of the LNA ODEs
+//'   are integrated concurrently in each interval, if the ODEs are split into
+//'   blocks (see \code{build_lna_blocks}). If less than 1, all available
+//'   threads are used.
+//'
+//' @return external pointer to the workspace
+//' @export
+// [[Rcpp::export]]
+SEXP make_lna_workspace(int n_events, int n_comps, int n_threads = 1) {
+        lna_scratch* ws   = new lna_scratch(n_events, n_comps);
+        ws->block_threads = n_threads;
+        return Rcpp::XPtr<lna_scratch>(ws);
+}
+
+//' Map N(0,1) stochastic perturbations to an LNA path.
+//'
+//' @param pathmat matrix where the LNA path should be stored
+//' @param draws matrix of N(0,1) draws to be mapped to an LNA path
+//' @param lna_times vector of interval endpoint times
+//' @param lna_pars numeric matrix of parameters, constants, and time-varying
+//'   covariates at each of the lna_times
+//' @param init_start index in the parameter vector where the initial compartment
+//'   volumes start
+//' @param param_update_inds logical vector indicating at which of the times the
+//'   LNA parameters need to be updated.
+//' @param stoich_matrix stoichiometry matrix giving the changes to compartments
+//'   from each reaction
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_matrix matrix containing the forcings.
+//' @param svd_d vector in which to store SVD singular values
+//' @param svd_U matrix in which to store the U matrix of the SVD
+//' @param svd_V matrix in which to store the V matrix of the SVD
+//' @param step_size initial step size for the ODE solver (adapted internally,
+//' but too large of an initial step can lead to failure in stiff systems).
+//' @param lna_pointer external pointer to LNA integration function.
+//' @param set_pars_pointer external pointer to the function for setting the LNA
+//'   parameters.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
+//' @param diffusion_sqrt method for computing the square root of the diffusion
+//'   matrix, either "svd", "eigen" (symmetric eigendecomposition), or "chol"
+//'   (pivoted Cholesky).
+//' @param lna_cache optional list in which the drift and diffusion square
+//'   root in each interval are cached across calls. The moments are recomputed
+//'   from the first interval in which the LNA parameters or state differ from
+//'   those in the cache. The list contains the double matrices keys,
+//'   with a row per LNA parameter plus two and a column per interval, drift,
+//'   with a row per event and a column per interval, and diffusion_sqrt, with a
+//'   row per event and n_events columns per interval, and the integer n_valid.
+//'   The elements are updated in place.
+//' @param start_ind index of the first interval whose perturbations differ
+//'   from those of the path already in pathmat. The increments in the
+//'   preceding intervals are taken from pathmat, which saves integrating the
+//'   LNA ODEs over the unchanged prefix of the path.
+//' @param lna_workspace optional workspace returned by make_lna_workspace,
+//'   which is reused instead of allocating the objects for each interval.
+//'
+//' @return fill out pathmat with the LNA path corresponding to the stochastic
+//'   perturbations.
+//'
+//' @export
+// [[Rcpp::export]]
+void map_draws_2_lna(arma::mat& pathmat,
+                     const arma::mat& draws,
+                     const arma::rowvec& lna_times,
+                     const Rcpp::NumericMatrix& lna_pars,
+                     Rcpp::NumericVector& lna_param_vec,
+                     const Rcpp::IntegerVector& lna_param_inds,
+                     const Rcpp::IntegerVector& lna_tcovar_inds,
+                     const int init_start,
+                     const Rcpp::LogicalVector& param_update_inds,
+                     const arma::mat& stoich_matrix,
+                     const Rcpp::LogicalVector& forcing_inds,
+                     const arma::uvec& forcing_tcov_inds,
+                     const arma::mat& forcings_out,
+                     const arma::cube& forcing_transfers,
+                     arma::vec& svd_d,
+                     arma::mat& svd_U,
+                     arma::mat& svd_V,
+                     double step_size,
+                     SEXP lna_pointer,
+                     SEXP set_pars_pointer,
+                     SEXP ctx_pointer,
+                     std::string diffusion_sqrt = "svd",
+                     Rcpp::Nullable<Rcpp::List> lna_cache = R_NilValue,
+                     int start_ind = 0,
+                     SEXP lna_workspace = R_NilValue) {
+
+        profile_scope scope(PROFILE_MAP_DRAWS_2_LNA);
+
+        try{
+                // use the workspace if supplied, otherwise allocate one for this call
+                std::unique_ptr<lna_scratch> ws_local;
+                lna_scratch& ws = lna_workspace_ref(lna_workspace, ws_local, stoich_matrix.n_cols, stoich_matrix.n_rows);
+
+                lna_path_from_draws(pathmat,
+                                    draws,
+                                    lna_times,
+                                    lna_pars,
+                                    lna_param_vec,
+                                    lna_param_inds,
+                                    lna_tcovar_inds,
+                                    init_start,
+                                    param_update_inds,
+                                    stoich_matrix,
+                                    forcing_inds,
+                                    forcing_tcov_inds,
+                                    forcings_out,
+                                    forcing_transfers,
+                                    svd_d,
+                                    svd_U,
+                                    svd_V,
+                                    step_size,
+                                    lna_pointer,
+                                    set_pars_pointer,
+                                    ctx_pointer,
+                                    diffusion_sqrt,
+                                    lna_cache,
+                                    start_ind,
+                                    ws);
+
+        } catch(std::exception &err) {
+
+                // forward the exception
+                forward_exception_to_r(err);
+
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
         }
-}
\ No newline at end of file
+}
@@ -0,0 +1,212 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include "stemr_types.h"
+#include "stemr_utils.h"
+
+using namespace Rcpp;
+using namespace arma;
+
+// Apply a forcing to the compartment volumes and to their directional
+// derivatives. The forcing flow is distributed proportionally to the volumes
+// in the applicable compartments, dist = flow * w / sum(w) with w = out % V,
+// so d dist = d flow * w / sum(w) + flow * (dw / sum(w) - w * sum(dw) / sum(w)^2).
+static void apply_forcing_sens(arma::vec& volumes,
+                               arma::mat& d_volumes,
+                               double flow,
+                               const arma::rowvec& d_flow,
+                               const arma::vec& forcings_out,
+                               const arma::mat& forcing_transfers) {
+
+        arma::vec w  = forcings_out % volumes;
+        double w_sum = arma::accu(w);
+
+        if(w_sum <= 0) return;
+
+        for(arma::uword d = 0; d < d_volumes.n_cols; ++d) {
+                arma::vec dw  = forcings_out % d_volumes.col(d);
+                arma::vec d_dist = d_flow[d] * w / w_sum + flow * (dw / w_sum - w * (arma::accu(dw) / (w_sum * w_sum)));
+                d_volumes.col(d) += forcing_transfers * d_dist;
+        }
+
+        volumes += forcing_transfers * (flow * w / w_sum);
+}
+
+//' Forward sensitivities of an ODE or LNA path with respect to the parameters.
+//'
+//' Computes the derivatives of the increments of a path, as returned by
+//' \code{map_pars_2_ode} or \code{map_draws_2_lna}, in each of a set of
+//' directions in the space of the parameter matrix. The sensitivities of the
+//' ODEs, or of the LNA drift, are integrated over each interval along with the
+//' ODEs, see \code{sensitivity_system_code}, and are propagated through the
+//' compartment volumes and forcings at the start of the next interval. For an
+//' LNA path the draws, and the square root of the diffusion they are mapped
+//' by, are held fixed, so that the derivative of the increment on its natural
+//' scale is (1 + increment) times the sensitivity of the drift. The
+//' dependence of the diffusion on the parameters is omitted.
+//'
+//' @param pathmat matrix with the path, whose increments are used for the
+//'   compartment volumes at the start of each interval
+//' @param times vector of interval endpoint times
+//' @param pars numeric matrix of parameters, constants, and time-varying
+//'   covariates at each of the times
+//' @param dpars array whose slices are the directions, i.e., the derivatives
+//'   of pars in each direction, with the dimensions of pars
+//' @param tcovar_inds indices of the time-varying covariates in the parameter
+//'   vector
+//' @param init_start index in the parameter vector where the initial compartment
+//'   volumes start
+//' @param param_update_inds logical vector indicating at which of the times the
+//'   parameters need to be updated.
+//' @param stoich_matrix stoichiometry matrix giving the changes to compartments
+//'   from each reaction
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_tcov_inds indices of the time-varying covariates with the
+//'   forcings
+//' @param forcings_out matrix indicating the compartments from which the
+//'   forcings flow
+//' @param forcing_transfers array with the transfer matrix of each forcing
+//' @param log_scale is the path an LNA path, otherwise an ODE path
+//' @param step_size initial step size for the ODE solver
+//' @param proc_pointer external pointer to the LNA or ODE integration function
+//' @param sens_pointer external pointer to the sensitivity integration function
+//' @param set_pars_pointer external pointer to the function for setting the
+//'   parameters
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context
+//'
+//' @return array whose slices are the derivatives of pathmat in each of the
+//'   directions, the time column is zero
+//' @export
+// [[Rcpp::export]]
+arma::cube map_pars_2_sens(const arma::mat& pathmat,
+                           const arma::rowvec& times,
+                           const Rcpp::NumericMatrix& pars,
+                           const arma::cube& dpars,
+                           const Rcpp::IntegerVector& tcovar_inds,
+                           const int init_start,
+                           const Rcpp::LogicalVector& param_update_inds,
+                           const arma::mat& stoich_matrix,
+                           const Rcpp::LogicalVector& forcing_inds,
+                           const arma::uvec& forcing_tcov_inds,
+                           const arma::mat& forcings_out,
+                           const arma::cube& forcing_transfers,
+                           bool log_scale,
+                           double step_size,
+                           SEXP proc_pointer,
+                           SEXP sens_pointer,
+                           SEXP set_pars_pointer,
+                           SEXP ctx_pointer) {
+
+        profile_scope scope(PROFILE_MAP_PARS_2_SENS);
+
+        // get the dimensions of various objects
+        int n_events   = stoich_matrix.n_cols;
+        int n_comps    = stoich_matrix.n_rows;
+        int n_times    = times.n_elem;
+        int n_pars     = pars.ncol();
+        int n_dirs     = dpars.n_slices;
+        int n_tcovar   = tcovar_inds.size();
+        int n_forcings = forcing_tcov_inds.n_elem;
+
+        arma::cube sens(n_times, n_events + 1, n_dirs, arma::fill::zeros);
+
+        try{
+                if(pathmat.n_rows != (arma::uword)n_times || pathmat.n_cols != (arma::uword)(n_events + 1)) {
+                        throw std::runtime_error("The path does not match the times and the stoichiometry matrix.");
+                }
+
+                if(dpars.n_rows != (arma::uword)pars.nrow() || dpars.n_cols != (arma::uword)n_pars) {
+                        throw std::runtime_error("The directions do not match the dimensions of the parameter matrix.");
+                }
+
+                if(TYPEOF(sens_pointer) != EXTPTRSXP) {
+                        throw std::runtime_error("The sensitivities of the ODEs are not compiled.");
+                }
+
+                if(n_dirs == 0) return sens;
+
+                // parameters, compartment volumes, and their directional derivatives
+                arma::vec param_vec(n_pars);
+                arma::mat dparam_vec(n_pars, n_dirs);
+
+                for(int k = 0; k < n_pars; ++k) {
+                        param_vec[k] = pars(0, k);
+                        for(int d = 0; d < n_dirs; ++d) dparam_vec(k, d) = dpars(0, k, d);
+                }
+
+                arma::vec volumes   = param_vec.subvec(init_start, init_start + n_comps - 1);
+                arma::mat d_volumes = dparam_vec.rows(init_start, init_start + n_comps - 1);
+                arma::rowvec d_flow(n_dirs);
+
+                // allocate the integrator context for this call
+                ode_context ctx(proc_pointer, set_pars_pointer, ctx_pointer);
+                ode_sens_ptr sens_integrator = *Rcpp::XPtr<ode_sens_ptr>(sens_pointer);
+
+                arma::vec state(n_events);
+                arma::mat state_sens(n_events, n_dirs);
+                arma::vec incr(n_events);
+
+                // apply forcings if called for - applied after censusing at the first time
+                if(forcing_inds[0]) {
+                        for(int s = 0; s < n_forcings; ++s) {
+                                for(int d = 0; d < n_dirs; ++d) d_flow[d] = dpars(0, forcing_tcov_inds[s], d);
+                                apply_forcing_sens(volumes, d_volumes, pars(0, forcing_tcov_inds[s]), d_flow,
+                                                   forcings_out.col(s), forcing_transfers.slice(s));
+                        }
+                }
+
+                for(int j = 0; j < (n_times - 1); ++j) {
+
+                        // volumes at the start of the interval
+                        param_vec.subvec(init_start, init_start + n_comps - 1) = volumes;
+                        dparam_vec.rows(init_start, init_start + n_comps - 1)  = d_volumes;
+
+                        // integrate the ODEs and their sensitivities from zero
+                        state.zeros();
+                        state_sens.zeros();
+                        ctx.set_pars(param_vec.memptr());
+                        ctx.integrate_sens(sens_integrator, state.memptr(), state_sens.memptr(), dparam_vec.memptr(),
+                                           n_dirs, times[j], times[j+1], step_size);
+
+                        if(state_sens.has_nan()) {
+                                throw std::runtime_error("Integration of the sensitivities failed.");
+                        }
+
+                        // the increments of the path, the LNA increments are expm1 of the log scale increments
+                        for(int e = 0; e < n_events; ++e) incr[e] = pathmat(j+1, e+1);
+                        if(log_scale) state_sens.each_col() %= (1 + incr);
+
+                        for(int d = 0; d < n_dirs; ++d) {
+                                for(int e = 0; e < n_events; ++e) sens(j+1, e+1, d) = state_sens(e, d);
+                        }
+
+                        // update the volumes and their derivatives
+                        volumes   += stoich_matrix * incr;
+                        d_volumes += stoich_matrix * state_sens;
+
+                        // apply forcings if called for - applied after censusing the path
+                        if(forcing_inds[j+1]) {
+                                for(int s = 0; s < n_forcings; ++s) {
+                                        for(int d = 0; d < n_dirs; ++d) d_flow[d] = dpars(j+1, forcing_tcov_inds[s], d);
+                                        apply_forcing_sens(volumes, d_volumes, pars(j+1, forcing_tcov_inds[s]), d_flow,
+                                                           forcings_out.col(s), forcing_transfers.slice(s));
+                                }
+                        }
+
+                        // update the time-varying covariates and parameters if they need to be updated
+                        if(param_update_inds[j+1]) {
+                                for(int k = n_pars - n_tcovar; k < n_pars; ++k) {
+                                        param_vec[k] = pars(j+1, k);
+                                        for(int d = 0; d < n_dirs; ++d) dparam_vec(k, d) = dpars(j+1, k, d);
+                                }
+                        }
+                }
+
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+
+        return sens;
+}
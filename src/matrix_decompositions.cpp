@@ -25,4 +25,84 @@ void comp_chol(arma::mat& C, arma::mat& M) {
             M.diag() = arma::max(M.diag(), arma::sum(arma::abs(M),1) - arma::abs(M.diag()));
             C = arma::chol(M);
       }
-}
\ No newline at end of file
+}
+
+// Rank one update of an upper triangular cholesky factor in place, i.e., R is
+// replaced by the factor of R'R + x x'. The update is a sequence of Givens
+// rotations that costs O(p^2) rather than the O(p^3) of a new factorization.
+// Returns false if a diagonal element of the factor is not positive and finite,
+// in which case R is left in an indeterminate state. x is overwritten.
+static bool chol_rank1_update(arma::mat& R, arma::vec& x) {
+
+      int p = R.n_rows;
+
+      for(int k = 0; k < p; ++k) {
+
+            double r_kk = R(k,k);
+            if(!(r_kk > 0.0) || !std::isfinite(r_kk)) return false;
+
+            double r = std::hypot(r_kk, x(k));
+            double c = r / r_kk;
+            double s = x(k) / r_kk;
+            R(k,k)   = r;
+
+            for(int j = k + 1; j < p; ++j) {
+                  R(k,j) = (R(k,j) + s * x(j)) / c;
+                  x(j)   = c * x(j) - s * R(k,j);
+            }
+      }
+
+      return R.is_finite();
+}
+
+//' Adapt the empirical mean and covariance of an MCMC kernel and their cholesky
+//'
+//' Performs the Robbins-Monro updates of the kernel mean and covariance in
+//' place, i.e., kernel_resid = pars_est - kernel_mean, kernel_cov = (1 - gain)
+//' kernel_cov + gain kernel_resid kernel_resid', and kernel_mean = kernel_mean
+//' + gain kernel_resid. Since the covariance changes by a rescaling and a rank
+//' one term, its cached upper cholesky factor, kernel_chol, is rescaled and
+//' updated with a rank one update rather than refactored. The factor is
+//' recomputed with \code{comp_chol} if the update breaks down, e.g., when the
+//' gain is one. The factor of the scaled covariance used by the proposals,
+//' kernel_cov_chol, is set to sqrt(scaling) kernel_chol.
+//'
+//' @param kernel_mean empirical mean of the kernel
+//' @param kernel_cov empirical covariance matrix of the kernel
+//' @param kernel_chol upper cholesky factor of kernel_cov
+//' @param kernel_cov_chol upper cholesky factor of scaling * kernel_cov
+//' @param kernel_resid vector to be filled out with the residual
+//' @param pars_est current parameters on the estimation scale
+//' @param gain adaptation gain factor, in (0,1]
+//' @param scaling scaling of the covariance in the proposal, defaults to 1
+//'
+//' @return updates the kernel mean, covariance, residual, and cholesky factors
+//'   in place
+//' @export
+// [[Rcpp::export]]
+void adapt_kernel_cov(arma::vec& kernel_mean, arma::mat& kernel_cov, arma::mat& kernel_chol,
+                      arma::mat& kernel_cov_chol, arma::vec& kernel_resid, const arma::vec& pars_est,
+                      double gain, double scaling = 1.0) {
+
+      kernel_resid = pars_est - kernel_mean;
+
+      kernel_cov *= 1.0 - gain;
+      kernel_cov += gain * kernel_resid * kernel_resid.t();
+      kernel_mean += gain * kernel_resid;
+
+      // rescale the factor and add the scaled residual
+      bool success = gain < 1.0;
+      if(success) {
+            arma::vec x = std::sqrt(gain) * kernel_resid;
+            kernel_chol *= std::sqrt(1.0 - gain);
+            success = chol_rank1_update(kernel_chol, x);
+      }
+
+      // refactor a copy, comp_chol modifies the diagonal of its argument
+      if(!success) {
+            arma::mat M = kernel_cov;
+            comp_chol(kernel_chol, M);
+      }
+
+      kernel_cov_chol = std::sqrt(scaling) * kernel_chol;
+}
@@ -0,0 +1,288 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include <RcppArmadillo.h>
+#include <cstdio>
+
+#ifdef _WIN32
+#define store_fseek _fseeki64
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace Rcpp;
+using namespace arma;
+
+// A sample store file starts with a header of four doubles: the format version,
+// the number of columns in each record, the capacity in records, and the number
+// of records flushed to the file. The records follow in columnar layout, i.e.,
+// as the column-major capacity x n_cols matrix with one row per sample, so that
+// each object saved at the samples occupies a contiguous range of the file.
+static const arma::uword STORE_HEADER  = 4;
+static const double      STORE_VERSION = 1;
+
+// Fixed-width columnar store for the MCMC samples. On POSIX systems the file is
+// memory-mapped, the records are written directly into the mapping, and the
+// mapping is synced and its pages released every chunk_size records, so that
+// the resident memory is bounded by the pages touched within a chunk. On
+// Windows the records of each chunk are buffered and written column by column.
+// A store may be reopened at an offset, e.g., when resuming from a checkpoint,
+// in which case the records after the offset are overwritten.
+struct sample_store {
+
+        sample_store(const std::string& file, arma::uword n_cols, arma::uword capacity, arma::uword chunk_size,
+                     arma::uword offset) :
+                n_cols(n_cols), capacity(capacity), chunk_size(chunk_size), n_written(offset), n_flushed(offset),
+                is_open(false) {
+
+                size_t n_bytes = sizeof(double) * (STORE_HEADER + n_cols * capacity);
+                double header[STORE_HEADER] = {STORE_VERSION, (double)n_cols, (double)capacity, (double)offset};
+
+#ifndef _WIN32
+                fd = offset == 0 ? ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(file.c_str(), O_RDWR);
+                if(fd < 0) {
+                        throw std::runtime_error("Could not open the sample store file.");
+                }
+
+                // the file is sparse until the records are written
+                if(offset == 0 && ::ftruncate(fd, n_bytes) != 0) {
+                        ::close(fd);
+                        throw std::runtime_error("Could not allocate the sample store file.");
+                }
+
+                map_bytes = n_bytes;
+                void* map_ptr = ::mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if(map_ptr == MAP_FAILED) {
+                        ::close(fd);
+                        throw std::runtime_error("Could not memory-map the sample store file.");
+                }
+
+                map = static_cast<double*>(map_ptr);
+
+                if(offset != 0 && !same_layout(map)) {
+                        ::munmap(map, map_bytes);
+                        ::close(fd);
+                        throw std::runtime_error("The sample store file does not match the layout of the records.");
+                }
+
+                std::copy(header, header + STORE_HEADER, map);
+#else
+                fp = std::fopen(file.c_str(), offset == 0 ? "w+b" : "r+b");
+                if(fp == NULL) {
+                        throw std::runtime_error("Could not open the sample store file.");
+                }
+
+                if(offset != 0) {
+                        double existing[STORE_HEADER];
+                        if(std::fread(existing, sizeof(double), STORE_HEADER, fp) != STORE_HEADER || !same_layout(existing)) {
+                                std::fclose(fp);
+                                throw std::runtime_error("The sample store file does not match the layout of the records.");
+                        }
+                        store_fseek(fp, 0, SEEK_SET);
+                }
+
+                std::fwrite(header, sizeof(double), STORE_HEADER, fp);
+                if(offset == 0 && n_bytes > sizeof(header)) {
+                        store_fseek(fp, n_bytes - 1, SEEK_SET);
+                        std::fputc(0, fp);
+                }
+                std::fflush(fp);
+
+                buffer.zeros(chunk_size, n_cols);
+#endif
+                is_open = true;
+        }
+
+        ~sample_store() {
+                close();
+        }
+
+        // does an existing header describe a store with at least offset records
+        bool same_layout(const double* header) const {
+                return header[0] == STORE_VERSION && header[1] == n_cols && header[2] == capacity &&
+                       header[3] >= n_written;
+        }
+
+        // copy one record, given as a list of numeric objects whose lengths sum
+        // to the record width, into the next row of the store
+        void write(const Rcpp::List& fields) {
+
+                if(!is_open) {
+                        throw std::runtime_error("The sample store is closed.");
+                }
+                if(n_written == capacity) {
+                        throw std::runtime_error("The sample store is full.");
+                }
+
+                arma::uword col = 0;
+
+                for(int f = 0; f < fields.size(); ++f) {
+
+                        Rcpp::NumericVector x = fields[f];
+
+                        if(col + x.size() > n_cols) {
+                                throw std::runtime_error("The record is wider than the sample store.");
+                        }
+
+#ifndef _WIN32
+                        double* dest = map + STORE_HEADER + col * capacity + n_written;
+                        for(int i = 0; i < x.size(); ++i) dest[i * capacity] = x[i];
+#else
+                        for(int i = 0; i < x.size(); ++i) buffer(n_written - n_flushed, col + i) = x[i];
+#endif
+                        col += x.size();
+                }
+
+                if(col != n_cols) {
+                        throw std::runtime_error("The record is narrower than the sample store.");
+                }
+
+                if(++n_written - n_flushed == chunk_size) flush();
+        }
+
+        // write the records since the last flush to disk and update the header
+        void flush() {
+
+                if(!is_open || n_written == n_flushed) return;
+
+#ifndef _WIN32
+                map[3] = (double)n_written;
+                ::msync(map, map_bytes, MS_SYNC);
+                ::madvise(map, map_bytes, MADV_DONTNEED);
+#else
+                arma::uword n_buf = n_written - n_flushed;
+                for(arma::uword c = 0; c < n_cols; ++c) {
+                        store_fseek(fp, sizeof(double) * (STORE_HEADER + c * capacity + n_flushed), SEEK_SET);
+                        std::fwrite(buffer.colptr(c), sizeof(double), n_buf, fp);
+                }
+
+                double n_rec = (double)n_written;
+                store_fseek(fp, sizeof(double) * 3, SEEK_SET);
+                std::fwrite(&n_rec, sizeof(double), 1, fp);
+                std::fflush(fp);
+#endif
+                n_flushed = n_written;
+        }
+
+        void close() {
+
+                if(!is_open) return;
+                flush();
+
+#ifndef _WIN32
+                ::munmap(map, map_bytes);
+                ::close(fd);
+#else
+                std::fclose(fp);
+#endif
+                is_open = false;
+        }
+
+        arma::uword n_cols;
+        arma::uword capacity;
+        arma::uword chunk_size;
+        arma::uword n_written;
+        arma::uword n_flushed;
+        bool is_open;
+
+#ifndef _WIN32
+        int fd;
+        double* map;
+        size_t map_bytes;
+#else
+        std::FILE* fp;
+        arma::mat buffer;
+#endif
+};
+
+//' Open a file-backed store for MCMC samples.
+//'
+//' Allocates a file with room for a fixed number of records of fixed width,
+//' see \code{mcmc_sample_store}. Any existing file is overwritten, unless the
+//' store is reopened at an offset.
+//'
+//' @param sample_file path of the file
+//' @param n_cols number of elements in each record
+//' @param capacity number of records
+//' @param chunk_size number of records between flushes of the file
+//' @param offset number of records to keep when reopening an existing store,
+//'   defaults to 0
+//'
+//' @return external pointer to the sample store, which is closed when the
+//'   pointer is garbage collected
+//' @export
+// [[Rcpp::export]]
+SEXP open_mcmc_store(std::string sample_file, int n_cols, int capacity, int chunk_size = 100, int offset = 0) {
+
+        try{
+                if(n_cols < 1 || capacity < 0 || chunk_size < 1) {
+                        throw std::runtime_error("The sample store dimensions must be positive.");
+                }
+                if(offset < 0 || offset > capacity) {
+                        throw std::runtime_error("The offset must be between zero and the capacity of the sample store.");
+                }
+
+                return Rcpp::XPtr<sample_store>(new sample_store(sample_file, n_cols, capacity, chunk_size, offset));
+
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+
+        return R_NilValue;
+}
+
+//' Write a record to an MCMC sample store.
+//'
+//' Copies the objects saved at an MCMC sample into the next record of the
+//' store in a single call, flushing the store if a chunk of records has been
+//' completed.
+//'
+//' @param store_pointer external pointer to the sample store
+//' @param fields list of numeric objects, in the order of the store layout
+//'
+//' @return writes the record to the sample store
+//' @export
+// [[Rcpp::export]]
+void write_mcmc_record(SEXP store_pointer, const Rcpp::List& fields) {
+
+        try{
+                Rcpp::XPtr<sample_store> store(store_pointer);
+                store->write(fields);
+
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+}
+
+//' Flush an MCMC sample store.
+//'
+//' @param store_pointer external pointer to the sample store
+//'
+//' @return number of records written to the file, i.e., the offset at which
+//'   the store may be reopened
+//' @export
+// [[Rcpp::export]]
+int flush_mcmc_store(SEXP store_pointer) {
+
+        Rcpp::XPtr<sample_store> store(store_pointer);
+        store->flush();
+
+        return store->n_flushed;
+}
+
+//' Close an MCMC sample store.
+//'
+//' @param store_pointer external pointer to the sample store
+//'
+//' @return flushes the remaining records and closes the sample store file
+//' @export
+// [[Rcpp::export]]
+void close_mcmc_store(SEXP store_pointer) {
+
+        Rcpp::XPtr<sample_store> store(store_pointer);
+        store->close();
+}
@@ -1,5 +1,6 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include <RcppArmadillo.h>
+#include "stemr_rng.h"
 using namespace arma;
 using namespace Rcpp;
 
@@ -22,8 +23,8 @@ arma::mat rmvtn(int n, const arma::rowvec& mu, const arma::mat& sigma) {
         int p = mu.n_elem;
 
         // generate independent standard normal RVs
-        Rcpp::NumericVector draws = Rcpp::rnorm(n*p);
-        arma::mat X(draws.begin(), n, p, false, true);
+        arma::mat X(n, p);
+        fill_normals(X.memptr(), X.n_elem);
 
         // add the mean and multiply by the upper triangular portion of the cholesky
         return arma::repmat(mu, n, 1) + X * arma::chol(sigma, "upper");
@@ -42,17 +43,16 @@ arma::mat rmvtn(int n, const arma::rowvec& mu, const arma::mat& sigma) {
 // [[Rcpp::export]]
 arma::vec dmvtn(const arma::mat& x, const arma::rowvec& mu, const arma::mat& sigma, bool logd = false) {
 
-        int n = x.n_rows;
         int xdim = x.n_cols;
-        arma::vec out(n);
-        arma::mat rooti = arma::trans(arma::inv(arma::chol(sigma, "upper")));
-        double rootisum = arma::sum(log(rooti.diag()));
+
+        // solve against the lower triangular factor rather than inverting it
+        arma::mat R = arma::chol(sigma, "upper");
+        arma::mat Z = arma::solve(arma::trimatl(R.t()), arma::trans(x.each_row() - mu));
+
+        double logdet    = arma::sum(arma::log(R.diag()));
         double constants = -(static_cast<double>(xdim)/2.0) * log2pi;
 
-        for (int i=0; i < n; i++) {
-                arma::vec z = rooti * arma::trans(x.row(i) - mu) ;
-                out(i)      = constants - 0.5 * arma::sum(z%z) + rootisum;
-        }
+        arma::vec out = constants - logdet - 0.5 * arma::trans(arma::sum(Z % Z, 0));
 
         if (logd == false) {
                 out = exp(out);
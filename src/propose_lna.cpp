@@ -1,6 +1,8 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_lna.h"
+#include "stemr_forcings.h"
 
 using namespace Rcpp;
 using namespace arma;
@@ -26,6 +28,11 @@ using namespace arma;
 //' but too large of an initial step can lead to failure in stiff systems).
 //' @param lna_pointer external pointer to the compiled LNA integration function.
 //' @param set_pars_pointer external pointer to the function for setting LNA pars.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
+//' @param diffusion_sqrt method for computing the square root of the diffusion
+//'   matrix, either "svd", "eigen" (symmetric eigendecomposition), or "chol"
+//'   (pivoted Cholesky).
 //' @return list containing the stochastic perturbations (i.i.d. N(0,1) draws) and
 //' the LNA path on its natural scale which is determined by the perturbations.
 //'
@@ -46,7 +53,9 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
                        int max_attempts,
                        double step_size,
                        SEXP lna_pointer,
-                       SEXP set_pars_pointer) {
+                       SEXP set_pars_pointer,
+                       SEXP ctx_pointer,
+                       std::string diffusion_sqrt = "svd") {
       
         // get the dimensions of various objects
         int n_events = stoich_matrix.n_cols;         // number of transition events, e.g., S2I, I2R
@@ -54,17 +63,19 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
         int n_odes   = n_events + n_events*n_events; // number of ODEs
         int n_times  = lna_times.n_elem;             // number of times at which the LNA must be evaluated
         int n_tcovar = lna_tcovar_inds.size();       // number of time-varying covariates or parameters
-        int n_forcings = forcing_tcov_inds.n_elem;   // number of forcings
         
-        // for use with forcings
-        double forcing_flow = 0;
-        arma::vec forcing_distvec(n_comps, arma::fill::zeros);
+        // forcings compiled into sparse transfer operators
+        forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers);
 
         // initialize the objects used in each time interval
         double t_L = 0;
         double t_R = 0;
+
+        // allocate the integrator context for this call
+        ode_context ctx(lna_pointer, set_pars_pointer, ctx_pointer);
+
         Rcpp::NumericVector current_params = lna_pars.row(0);   // vector for storing the current parameter values
-        CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+        ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
 
         // initial state vector - copy elements from the current parameter vector
         arma::vec init_volumes(current_params.begin() + init_start, n_comps);
@@ -77,11 +88,15 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
         
         arma::vec log_lna(n_events, arma::fill::zeros);  // LNA increment, log scale
         arma::vec nat_lna(n_events, arma::fill::zeros);  // LNA increment, natural scale
+        arma::sp_mat stoich_sparse(stoich_matrix);        // sparse stoichiometry matrix
         
         // Objects for computing the eigen decomposition of the LNA covariance matrices
         arma::vec svd_d(n_events, arma::fill::zeros);
         arma::mat svd_U(n_events, n_events, arma::fill::zeros);
         arma::mat svd_V(n_events, n_events, arma::fill::zeros);
+        arma::mat sqrt_work(n_events, n_events, arma::fill::zeros);
+        arma::uvec sqrt_perm(n_events, arma::fill::zeros);
+        lna_sqrt_blocks sqrt_blocks;
         bool good_svd = true;
         
         // matrix in which to store the LNA path
@@ -95,17 +110,11 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
         if(forcing_inds[0]) {
               
               // distribute the forcings proportionally to the compartment counts in the applicable states
-              for(int j=0; j < n_forcings; ++j) {
-                    
-                    forcing_flow       = lna_pars(0, forcing_tcov_inds[j]);
-                    forcing_distvec    = forcing_flow * normalise(forcings_out.col(j) % init_volumes, 1);
-                    init_volumes      += forcing_transfers.slice(j) * forcing_distvec;
-              }
+              forcings.apply(init_volumes.memptr(), lna_pars, 0);
         }
         
-        // sample the stochastic perturbations - use Rcpp RNG for safety
-        Rcpp::NumericVector draws_rcpp(Rcpp::clone(lna_draws));
-        arma::mat draws(draws_rcpp.begin(), n_events, n_times-1, true);
+        // the stochastic perturbations, copied once into the matrix that is returned
+        arma::mat draws(lna_draws.begin(), n_events, n_times-1);
         
         // iterate over the time sequence, solving the LNA over each interval
         for(int j=0; j < (n_times-1); ++j) {
@@ -116,7 +125,7 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
               
               // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
               std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-              CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+              ctx.integrate(lna_state_vec.begin(), t_L, t_R, step_size);
               
               // transfer the elements of the lna_state_vec to the process objects
               std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
@@ -128,28 +137,18 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
                           good_svd = false;
                           throw std::runtime_error("Integration failed.");
                     } else {
-                          good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
+                          good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt, sqrt_work, sqrt_perm, sqrt_blocks); // compute the square root
                     }
                     
                     if(!good_svd) {
                           throw std::runtime_error("SVD failed.");
                           
                     } else {
-                          svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                          svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                          svd_U *= svd_V.t();                                 // complete svd_sqrt
-                          svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-                          
                           log_lna = lna_drift + svd_U * draws.col(j);         // map the LNA draws
                     }
                     
               } catch(std::exception & err) {
                     
-                    // reinstatiate the SVD objects
-                    arma::vec svd_d(n_events, arma::fill::zeros);
-                    arma::mat svd_U(n_events, n_events, arma::fill::zeros);
-                    arma::mat svd_V(n_events, n_events, arma::fill::zeros);
-                    
                     // forward the exception
                     forward_exception_to_r(err);
                     
@@ -158,10 +157,10 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
               }
               
               // compute the LNA increment
-              nat_lna = arma::vec(expm1(Rcpp::NumericVector(log_lna.begin(), log_lna.end())));
+              for(int k=0; k < n_events; ++k) nat_lna[k] = std::expm1(log_lna[k]);
               
               // update the compartment volumes
-              init_volumes += stoich_matrix * nat_lna;
+              init_volumes += stoich_sparse * nat_lna;
               
               // throw errors for negative increments or negative volumes
               try{
@@ -189,12 +188,7 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
               if(forcing_inds[j+1]) {
                     
                     // distribute the forcings proportionally to the compartment counts in the applicable states
-                    for(int s=0; s < n_forcings; ++s) {
-                          
-                          forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                          forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                          init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                    }
+                    forcings.apply(init_volumes.memptr(), lna_pars, j+1);
                     
                     // throw errors for negative negative volumes
                     try{
@@ -225,7 +219,7 @@ Rcpp::List propose_lna(const arma::rowvec& lna_times,
               std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
               
               // set the lna parameters and reset the LNA state vector
-              CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+              ctx.set_pars(current_params.begin());
         }
         
         // return the paths
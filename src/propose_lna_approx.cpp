@@ -1,6 +1,9 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_lna.h"
+#include "stemr_rng.h"
+#include "stemr_forcings.h"
 
 using namespace Rcpp;
 using namespace arma;
@@ -30,6 +33,11 @@ using namespace arma;
 //' but too large of an initial step can lead to failure in stiff systems).
 //' @param lna_pointer external pointer to the compiled LNA integration function.
 //' @param set_pars_pointer external pointer to the function for setting LNA pars.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
+//' @param diffusion_sqrt method for computing the square root of the diffusion
+//'   matrix, either "svd", "eigen" (symmetric eigendecomposition), or "chol"
+//'   (pivoted Cholesky).
 //' @return list containing the stochastic perturbations (i.i.d. N(0,1) draws) and
 //' the LNA path on its natural scale which is determined by the perturbations.
 //'
@@ -53,7 +61,9 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                               double lna_bracket_width,
                               double step_size,
                               SEXP lna_pointer,
-                              SEXP set_pars_pointer) {
+                              SEXP set_pars_pointer,
+                              SEXP ctx_pointer,
+                              std::string diffusion_sqrt = "svd") {
       
         // get the dimensions of various objects
         int n_events = stoich_matrix.n_cols;         // number of transition events, e.g., S2I, I2R
@@ -61,11 +71,9 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
         int n_odes   = n_events + n_events*n_events; // number of ODEs
         int n_times  = lna_times.n_elem;             // number of times at which the LNA must be evaluated
         int n_tcovar = lna_tcovar_inds.size();       // number of time-varying covariates or parameters
-        int n_forcings = forcing_tcov_inds.n_elem;   // number of forcings
         
-        // for use with forcings
-        double forcing_flow = 0;
-        arma::vec forcing_distvec(n_comps, arma::fill::zeros);
+        // forcings compiled into sparse transfer operators
+        forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers);
 
         // initialize the LNA objects - the vector for storing the current state
         Rcpp::NumericVector lna_state_vec(n_odes);   // vector to store the results of the ODEs
@@ -75,6 +83,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
 
         arma::vec log_lna(n_events, arma::fill::zeros);  // LNA increment, log scale
         arma::vec nat_lna(n_events, arma::fill::zeros);  // LNA increment, natural scale
+        arma::sp_mat stoich_sparse(stoich_matrix);        // sparse stoichiometry matrix
 
         // Objects for computing the eigen decomposition of the LNA covariance matrices
         arma::vec svd_d(n_events, arma::fill::zeros);
@@ -85,8 +94,15 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
         // initialize the objects used in each time interval
         double t_L = 0;
         double t_R = 0;
+
+        // allocate the integrator context for this call
+        ode_context ctx(lna_pointer, set_pars_pointer, ctx_pointer);
+
+        // stream for the perturbations and ESS angles, seeded from R's RNG
+        philox_rng rng(draw_rng_seed(), 0);
+
         Rcpp::NumericVector current_params = lna_pars.row(0);   // vector for storing the current parameter values
-        CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+        ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
         
         // initial state vector - copy elements from the current parameter vector
         arma::vec init_volumes(current_params.begin() + init_start, n_comps);
@@ -105,22 +121,15 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
         if(forcing_inds[0]) {
               
               // distribute the forcings proportionally to the compartment counts in the applicable states
-              for(int s=0; s < n_forcings; ++s) {
-                    
-                    forcing_flow       = lna_pars(0, forcing_tcov_inds[s]);
-                    forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                    init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                    init_volumes_prop += forcing_transfers.slice(s) * forcing_distvec;
-              }
+              forcings.apply(init_volumes.memptr(), lna_pars, 0, init_volumes_prop.memptr());
         }
         
         // sample the stochastic perturbations
         int n_draws = n_events * (n_times-1);
-        Rcpp::NumericVector draws_cur_rcpp(Rcpp::clone(lna_draws));
-        Rcpp::NumericVector draws_prop_rcpp(Rcpp::clone(lna_draws));
         
-        arma::mat draws_cur(draws_cur_rcpp.begin(), n_events, n_times-1, false, true);
-        arma::mat draws_prop(draws_prop_rcpp.begin(), n_events, n_times-1, false, true);
+        // the current draws are copied once from lna_draws, the proposals are overwritten before use
+        arma::mat draws_cur(lna_draws.begin(), n_events, n_times-1);
+        arma::mat draws_prop(n_events, n_times-1, arma::fill::zeros);
         arma::mat draws_temp(n_events, n_times-1, arma::fill::zeros);
         
         // integer for the attempt number
@@ -141,7 +150,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               
               // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
               std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-              CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+              ctx.integrate(lna_state_vec.begin(), t_L, t_R, step_size);
               
               // transfer the elements of the lna_state_vec to the process objects
               std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
@@ -156,18 +165,13 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           good_svd = false;
                           throw std::runtime_error("Integration failed.");
                     } else {
-                          good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
+                          good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt); // compute the square root
                     }
                     
                     if(!good_svd) {
                           throw std::runtime_error("SVD failed.");
                           
                     } else {
-                          svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                          svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                          svd_U *= svd_V.t();                                 // complete svd_sqrt
-                          svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-                          
                           log_lna = lna_drift + svd_U * draws_cur.col(j);         // map the LNA draws
                     }
                     
@@ -190,17 +194,17 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               nat_lna = arma::exp(log_lna) - 1;
               
               // update the compartment volumes
-              init_volumes_prop = init_volumes + stoich_matrix * nat_lna;
+              init_volumes_prop = init_volumes + stoich_sparse * nat_lna;
               
               // ensure monotonicity of the increment, compartment volumes, 
               // and compartment volumes with forcings
               attempt = 0;
               while((any(nat_lna < 0) || any(init_volumes_prop < 0)) && (attempt <= max_attempts)) {
                     attempt          += 1;
-                    draws_cur.col(j)  = Rcpp::as<arma::vec>(Rcpp::rnorm(n_events)); // draw a new vector of N(0,1)
+                    for(int k=0; k < n_events; ++k) draws_cur(k, j) = rng.normal(); // draw a new vector of N(0,1)
                     log_lna           = lna_drift + svd_U * draws_cur.col(j);       // map the new draws to
                     nat_lna           = arma::exp(log_lna) - 1;                     // compute the LNA increment
-                    init_volumes_prop = init_volumes + stoich_matrix * nat_lna;     // compute new initial volumes
+                    init_volumes_prop = init_volumes + stoich_sparse * nat_lna;     // compute new initial volumes
               }
               
               try{
@@ -229,12 +233,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               if(forcing_inds[j+1]) {
                     
                     // distribute the forcings proportionally to the compartment counts in the applicable states
-                    for(int s=0; s < n_forcings; ++s) {
-                          
-                          forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                          forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                          init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                    }
+                    forcings.apply(init_volumes.memptr(), lna_pars, j+1);
                     
                     // throw errors for negative increments or negative volumes
                     try{
@@ -264,7 +263,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
               
               // set the lna parameters and reset the LNA state vector
-              CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+              ctx.set_pars(current_params.begin());
         }
         
         // now warm up the sampler
@@ -272,7 +271,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               
               // initialize the parameters and volumes
               current_params = lna_pars.row(0);   // vector for storing the current parameter values
-              CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+              ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
               
               // initial state vector - copy elements from the current parameter vector
               std::copy(current_params.begin()+init_start, current_params.begin()+init_start+n_comps, init_volumes.begin());
@@ -282,20 +281,14 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               if(forcing_inds[0]) {
                     
                     // distribute the forcings proportionally to the compartment counts in the applicable states
-                    for(int s=0; s < n_forcings; ++s) {
-                          
-                          forcing_flow       = lna_pars(0, forcing_tcov_inds[s]);
-                          forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                          init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                          init_volumes_prop += forcing_transfers.slice(s) * forcing_distvec;
-                    }
+                    forcings.apply(init_volumes.memptr(), lna_pars, 0, init_volumes_prop.memptr());
               }
               
               // sample new perturbations
-              std::copy_n(Rcpp::rnorm(n_draws).begin(), n_draws, draws_prop_rcpp.begin());
+              for(int k=0; k < n_draws; ++k) draws_prop[k] = rng.normal();
               
               // center the bracket
-              theta = runif(1, 0, lna_bracket_width)[0];
+              theta = lna_bracket_width * rng.unif();
               lower = theta - lna_bracket_width;
               upper = theta;
               
@@ -314,7 +307,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     
                     // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
                     std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-                    CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+                    ctx.integrate(lna_state_vec.begin(), t_L, t_R, step_size);
                     
                     // transfer the elements of the lna_state_vec to the process objects
                     std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
@@ -329,18 +322,13 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                                 good_svd = false;
                                 throw std::runtime_error("Integration failed.");
                           } else {
-                                good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
+                                good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt); // compute the square root
                           }
                           
                           if(!good_svd) {
                                 throw std::runtime_error("SVD failed.");
                                 
                           } else {
-                                svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                                svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                                svd_U *= svd_V.t();                                 // complete svd_sqrt
-                                svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-                                
                                 log_lna = lna_drift + svd_U * draws_temp.col(j);         // map the LNA draws
                           }
                           
@@ -363,7 +351,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     nat_lna = arma::exp(log_lna) - 1;
                     
                     // update the compartment volumes
-                    init_volumes_prop = init_volumes + stoich_matrix * nat_lna;
+                    init_volumes_prop = init_volumes + stoich_sparse * nat_lna;
                     
                     // ensure monotonicity of the increment, compartment volumes,
                     // and compartment volumes with forcings
@@ -379,12 +367,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     if(forcing_inds[j+1]) {
                           
                           // distribute the forcings proportionally to the compartment counts in the applicable states
-                          for(int s=0; s < n_forcings; ++s) {
-                                
-                                forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                                forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                                init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                          }
+                          forcings.apply(init_volumes.memptr(), lna_pars, j+1);
                           
                           // throw errors for negative increments or negative volumes
                           if(any(init_volumes < 0)) {
@@ -407,14 +390,14 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
                     
                     // set the lna parameters and reset the LNA state vector
-                    CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+                    ctx.set_pars(current_params.begin());
               }
               
               while( (upper - lower) > sqrt(arma::datum::eps) && !valid_path) {
                     
                     // initialize the parameters and volumes
                     current_params = lna_pars.row(0);   // vector for storing the current parameter values
-                    CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+                    ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
                     
                     // initial state vector - copy elements from the current parameter vector
                     std::copy(current_params.begin()+init_start, current_params.begin()+init_start+n_comps, init_volumes.begin());
@@ -424,13 +407,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     if(forcing_inds[0]) {
                           
                           // distribute the forcings proportionally to the compartment counts in the applicable states
-                          for(int s=0; s < n_forcings; ++s) {
-                                
-                                forcing_flow       = lna_pars(0, forcing_tcov_inds[s]);
-                                forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                                init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                                init_volumes_prop += forcing_transfers.slice(s) * forcing_distvec;
-                          }
+                          forcings.apply(init_volumes.memptr(), lna_pars, 0, init_volumes_prop.memptr());
                     }
                     
                     // construct the next proposal
@@ -440,7 +417,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           upper = theta;
                     }
                     
-                    theta = runif(1, lower, upper)[0];
+                    theta = lower + (upper - lower) * rng.unif();
                     draws_temp = cos(theta) * draws_cur + sin(theta) * draws_prop;
                     
                     // initialize the log-likelihood (indicator for a valid proposal)
@@ -455,7 +432,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           
                           // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
                           std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-                          CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+                          ctx.integrate(lna_state_vec.begin(), t_L, t_R, step_size);
                           
                           // transfer the elements of the lna_state_vec to the process objects
                           std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
@@ -470,18 +447,13 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                                       good_svd = false;
                                       throw std::runtime_error("Integration failed.");
                                 } else {
-                                      good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
+                                      good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt); // compute the square root
                                 }
                                 
                                 if(!good_svd) {
                                       throw std::runtime_error("SVD failed.");
                                       
                                 } else {
-                                      svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                                      svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                                      svd_U *= svd_V.t();                                 // complete svd_sqrt
-                                      svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-                                      
                                       log_lna = lna_drift + svd_U * draws_temp.col(j);         // map the LNA draws
                                 }
                                 
@@ -504,7 +476,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           nat_lna = arma::exp(log_lna) - 1;
                           
                           // update the compartment volumes
-                          init_volumes_prop = init_volumes + stoich_matrix * nat_lna;
+                          init_volumes_prop = init_volumes + stoich_sparse * nat_lna;
                           
                           // ensure monotonicity of the increment, compartment volumes,
                           // and compartment volumes with forcings
@@ -521,12 +493,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           if(forcing_inds[j+1]) {
                                 
                                 // distribute the forcings proportionally to the compartment counts in the applicable states
-                                for(int s=0; s < n_forcings; ++s) {
-                                      
-                                      forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                                      forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                                      init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                                }
+                                forcings.apply(init_volumes.memptr(), lna_pars, j+1);
                                 
                                 // throw errors for negative increments or negative volumes
                                 if(any(init_volumes < 0)) {
@@ -549,7 +516,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
                           
                           // set the lna parameters and reset the LNA state vector
-                          CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+                          ctx.set_pars(current_params.begin());
                     }
               }
               
@@ -564,7 +531,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               
               // initialize the parameters and volumes
               current_params = lna_pars.row(0);   // vector for storing the current parameter values
-              CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+              ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
               
               // initial state vector - copy elements from the current parameter vector
               std::copy(current_params.begin()+init_start, current_params.begin()+init_start+n_comps, init_volumes.begin());
@@ -574,20 +541,14 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
               if(forcing_inds[0]) {
                     
                     // distribute the forcings proportionally to the compartment counts in the applicable states
-                    for(int s=0; s < n_forcings; ++s) {
-                          
-                          forcing_flow       = lna_pars(0, forcing_tcov_inds[s]);
-                          forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                          init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                          init_volumes_prop += forcing_transfers.slice(s) * forcing_distvec;
-                    }
+                    forcings.apply(init_volumes.memptr(), lna_pars, 0, init_volumes_prop.memptr());
               }
               
               // sample new perturbations
-              std::copy_n(Rcpp::rnorm(n_draws).begin(), n_draws, draws_prop_rcpp.begin());
+              for(int k=0; k < n_draws; ++k) draws_prop[k] = rng.normal();
               
               // center the bracket
-              theta = runif(1, 0, 2*arma::datum::pi)[0];
+              theta = 2*arma::datum::pi * rng.unif();
               lower = theta - 2*arma::datum::pi;
               upper = theta;
               
@@ -606,7 +567,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     
                     // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
                     std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-                    CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+                    ctx.integrate(lna_state_vec.begin(), t_L, t_R, step_size);
                     
                     // transfer the elements of the lna_state_vec to the process objects
                     std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
@@ -621,18 +582,13 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                                 good_svd = false;
                                 throw std::runtime_error("Integration failed.");
                           } else {
-                                good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
+                                good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt); // compute the square root
                           }
                           
                           if(!good_svd) {
                                 throw std::runtime_error("SVD failed.");
                                 
                           } else {
-                                svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                                svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                                svd_U *= svd_V.t();                                 // complete svd_sqrt
-                                svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-                                
                                 log_lna = lna_drift + svd_U * draws_temp.col(j);         // map the LNA draws
                           }
                           
@@ -655,7 +611,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     nat_lna = arma::exp(log_lna) - 1;
                     
                     // update the compartment volumes
-                    init_volumes_prop = init_volumes + stoich_matrix * nat_lna;
+                    init_volumes_prop = init_volumes + stoich_sparse * nat_lna;
                     
                     // ensure monotonicity of the increment, compartment volumes,
                     // and compartment volumes with forcings
@@ -678,12 +634,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     if(forcing_inds[j+1]) {
                           
                           // distribute the forcings proportionally to the compartment counts in the applicable states
-                          for(int s=0; s < n_forcings; ++s) {
-                                
-                                forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                                forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                                init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                          }
+                          forcings.apply(init_volumes.memptr(), lna_pars, j+1);
                           
                           // throw errors for negative increments or negative volumes
                           if(any(init_volumes < 0)) {
@@ -706,14 +657,14 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
                     
                     // set the lna parameters and reset the LNA state vector
-                    CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+                    ctx.set_pars(current_params.begin());
               }
               
               while( (upper - lower) > sqrt(arma::datum::eps) && !valid_path) {
                     
                     // initialize the parameters and volumes
                     current_params = lna_pars.row(0);   // vector for storing the current parameter values
-                    CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);  // set the parameters in the odeintr namespace
+                    ctx.set_pars(current_params.begin());  // set the parameters in the integrator context
                     
                     // initial state vector - copy elements from the current parameter vector
                     std::copy(current_params.begin()+init_start, current_params.begin()+init_start+n_comps, init_volumes.begin());
@@ -723,13 +674,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                     if(forcing_inds[0]) {
                           
                           // distribute the forcings proportionally to the compartment counts in the applicable states
-                          for(int s=0; s < n_forcings; ++s) {
-                                
-                                forcing_flow       = lna_pars(0, forcing_tcov_inds[s]);
-                                forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                                init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                                init_volumes_prop += forcing_transfers.slice(s) * forcing_distvec;
-                          }
+                          forcings.apply(init_volumes.memptr(), lna_pars, 0, init_volumes_prop.memptr());
                     }
                     
                     // construct the next proposal
@@ -739,7 +684,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           upper = theta;
                     }
                     
-                    theta = runif(1, lower, upper)[0];
+                    theta = lower + (upper - lower) * rng.unif();
                     draws_temp = cos(theta) * draws_cur + sin(theta) * draws_prop;
                     
                     // initialize the log-likelihood (indicator for a valid proposal)
@@ -754,7 +699,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           
                           // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
                           std::fill(lna_state_vec.begin(), lna_state_vec.end(), 0.0);
-                          CALL_INTEGRATE_STEM_ODE(lna_state_vec, t_L, t_R, step_size, lna_pointer);
+                          ctx.integrate(lna_state_vec.begin(), t_L, t_R, step_size);
                           
                           // transfer the elements of the lna_state_vec to the process objects
                           std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
@@ -769,18 +714,13 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                                       good_svd = false;
                                       throw std::runtime_error("Integration failed.");
                                 } else {
-                                      good_svd = arma::svd(svd_U, svd_d, svd_V, lna_diffusion); // compute the SVD
+                                      good_svd = lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt); // compute the square root
                                 }
 
                                 if(!good_svd) {
                                       throw std::runtime_error("SVD failed.");
 
                                 } else {
-                                      svd_d.elem(arma::find(svd_d < 0)).zeros();          // zero out negative sing. vals
-                                      svd_V.each_row() %= arma::sqrt(svd_d).t();          // multiply rows of V by sqrt(d)
-                                      svd_U *= svd_V.t();                                 // complete svd_sqrt
-                                      svd_U.elem(arma::find(lna_diffusion == 0)).zeros(); // zero out numerical errors
-
                                       log_lna = lna_drift + svd_U * draws_temp.col(j);         // map the LNA draws
                                 }
 
@@ -803,7 +743,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           nat_lna = arma::exp(log_lna) - 1;
 
                           // update the compartment volumes
-                          init_volumes_prop = init_volumes + stoich_matrix * nat_lna;
+                          init_volumes_prop = init_volumes + stoich_sparse * nat_lna;
 
                           // ensure monotonicity of the increment, compartment volumes,
                           // and compartment volumes with forcings
@@ -826,12 +766,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           if(forcing_inds[j+1]) {
                                 
                                 // distribute the forcings proportionally to the compartment counts in the applicable states
-                                for(int s=0; s < n_forcings; ++s) {
-                                      
-                                      forcing_flow       = lna_pars(j+1, forcing_tcov_inds[s]);
-                                      forcing_distvec    = forcing_flow * normalise(forcings_out.col(s) % init_volumes, 1);
-                                      init_volumes      += forcing_transfers.slice(s) * forcing_distvec;
-                                }
+                                forcings.apply(init_volumes.memptr(), lna_pars, j+1);
                                 
                                 // throw errors for negative increments or negative volumes
                                 if(any(init_volumes < 0)) {
@@ -854,7 +789,7 @@ Rcpp::List propose_lna_approx(const arma::rowvec& lna_times,
                           std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
 
                           // set the lna parameters and reset the LNA state vector
-                          CALL_SET_ODE_PARAMS(current_params, set_pars_pointer);
+                          ctx.set_pars(current_params.begin());
                     }
               }
 
@@ -0,0 +1,288 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#define ARMA_DONT_PRINT_ERRORS
+#include "stemr_types.h"
+#include "stemr_utils.h"
+#include "stemr_lna.h"
+#include "stemr_forcings.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace Rcpp;
+using namespace arma;
+
+// Map the N(0,1) draws for a single simulation to an LNA path. Mirrors
+// propose_lna, but only uses armadillo objects so that it may be called from a
+// worker thread, and writes the paths into slices of preallocated cubes, with
+// the times in the rows. Returns false if the integration or the square root
+// of the diffusion matrix failed, or if the path had negative increments or
+// compartment volumes.
+static bool lna_draw_path(ode_context& ctx,
+                          lna_scratch& ws,
+                          forcing_engine& forcings,
+                          arma::mat& incid_path,
+                          arma::mat& prev_path,
+                          arma::vec& current_params,
+                          arma::vec& svd_d,
+                          arma::mat& svd_U,
+                          arma::mat& svd_V,
+                          const arma::rowvec& lna_times,
+                          const arma::mat& lna_pars,
+                          const double* draw_pars,
+                          int n_draw_pars,
+                          const double* draws,
+                          int n_tcovar,
+                          int init_start,
+                          const std::vector<int>& param_update_inds,
+                          const std::vector<int>& forcing_inds,
+                          const std::string& diffusion_sqrt,
+                          double step_size) {
+
+        int n_events = svd_d.n_elem;
+        int n_comps  = ws.init_volumes.n_elem;
+        int n_times  = lna_times.n_elem;
+
+        // parameters and initial volumes for this simulation
+        current_params = lna_pars.row(0).t();
+        std::copy(draw_pars, draw_pars + n_draw_pars, current_params.begin());
+        ctx.set_pars(current_params.memptr());
+
+        arma::vec& init_volumes = ws.init_volumes;
+        std::copy(current_params.begin() + init_start, current_params.begin() + init_start + n_comps, init_volumes.begin());
+
+        arma::vec& lna_state_vec = ws.lna_state;
+        arma::vec& lna_drift     = ws.lna_drift;
+        arma::mat& lna_diffusion = ws.lna_diffusion;
+        arma::vec& nat_lna       = ws.nat_lna;
+
+        incid_path.col(0) = lna_times.t();
+        prev_path.col(0)  = lna_times.t();
+        incid_path(0, arma::span(1, n_events)).zeros();
+        prev_path(0, arma::span(1, n_comps)) = init_volumes.t();
+
+        // apply forcings if called for - applied after censusing at the first time
+        if(forcing_inds[0]) {
+                forcings.apply(init_volumes.memptr(), lna_pars, 0);
+        }
+
+        for(int j=0; j < (n_times-1); ++j) {
+
+                // Reset the LNA state vector and integrate the LNA ODEs over the next interval to 0
+                lna_state_vec.zeros();
+                ctx.integrate(lna_state_vec.memptr(), lna_times[j], lna_times[j+1], step_size);
+
+                // transfer the elements of the lna_state_vec to the process objects
+                std::copy(lna_state_vec.begin(), lna_state_vec.begin() + n_events, lna_drift.begin());
+                std::copy(lna_state_vec.begin() + n_events, lna_state_vec.end(), lna_diffusion.begin());
+
+                if(lna_drift.has_nan() || lna_diffusion.has_nan()) return false;
+
+                // ensure symmetry of the diffusion matrix
+                for(int c=0; c < n_events; ++c) {
+                        for(int r=c+1; r < n_events; ++r) lna_diffusion(r, c) = lna_diffusion(c, r);
+                }
+
+                if(!lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, diffusion_sqrt,
+                                       ws.sqrt_work, ws.perm, ws.sqrt_blocks)) return false;
+
+                // map the LNA draws and compute the LNA increment
+                const double* draws_j = draws + j * n_events;
+                for(int r=0; r < n_events; ++r) {
+                        double log_lna = lna_drift[r];
+                        for(int c=0; c < n_events; ++c) log_lna += svd_U(r, c) * draws_j[c];
+                        nat_lna[r] = std::expm1(log_lna);
+                }
+
+                if(nat_lna.min() < 0) return false;
+
+                // update the compartment volumes and save the increment and volumes
+                init_volumes += ws.stoich_sparse * nat_lna;
+                if(init_volumes.min() < 0) return false;
+
+                incid_path(j+1, arma::span(1, n_events)) = nat_lna.t();
+                prev_path(j+1, arma::span(1, n_comps))   = init_volumes.t();
+
+                // apply forcings if called for - applied after censusing the path
+                if(forcing_inds[j+1]) {
+                        forcings.apply(init_volumes.memptr(), lna_pars, j+1);
+                        if(init_volumes.min() < 0) return false;
+                }
+
+                // update the time-varying covariates and parameters
+                if(param_update_inds[j+1]) {
+                        for(int c = current_params.n_elem - n_tcovar; c < (int)current_params.n_elem; ++c) {
+                                current_params[c] = lna_pars(j+1, c);
+                        }
+                }
+
+                // copy the compartment volumes to the current parameters
+                std::copy(init_volumes.begin(), init_volumes.end(), current_params.begin() + init_start);
+                ctx.set_pars(current_params.memptr());
+        }
+
+        return true;
+}
+
+//' Simulate LNA paths for a batch of draws.
+//'
+//' Maps the N(0,1) draws for many simulations to LNA paths in a single call,
+//' as in \code{propose_lna}. The integrator functions are resolved once and
+//' each thread uses its own integrator context and LNA workspace, so the
+//' simulations are distributed over a pool of threads. The paths are written
+//' into preallocated arrays and no intermediate R objects are created for each
+//' simulation. Draws for which the path is rejected are flagged rather than
+//' redrawn, so that the draws are resampled in R.
+//'
+//' @param lna_times vector of interval endpoint times
+//' @param lna_draws array of N(0,1) draws, with one slice per simulation
+//'   containing a matrix with one row per event and one column per interval
+//' @param lna_pars array of matrices of parameters, constants, and time-varying
+//'   covariates at each of the lna_times, either with a single slice shared by
+//'   all simulations or with one slice per simulation
+//' @param draw_pars matrix with one row per simulation of the parameters and
+//'   initial compartment volumes, copied into the first columns of the first
+//'   row of the parameter matrix
+//' @param lna_param_inds indices of the parameters
+//' @param lna_tcovar_inds indices of the time-varying covariates
+//' @param init_start index in the parameter vector where the initial compartment
+//'   volumes start
+//' @param param_update_inds logical vector indicating at which of the times the
+//'   LNA parameters need to be updated.
+//' @param stoich_matrix stoichiometry matrix giving the changes to compartments
+//'   from each reaction
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_tcov_inds indices of the time-varying covariates for the
+//'   forcings
+//' @param forcings_out matrix indicating the compartments that forcings flow out
+//'   of
+//' @param forcing_transfers array of forcing transfer matrices
+//' @param step_size initial step size for the ODE solver
+//' @param lna_pointer external pointer to the compiled LNA integration function.
+//' @param set_pars_pointer external pointer to the function for setting LNA pars.
+//' @param ctx_pointer external pointer to the functions for allocating and
+//'   releasing the integrator context.
+//' @param diffusion_sqrt method for computing the square root of the diffusion
+//'   matrix, either "svd", "eigen" (symmetric eigendecomposition), or "chol"
+//'   (pivoted Cholesky).
+//' @param n_threads number of threads
+//'
+//' @return List containing arrays with the LNA incidence and prevalence paths,
+//'   with one slice per simulation laid out as in the output of
+//'   \code{propose_lna}, and a logical vector indicating which paths were
+//'   accepted. Slices for the rejected paths are filled with NA.
+//' @export
+// [[Rcpp::export]]
+Rcpp::List propose_lna_batch(const arma::rowvec& lna_times,
+                             const arma::cube& lna_draws,
+                             const arma::cube& lna_pars,
+                             const arma::mat& draw_pars,
+                             const Rcpp::IntegerVector& lna_param_inds,
+                             const Rcpp::IntegerVector& lna_tcovar_inds,
+                             const int init_start,
+                             const Rcpp::LogicalVector& param_update_inds,
+                             const arma::mat& stoich_matrix,
+                             const Rcpp::LogicalVector& forcing_inds,
+                             const arma::uvec& forcing_tcov_inds,
+                             const arma::mat& forcings_out,
+                             const arma::cube& forcing_transfers,
+                             double step_size,
+                             SEXP lna_pointer,
+                             SEXP set_pars_pointer,
+                             SEXP ctx_pointer,
+                             std::string diffusion_sqrt = "svd",
+                             int n_threads = 1) {
+
+        int n_draws  = lna_draws.n_slices;
+        int n_events = stoich_matrix.n_cols;
+        int n_comps  = stoich_matrix.n_rows;
+        int n_times  = lna_times.n_elem;
+        int n_tcovar = lna_tcovar_inds.size();
+
+        try{
+                if(lna_pars.n_slices != 1 && (int)lna_pars.n_slices != n_draws) {
+                        throw std::runtime_error("lna_pars must have either one slice or one slice per simulation.");
+                }
+                if((int)draw_pars.n_rows != n_draws) {
+                        throw std::runtime_error("draw_pars must have one row per simulation.");
+                }
+                if(draw_pars.n_cols > lna_pars.n_cols) {
+                        throw std::runtime_error("draw_pars has more columns than lna_pars.");
+                }
+                if((int)lna_draws.n_rows != n_events || (int)lna_draws.n_cols < n_times - 1) {
+                        throw std::runtime_error("lna_draws must have one row per event and a column for each interval.");
+                }
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+
+#ifdef _OPENMP
+        if(n_threads < 1) n_threads = omp_get_max_threads();
+#else
+        n_threads = 1;
+#endif
+        if(n_threads > n_draws) n_threads = std::max(n_draws, 1);
+
+        // resolve the integrator functions on the main thread
+        ode_context fcns(lna_pointer, set_pars_pointer, ctx_pointer);
+
+        // indicators copied out of the R vectors
+        std::vector<int> update_inds(param_update_inds.begin(), param_update_inds.end());
+        std::vector<int> force_inds(forcing_inds.begin(), forcing_inds.end());
+
+        // draw parameters stored by row for contiguous access
+        arma::mat draw_pars_t = draw_pars.t();
+
+        // preallocated paths, one slice per simulation
+        arma::cube incid_paths(n_times, n_events + 1, n_draws);
+        arma::cube prev_paths(n_times, n_comps + 1, n_draws);
+        std::vector<int> success(n_draws, 0);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+        {
+                // integrator context, forcing operators, and scratch for this thread
+                ode_context ctx(fcns.integrator, fcns.par_setter, fcns.ctx_fcns, fcns.times_integrator, fcns.counter);
+                lna_scratch ws(n_events, n_comps);
+                ws.stoich_ops(stoich_matrix);
+                forcing_engine& forcings = ws.forcing_ops(forcing_tcov_inds, forcings_out, forcing_transfers);
+
+                arma::vec current_params(lna_pars.n_cols);
+                arma::vec svd_d(n_events, arma::fill::zeros);
+                arma::mat svd_U(n_events, n_events, arma::fill::zeros);
+                arma::mat svd_V(n_events, n_events, arma::fill::zeros);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+                for(int k=0; k < n_draws; ++k) {
+
+                        arma::mat incid_path(incid_paths.slice(k).memptr(), n_times, n_events + 1, false, true);
+                        arma::mat prev_path(prev_paths.slice(k).memptr(), n_times, n_comps + 1, false, true);
+
+                        try{
+                                success[k] = lna_draw_path(ctx, ws, forcings, incid_path, prev_path,
+                                                           current_params, svd_d, svd_U, svd_V, lna_times,
+                                                           lna_pars.slice(lna_pars.n_slices == 1 ? 0 : k),
+                                                           draw_pars_t.colptr(k), draw_pars.n_cols,
+                                                           lna_draws.slice(k).memptr(), n_tcovar, init_start,
+                                                           update_inds, force_inds, diffusion_sqrt, step_size);
+                        } catch(...) {
+                                success[k] = 0;
+                        }
+
+                        if(!success[k]) {
+                                incid_path.fill(NA_REAL);
+                                prev_path.fill(NA_REAL);
+                        }
+                }
+        }
+
+        return Rcpp::List::create(Rcpp::Named("incid_paths") = incid_paths,
+                                  Rcpp::Named("prev_paths")  = prev_paths,
+                                  Rcpp::Named("success")     = Rcpp::LogicalVector(success.begin(), success.end()));
+}
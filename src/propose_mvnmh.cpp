@@ -1,5 +1,7 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include <RcppArmadillo.h>
+#include "stemr_rng.h"
+#include "stemr_profile.h"
 
 using namespace Rcpp;
 using namespace arma;
@@ -19,16 +21,23 @@ void propose_mvnmh(arma::rowvec& params_prop,
                     const arma::mat& kernel_cov_chol,
                     double nugget) {
 
+    profile_scope scope(PROFILE_PROPOSE_MVNMH);
+
     int par_dim = params_cur.n_elem;
 
+    // N(0,1) draws for the proposal, written in place
+    arma::rowvec draws(par_dim);
+    fill_normals(draws.memptr(), par_dim);
+
     if(nugget == 0) {
-        params_prop = 
-            params_cur + 
-            Rcpp::as<arma::rowvec>(Rcpp::rnorm(par_dim)) * kernel_cov_chol;
+        params_prop = params_cur + draws * kernel_cov_chol;
     } else {
-        params_prop = 
-            params_cur + 
-            nugget * Rcpp::as<arma::rowvec>(Rcpp::rnorm(par_dim)) +
-            (1 - nugget) * Rcpp::as<arma::rowvec>(Rcpp::rnorm(par_dim)) * kernel_cov_chol;    
+        arma::rowvec nugget_draws(par_dim);
+        fill_normals(nugget_draws.memptr(), par_dim);
+
+        params_prop =
+            params_cur +
+            nugget * nugget_draws +
+            (1 - nugget) * draws * kernel_cov_chol;
     }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_census.h"
 
 using namespace arma;
 using namespace Rcpp;
@@ -12,25 +13,62 @@ using namespace Rcpp;
 //' @param census_times vector of census times.
 //' @param census_columns vector of column indices to be censused (C++ indexing
 //'   beginning at 0).
+//' @param census_inds optional vector of the rows of the path at the census
+//'   times, as returned by \code{census_row_indices} with \code{all_inside =
+//'   TRUE}, to be reused across calls for paths with the same times.
 //'
 //' @return matrix containing the compartment counts at census times.
 //' @export
 // [[Rcpp::export]]
-void retrieve_census_path(arma::mat& censusmat, Rcpp::NumericMatrix& path, Rcpp::NumericVector& census_times, Rcpp::IntegerVector& census_columns) {
+void retrieve_census_path(arma::mat& censusmat,
+                          Rcpp::NumericMatrix& path,
+                          Rcpp::NumericVector& census_times,
+                          Rcpp::IntegerVector& census_columns,
+                          const Rcpp::Nullable<Rcpp::IntegerVector>& census_inds = R_NilValue) {
 
         // get dimensions
         int n_census_times = census_times.size();
-        int n_comps = census_columns.size();
-        Rcpp::IntegerVector path_dims = path.attr("dim");
+        int n_comps        = census_columns.size();
+        int n_rows         = path.nrow();
 
-        // get path matrix pointers
-        arma::mat path_mat(path.begin(), path_dims[0], path_dims[1], false);
+        try{
+                if((int)censusmat.n_rows != n_census_times || (int)censusmat.n_cols <= n_comps) {
+                        throw std::runtime_error("The census matrix does not match the census times and columns.");
+                }
+                if(n_rows < 2) {
+                        throw std::runtime_error("The path must contain at least two rows.");
+                }
 
-        // get vector of times in the path matrix and the census time indices
-        Rcpp::NumericVector timevec = path(_,0);
-        Rcpp::IntegerVector census_inds(n_census_times);
-        census_inds = find_interval(census_times, timevec, true, true) - 1; // rightmost_closed = true, all.inside = true
+                for(int c = 0; c < n_comps; ++c) {
+                        if(census_columns[c] < 0 || census_columns[c] >= path.ncol()) {
+                                throw std::runtime_error("The census columns must be columns of the path.");
+                        }
+                }
 
-        // fill out the census matrix
-        censusmat.cols(1, n_comps) = path_mat.submat(Rcpp::as<arma::uvec>(census_inds), Rcpp::as<arma::uvec>(census_columns));
-}
\ No newline at end of file
+                // rows of the path at the census times, rightmost_closed = true, all.inside = true
+                Rcpp::IntegerVector row_inds;
+                if(census_inds.isNotNull()) {
+                        row_inds = Rcpp::IntegerVector(census_inds.get());
+                        if(row_inds.size() != n_census_times) {
+                                throw std::runtime_error("There must be one census index per census time.");
+                        }
+                        for(int k = 0; k < n_census_times; ++k) {
+                                if(row_inds[k] < 0 || row_inds[k] >= n_rows) {
+                                        throw std::runtime_error("The census indices must be rows of the path.");
+                                }
+                        }
+                } else {
+                        row_inds = Rcpp::IntegerVector(n_census_times);
+                        census_row_inds(path.begin(), n_rows, census_times.begin(), n_census_times, true, row_inds.begin());
+                }
+
+                // fill out the census matrix in place
+                census_gather(path.begin(), n_rows, census_columns.begin(), n_comps, row_inds.begin(),
+                              n_census_times, censusmat.memptr());
+
+        } catch(std::exception &err) {
+                forward_exception_to_r(err);
+        } catch(...) {
+                ::Rf_error("c++ exception (unknown reason)");
+        }
+}
@@ -1,6 +1,10 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 #include "stemr_types.h"
 #include "stemr_utils.h"
+#include "stemr_rng.h"
+#include "stemr_sumtree.h"
+#include "stemr_pathrecorder.h"
+#include "stemr_forcings.h"
 
 using namespace arma;
 using namespace Rcpp;
@@ -26,8 +30,16 @@ using namespace Rcpp;
 //'   time-varying covariance matrix a forcing is applied.
 //' @param forcing_matrix matrix containing the forcings.
 //' @param rate_ptr external function pointer to the lumped rate functions.
+//' @param census_times optional vector of census times. If supplied, the path
+//'   is censused as it is simulated and only the compartment counts at the
+//'   census times are stored.
+//' @param census_columns vector of column indices to be censused, required if
+//'   census times are supplied (C++ indexing beginning at 0, including the
+//'   time and event columns as for build_census_path).
 //'
-//' @return matrix with a simulated path from a stochastic epidemic model.
+//' @return matrix with a simulated path from a stochastic epidemic model, or
+//'   the census matrix laid out as the output of \code{build_census_path} if
+//'   census times were supplied.
 //' @export
 // [[Rcpp::export]]
 arma::mat simulate_gillespie(const arma::mat& flow,
@@ -44,7 +56,9 @@ arma::mat simulate_gillespie(const arma::mat& flow,
                              const arma::uvec& forcing_tcov_inds,
                              const arma::mat& forcings_out,
                              const arma::cube& forcing_transfers,
-                             SEXP rate_ptr) {
+                             SEXP rate_ptr,
+                             Rcpp::Nullable<Rcpp::NumericVector> census_times = R_NilValue,
+                             Rcpp::Nullable<Rcpp::IntegerVector> census_columns = R_NilValue) {
       
       // Get dimensions of various objects
       Rcpp::IntegerVector flow_dims(2);       // size of flow matrix
@@ -53,20 +67,35 @@ arma::mat simulate_gillespie(const arma::mat& flow,
       flow_dims[1]    = flow.n_cols;
       tcovar_dims[0]  = tcovar.n_rows;
       tcovar_dims[1]  = tcovar.n_cols;
-      int n_forcings  = forcing_tcov_inds.n_elem;
       
-      // for use with forcings
-      double forcing_flow = 0;
-      arma::vec forcing_distvec(init_dims[1]-2, arma::fill::zeros);
+      // forcings compiled into sparse transfer operators
+      forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers, true);
       
-      // initialize bookkeeping matrix
-      arma::mat path(init_dims[0], init_dims[1]);
-      path(0, 1) = -1;
-      int path_nrows = path.n_rows;
+      // bookkeeping matrix, or census matrix if census times were supplied
+      arma::mat path;
+      arma::vec census_tms;
+      arma::uvec census_comps;
       
-      // vector of event codes
-      Rcpp::IntegerVector events = Rcpp::seq_len(flow_dims[0]) - 1; // vector of event codes
-      Rcpp::IntegerVector next_event(1);                            // next event
+      if(census_times.isNotNull()) {
+            try{
+                  if(census_columns.isNull()) {
+                        throw std::runtime_error("census_columns must be supplied along with census_times.");
+                  }
+            } catch(std::exception &err) {
+                  forward_exception_to_r(err);
+            } catch(...) {
+                  ::Rf_error("c++ exception (unknown reason)");
+            }
+            census_tms   = Rcpp::as<arma::vec>(census_times.get());
+            census_comps = Rcpp::as<arma::uvec>(Rcpp::IntegerVector(census_columns.get())) - 2;
+      }
+      
+      path_recorder recorder = census_times.isNotNull() ?
+            path_recorder(path, census_tms, census_comps) :
+            path_recorder(path, init_dims[0], init_dims[1]);
+      
+      // next event
+      int next_event = 0;
       
       // initialize the time varying covariates and the left and right
       // endpoints of the first piecewise homogeneous interval
@@ -75,48 +104,45 @@ arma::mat simulate_gillespie(const arma::mat& flow,
       double t_L = tcovar(tcov_ind,0);                // left-endpoint of first interval
       double t_R = tcovar(tcov_ind + 1,0);            // right-endpoint of first interval
       double t_cur = t_L;                             // current time
-      Rcpp::NumericVector dt(1);                      // time increment
       
-      // insert the initial compartment counts
-      path(0, arma::span(2,init_dims[1]-1)) = init_states;
+      // record the initial compartment counts
+      recorder.start(t_cur, init_states);
       
       // initialize a state vector
       arma::rowvec state = init_states;
       
       // apply forcings if necessary
       if(forcing_inds[tcov_ind]) {
-            for(int j=0; j < n_forcings; ++j) {
-                  
-                  // distribute the forcings proportionally to the compartment counts in the applicable states
-                  forcing_flow = tcovar(tcov_ind, forcing_tcov_inds[j]);
-                  forcing_distvec = arma::round(forcing_flow * normalise(forcings_out.col(j) % state.t(), 1));
-                  state += (forcing_transfers.slice(j) * forcing_distvec).t();
-            }
+            // distribute the forcings proportionally to the compartment counts in the applicable states
+            forcings.apply(state.memptr(), tcovar, tcov_ind);
       }
       
-      // insert the initial time into the path matrix
-      path(0, 0) = t_cur;
+      // resolve the rate function once, rather than at each event
+      stem_rate_fcn rate_fcn(rate_ptr);
       
       // initialize the rates
       Rcpp::LogicalVector rate_inds(flow_dims[0], true); // logical vector of rates to update
       Rcpp::NumericVector rates(flow_dims[0]);           // initialize vector of rates
-      CALL_RATE_FCN(rates, rate_inds, state, parameters, constants, tcovs, rate_ptr); // compute rates
+      rate_fcn(rates, rate_inds, state, parameters, constants, tcovs); // compute rates
+      std::fill(rate_inds.begin(), rate_inds.end(), false);
       
-      // vector for storing the event probabilities - Rcpp's sample function no longer modifies probs in place
-      // Rcpp::NumericVector event_probs(flow_dims[0]);
-      // event_probs = rates / sum(rates);
+      // sum tree over the rates for sampling events and the total rate in O(log R),
+      // and the indices of rates that depend on each event
+      rate_sumtree rate_tree(flow_dims[0]);
+      rate_tree.fill(rates);
+      std::vector<std::vector<int> > rate_deps = build_rate_deps(rate_adjmat);
       
-      // set keep_going and the row index
+      // stream for the event times and events, seeded from R's RNG
+      philox_rng rng(draw_rng_seed(), 0);
+
+      // set keep_going
       bool keep_going = true;
-      int ind_start = 1;       // row from which to begin inserting, updated throughout
-      int ind_cur = ind_start; // row index into which to actually insert
       
       // start simulating
       while(keep_going) {
             
             // sample the next event time
-            dt = Rcpp::rexp(1, sum(rates));
-            t_cur += dt[0];
+            t_cur += rng.exp(rate_tree.total());
             
             if(t_cur > t_R) {
                   
@@ -140,13 +166,8 @@ arma::mat simulate_gillespie(const arma::mat& flow,
                         // apply forcings if necessary
                         if(forcing_inds[tcov_ind]) {
                               
-                              for(int j=0; j < n_forcings; ++j) {
-                                    
-                                    // distribute the forcings proportionally to the compartment counts in the applicable states
-                                    forcing_flow = tcovar(tcov_ind, forcing_tcov_inds[j]);
-                                    forcing_distvec = arma::round(forcing_flow * normalise(forcings_out.col(j) % state.t(), 1));
-                                    state += (forcing_transfers.slice(j) * forcing_distvec).t();
-                              }
+                              // distribute the forcings proportionally to the compartment counts in the applicable states
+                              forcings.apply(state.memptr(), tcovar, tcov_ind);
                               
                               // throw errors for negative volumes
                               try{
@@ -163,72 +184,51 @@ arma::mat simulate_gillespie(const arma::mat& flow,
                               }
                         }
                         
-                        // insert the time, event, and new state vector into the path matrix
-                        path(ind_cur, 0) = t_cur;                             // insert new time
-                        path(ind_cur, 1) = -1;                                // event code
-                        path(ind_cur, arma::span(2,init_dims[1]-1)) = state;  // state
+                        // record the time, event, and new state vector
+                        recorder.add(t_cur, -1, state);
                         
-                        // increment the index
-                        ind_cur += 1;
+                        // update the rate functions and the sum tree
+                        rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
                         
-                        // if there are no empty rows in the path matrix, add some
-                        if(ind_cur == path_nrows) {
-                              path.insert_rows(ind_cur, init_dims[0]);
-                              path_nrows = path.n_rows;
+                        for(int k=0; k < flow_dims[0]; ++k) {
+                              if(rate_inds[k]) {
+                                    rate_tree.set(k, rates[k]);
+                                    rate_inds[k] = false;
+                              }
                         }
                         
-                        // update the rate functions
-                        CALL_RATE_FCN(rates, rate_inds, state, parameters, constants, tcovs, rate_ptr);
-                        
-                        // update event probabilities
-                        // event_probs = rates / sum(rates);
-                        
                         // if all rates equal zero, stop simulating
-                        keep_going = Rcpp::is_true(any(rates != 0));
+                        keep_going = rate_tree.any();
                   }
                   
             } else {
                
                   // sample the next event
-                  next_event = Rcpp::sample(events, 1, false, rates);
+                  next_event = rate_tree.sample(rng.unif() * rate_tree.total());
                   
                   // update the state vector
-                  state += flow.row(next_event[0]);
+                  state += flow.row(next_event);
                   
-                  // insert the time, event, and new state vector into the path matrix
-                  path(ind_cur, 0) = t_cur;                       // insert new time
-                  path(ind_cur, 1) = next_event[0];               // event code
-                  path(ind_cur, arma::span(2,init_dims[1]-1)) = state;  // state
+                  // record the time, event, and new state vector
+                  recorder.add(t_cur, next_event, state);
                   
-                  // increment the index
-                  ind_cur += 1;
+                  // update the rates that depend on the event, and the sum tree
+                  const std::vector<int>& deps = rate_deps[next_event];
+                  for(size_t k=0; k < deps.size(); ++k) rate_inds[deps[k]] = true;
                   
-                  // if there are no empty rows in the path matrix, add some
-                  if(ind_cur == path_nrows) {
-                        path.insert_rows(ind_cur, init_dims[0]);
-                        path_nrows = path.n_rows;
-                  }
+                  rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
                   
-                  // update the rates
-                  rate_update_event(rate_inds, rate_adjmat, next_event[0]);                       // identify rates that need to be updated
-                  CALL_RATE_FCN(rates, rate_inds, state, parameters, constants, tcovs, rate_ptr); // update the rate functions
-                  
-                  // event_probs = rates / sum(rates); // update the event probabilities
+                  for(size_t k=0; k < deps.size(); ++k) {
+                        rate_tree.set(deps[k], rates[deps[k]]);
+                        rate_inds[deps[k]] = false;
+                  }
                   
                   // if all rates equal zero, stop simulating
-                  keep_going = Rcpp::is_true(any(rates != 0));
+                  keep_going = rate_tree.any();
             }
       }
       
-      path.shed_rows(ind_cur, path.n_rows - 1);
-      
-      // ensure that t_max is the time of the last row in path. if not, add it
-      if(path(path.n_rows-1, 0) != t_max) {
-            arma::rowvec last_row = path.row(path.n_rows - 1);
-            last_row(0) = t_max;
-            last_row(1) = -1;
-            path.insert_rows(path.n_rows, last_row);
-      }
+      recorder.finish(t_max);
       
       return path;
 }
@@ -0,0 +1,533 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include "stemr_types.h"
+#include "stemr_utils.h"
+#include "stemr_rng.h"
+#include "stemr_sumtree.h"
+#include "stemr_eventqueue.h"
+#include "stemr_pathrecorder.h"
+#include "stemr_forcings.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace arma;
+using namespace Rcpp;
+
+// Simulate a single path via Gillespie's direct method. Mirrors
+// simulate_gillespie, but draws from a counter-based RNG stream and resolves
+// the rate function beforehand so that it may be called from a worker thread.
+// Rcpp objects passed in must be allocated on the main thread. The path is
+// stored by the recorder, either in full or at the census times only. Returns
+// false if the path had negative compartment volumes after a forcing was
+// applied.
+template <class RateFcn>
+static bool gillespie_path(path_recorder& recorder,
+                           philox_rng& rng,
+                           Rcpp::NumericVector& rates,
+                           Rcpp::LogicalVector& rate_inds,
+                           const arma::mat& flow,
+                           const Rcpp::NumericVector& parameters,
+                           const Rcpp::NumericVector& constants,
+                           const arma::mat& tcovar,
+                           double t_max,
+                           const arma::rowvec& init_states,
+                           const std::vector<std::vector<int> >& rate_deps,
+                           const arma::mat& tcovar_adjmat,
+                           const arma::mat& tcovar_changemat,
+                           const Rcpp::LogicalVector& forcing_inds,
+                           const arma::uvec& forcing_tcov_inds,
+                           const arma::mat& forcings_out,
+                           const arma::cube& forcing_transfers,
+                           const RateFcn& rate_fcn) {
+
+      int n_rates    = flow.n_rows;
+
+      // forcings compiled into sparse transfer operators
+      forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers, true);
+
+      // initialize the time varying covariates and the interval endpoints
+      int tcov_ind = 0;
+      arma::rowvec tcovs = tcovar.row(tcov_ind);
+      double t_R = tcovar(tcov_ind + 1,0);
+      double t_cur = tcovar(tcov_ind,0);
+
+      // record the initial compartment counts and initialize the state vector
+      recorder.start(t_cur, init_states);
+      arma::rowvec state = init_states;
+
+      // apply forcings if necessary
+      if(forcing_inds[tcov_ind]) {
+            forcings.apply(state.memptr(), tcovar, tcov_ind);
+      }
+
+      // initialize the rates
+      std::fill(rate_inds.begin(), rate_inds.end(), true);
+      rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+      std::fill(rate_inds.begin(), rate_inds.end(), false);
+
+      // sum tree for sampling events and computing the total rate in O(log R)
+      rate_sumtree rate_tree(n_rates);
+      rate_tree.fill(rates);
+
+      bool keep_going = true;
+      int next_event = 0;
+
+      while(keep_going) {
+
+            // sample the next event time
+            t_cur += rng.exp(rate_tree.total());
+
+            if(t_cur > t_R) {
+
+                  if((t_R == t_max) && (t_cur > t_max)) {
+
+                        keep_going = false;
+
+                  } else {
+
+                        // increment the time-homogeneous interval and the rates
+                        tcov_ind += 1;
+                        tcovs     = tcovar.row(tcov_ind);
+                        t_cur     = t_R;
+                        t_R       = tcovar(tcov_ind + 1, 0);
+
+                        rate_update_tcovar(rate_inds, tcovar_adjmat, tcovar_changemat.row(tcov_ind));
+
+                        // apply forcings if necessary
+                        if(forcing_inds[tcov_ind]) {
+
+                              forcings.apply(state.memptr(), tcovar, tcov_ind);
+
+                              if(any(state < 0)) return false;
+                        }
+
+                        // record the time and new state vector
+                        recorder.add(t_cur, -1, state);
+
+                        rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+
+                        for(int k=0; k < n_rates; ++k) {
+                              if(rate_inds[k]) {
+                                    rate_tree.set(k, rates[k]);
+                                    rate_inds[k] = false;
+                              }
+                        }
+
+                        keep_going = rate_tree.any();
+                  }
+
+            } else {
+
+                  // sample the next event proportionally to the rates
+                  next_event = rate_tree.sample(rng.unif() * rate_tree.total());
+
+                  state += flow.row(next_event);
+
+                  recorder.add(t_cur, next_event, state);
+
+                  // update the rates that depend on the event
+                  const std::vector<int>& deps = rate_deps[next_event];
+                  for(size_t k=0; k < deps.size(); ++k) rate_inds[deps[k]] = true;
+
+                  rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+
+                  for(size_t k=0; k < deps.size(); ++k) {
+                        rate_tree.set(deps[k], rates[deps[k]]);
+                        rate_inds[deps[k]] = false;
+                  }
+
+                  keep_going = rate_tree.any();
+            }
+      }
+
+      recorder.finish(t_max);
+
+      return true;
+}
+
+// Update the clock of an event in the next reaction method (Gibson and Bruck,
+// 2000) when its rate changes from rate_old to rate_new at time t_cur. The
+// unused part of the exponential waiting time is rescaled rather than redrawn.
+// When a rate drops to zero, the unused waiting time (on the unit rate scale) is
+// stored so that it can be reused when the rate becomes positive again.
+static inline void nrm_update_clock(event_queue& queue,
+                                    std::vector<double>& unused_time,
+                                    int event,
+                                    double rate_old,
+                                    double rate_new,
+                                    double t_cur) {
+
+      if(rate_old > 0) unused_time[event] = rate_old * (queue.time(event) - t_cur);
+
+      if(rate_new > 0) {
+            queue.set(event, t_cur + unused_time[event] / rate_new);
+      } else {
+            queue.set(event, std::numeric_limits<double>::infinity());
+      }
+}
+
+// Simulate a single path via the next reaction method. Events are kept in an
+// indexed priority queue of firing times and only one exponential draw is
+// needed per event. When a tcovar interval ends, only the clocks of the rates
+// flagged by tcovar_adjmat are rescaled, the waiting times of the other events
+// carry over. Arguments as for gillespie_path.
+template <class RateFcn>
+static bool nrm_path(path_recorder& recorder,
+                     philox_rng& rng,
+                     Rcpp::NumericVector& rates,
+                     Rcpp::LogicalVector& rate_inds,
+                     const arma::mat& flow,
+                     const Rcpp::NumericVector& parameters,
+                     const Rcpp::NumericVector& constants,
+                     const arma::mat& tcovar,
+                     double t_max,
+                     const arma::rowvec& init_states,
+                     const std::vector<std::vector<int> >& rate_deps,
+                     const arma::mat& tcovar_adjmat,
+                     const arma::mat& tcovar_changemat,
+                     const Rcpp::LogicalVector& forcing_inds,
+                     const arma::uvec& forcing_tcov_inds,
+                     const arma::mat& forcings_out,
+                     const arma::cube& forcing_transfers,
+                     const RateFcn& rate_fcn) {
+
+      int n_rates    = flow.n_rows;
+
+      // forcings compiled into sparse transfer operators
+      forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers, true);
+
+      // initialize the time varying covariates and the interval endpoints
+      int tcov_ind = 0;
+      arma::rowvec tcovs = tcovar.row(tcov_ind);
+      double t_R = tcovar(tcov_ind + 1,0);
+      double t_cur = tcovar(tcov_ind,0);
+
+      // record the initial compartment counts and initialize the state vector
+      recorder.start(t_cur, init_states);
+      arma::rowvec state = init_states;
+
+      // apply forcings if necessary
+      if(forcing_inds[tcov_ind]) {
+            forcings.apply(state.memptr(), tcovar, tcov_ind);
+      }
+
+      // initialize the rates
+      std::fill(rate_inds.begin(), rate_inds.end(), true);
+      rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+      std::fill(rate_inds.begin(), rate_inds.end(), false);
+
+      // current rates, unit rate waiting times, and the queue of firing times
+      std::vector<double> rates_cur(rates.begin(), rates.end());
+      std::vector<double> unused_time(n_rates);
+      event_queue queue(n_rates);
+      int n_positive = 0;
+
+      for(int k=0; k < n_rates; ++k) {
+            unused_time[k] = rng.exp(1.0);
+            nrm_update_clock(queue, unused_time, k, 0.0, rates_cur[k], t_cur);
+            if(rates_cur[k] > 0) ++n_positive;
+      }
+
+      bool keep_going = n_positive > 0;
+      int next_event = 0;
+
+      while(keep_going) {
+
+            if(queue.top_time() > t_R) {
+
+                  if(t_R == t_max) {
+
+                        keep_going = false;
+
+                  } else {
+
+                        // increment the time-homogeneous interval
+                        tcov_ind += 1;
+                        tcovs     = tcovar.row(tcov_ind);
+                        t_cur     = t_R;
+                        t_R       = tcovar(tcov_ind + 1, 0);
+
+                        rate_update_tcovar(rate_inds, tcovar_adjmat, tcovar_changemat.row(tcov_ind));
+
+                        // apply forcings if necessary
+                        if(forcing_inds[tcov_ind]) {
+
+                              forcings.apply(state.memptr(), tcovar, tcov_ind);
+
+                              if(any(state < 0)) return false;
+                        }
+
+                        // record the time and new state vector
+                        recorder.add(t_cur, -1, state);
+
+                        // update the rates and rescale the clocks of the rates that changed
+                        rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+
+                        for(int k=0; k < n_rates; ++k) {
+                              if(rate_inds[k]) {
+                                    n_positive += (rates[k] > 0) - (rates_cur[k] > 0);
+                                    nrm_update_clock(queue, unused_time, k, rates_cur[k], rates[k], t_cur);
+                                    rates_cur[k] = rates[k];
+                                    rate_inds[k] = false;
+                              }
+                        }
+
+                        keep_going = n_positive > 0;
+                  }
+
+            } else {
+
+                  // fire the event with the earliest firing time
+                  next_event = queue.top();
+                  t_cur      = queue.top_time();
+
+                  state += flow.row(next_event);
+
+                  recorder.add(t_cur, next_event, state);
+
+                  // the clock of the event that fired is reset with a new waiting time
+                  unused_time[next_event] = rng.exp(1.0);
+                  queue.set(next_event, std::numeric_limits<double>::infinity());
+
+                  // update the rates that depend on the event
+                  const std::vector<int>& deps = rate_deps[next_event];
+                  for(size_t k=0; k < deps.size(); ++k) rate_inds[deps[k]] = true;
+
+                  rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+
+                  for(size_t k=0; k < deps.size(); ++k) {
+                        int r = deps[k];
+                        n_positive += (rates[r] > 0) - (rates_cur[r] > 0);
+                        nrm_update_clock(queue, unused_time, r, r == next_event ? 0.0 : rates_cur[r], rates[r], t_cur);
+                        rates_cur[r] = rates[r];
+                        rate_inds[r] = false;
+                  }
+
+                  // if the rate of the event that fired did not change, restart its clock
+                  if(queue.time(next_event) == std::numeric_limits<double>::infinity() && rates_cur[next_event] > 0) {
+                        nrm_update_clock(queue, unused_time, next_event, 0.0, rates_cur[next_event], t_cur);
+                  }
+
+                  keep_going = n_positive > 0;
+            }
+      }
+
+      recorder.finish(t_max);
+
+      return true;
+}
+
+//' Simulate a batch of stochastic epidemic model paths via Gillespie's direct
+//' method or the next reaction method, distributing the replicates over a pool
+//' of threads.
+//'
+//' Each replicate draws from its own Philox stream, keyed by a seed drawn from
+//' R's RNG and the replicate index, so the paths are reproducible under
+//' \code{set.seed} regardless of the number of threads. If census times are
+//' supplied, the paths are censused as they are simulated and only the
+//' compartment counts at the census times are stored, so memory usage does not
+//' grow with the number of events.
+//'
+//' @param flow Flow matrix
+//' @param parameters matrix of parameters, either with a single row shared by
+//'   all replicates or with one row per replicate
+//' @param constants vector of constants
+//' @param tcovar array of time-varying covariate matrices, either with a single
+//'   slice shared by all replicates or with one slice per replicate
+//' @param t_max time at which simulation is terminated
+//' @param init_states matrix of initial compartment counts, one row per
+//'   replicate
+//' @param rate_adjmat adjacency matrix for updating rates after each event
+//' @param tcovar_adjmat adjacency matrix for updating rates after each time a
+//'   covariate changes
+//' @param tcovar_changemat indicator matrix identifying which covariates change
+//'   at each time
+//' @param init_dims initial estimate for dimensions of the bookkeeping matrix
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_tcov_inds indices of the forcings in the tcovar matrix
+//' @param forcings_out matrix indicating the compartments that forcings flow out
+//'   of
+//' @param forcing_transfers array of forcing transfer matrices
+//' @param rate_ptr external function pointer to the lumped rate functions.
+//' @param census_times optional vector of census times. If supplied, census
+//'   matrices are returned in place of the full paths.
+//' @param census_columns vector of column indices to be censused, required if
+//'   census times are supplied (C++ indexing beginning at 0, including the
+//'   time and event columns as for build_census_path).
+//' @param max_attempts maximum number of attempts to simulate each path
+//' @param ssa_algorithm either "direct" for Gillespie's direct method, or "nrm"
+//'   for the next reaction method of Gibson and Bruck.
+//' @param n_threads number of threads
+//'
+//' @return list of matrices with the simulated paths, or with the census
+//'   matrices laid out as the output of \code{build_census_path} if census
+//'   times were supplied. Entries for replicates that failed in each of the
+//'   attempts are NULL. An error in a replicate is raised once the batch has
+//'   finished.
+//' @export
+// [[Rcpp::export]]
+Rcpp::List simulate_gillespie_batch(const arma::mat& flow,
+                                    const Rcpp::NumericMatrix& parameters,
+                                    const Rcpp::NumericVector& constants,
+                                    const arma::cube& tcovar,
+                                    double t_max,
+                                    const arma::mat& init_states,
+                                    const Rcpp::LogicalMatrix& rate_adjmat,
+                                    const arma::mat& tcovar_adjmat,
+                                    const arma::mat& tcovar_changemat,
+                                    const Rcpp::IntegerVector init_dims,
+                                    const Rcpp::LogicalVector& forcing_inds,
+                                    const arma::uvec& forcing_tcov_inds,
+                                    const arma::mat& forcings_out,
+                                    const arma::cube& forcing_transfers,
+                                    SEXP rate_ptr,
+                                    Rcpp::Nullable<Rcpp::NumericVector> census_times = R_NilValue,
+                                    Rcpp::Nullable<Rcpp::IntegerVector> census_columns = R_NilValue,
+                                    int max_attempts = 1,
+                                    std::string ssa_algorithm = "direct",
+                                    int n_threads = 1) {
+
+      int nsim     = init_states.n_rows;
+      int n_rates  = flow.n_rows;
+      int n_params = parameters.ncol();
+
+#ifdef _OPENMP
+      if(n_threads < 1) n_threads = omp_get_max_threads();
+#else
+      n_threads = 1;
+#endif
+      if(n_threads > nsim) n_threads = std::max(nsim, 1);
+
+      // select the simulation algorithm
+      bool use_nrm = false;
+      try{
+            if(ssa_algorithm == "nrm") {
+                  use_nrm = true;
+            } else if(ssa_algorithm != "direct") {
+                  throw std::runtime_error("ssa_algorithm must be either \"direct\" or \"nrm\".");
+            }
+      } catch(std::exception &err) {
+            forward_exception_to_r(err);
+      } catch(...) {
+            ::Rf_error("c++ exception (unknown reason)");
+      }
+
+      // census times and the censused compartments, if censusing on the fly
+      bool census_mode = census_times.isNotNull();
+      arma::vec census_tms;
+      arma::uvec census_comps;
+      if(census_mode) {
+            try{
+                  if(census_columns.isNull()) {
+                        throw std::runtime_error("census_columns must be supplied along with census_times.");
+                  }
+            } catch(std::exception &err) {
+                  forward_exception_to_r(err);
+            } catch(...) {
+                  ::Rf_error("c++ exception (unknown reason)");
+            }
+            census_tms   = Rcpp::as<arma::vec>(census_times.get());
+            census_comps = Rcpp::as<arma::uvec>(Rcpp::IntegerVector(census_columns.get())) - 2;
+      }
+
+      // resolve the rate function on the main thread
+      stem_rate_fcn rate_fcn(rate_ptr);
+
+      // per-thread rate and parameter vectors, allocated on the main thread
+      std::vector<Rcpp::NumericVector> rates(n_threads);
+      std::vector<Rcpp::LogicalVector> rate_inds(n_threads);
+      std::vector<Rcpp::NumericVector> pars(n_threads);
+      for(int t=0; t < n_threads; ++t) {
+            rates[t]     = Rcpp::NumericVector(n_rates);
+            rate_inds[t] = Rcpp::LogicalVector(n_rates);
+            pars[t]      = Rcpp::NumericVector(n_params);
+      }
+
+      // indices of the rates that depend on each event
+      std::vector<std::vector<int> > rate_deps = build_rate_deps(rate_adjmat);
+
+      // seed for the replicate streams
+      uint64_t seed = draw_rng_seed();
+
+      std::vector<arma::mat> paths(nsim);
+      std::vector<int> success(nsim, 0);
+      std::vector<std::string> errors(nsim);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic)
+#endif
+      for(int k=0; k < nsim; ++k) {
+
+#ifdef _OPENMP
+            int thread = omp_get_thread_num();
+#else
+            int thread = 0;
+#endif
+            philox_rng rng(seed, static_cast<uint64_t>(k));
+
+            // copy the parameters for this replicate
+            int par_row = parameters.nrow() == 1 ? 0 : k;
+            for(int j=0; j < n_params; ++j) pars[thread][j] = parameters(par_row, j);
+
+            const arma::mat& tcov = tcovar.slice(tcovar.n_slices == 1 ? 0 : k);
+
+            // an exception must not escape the parallel region, the replicate
+            // is marked as failed and the error is raised after the region
+            try{
+                  // full bookkeeping matrix or census matrix
+                  path_recorder recorder = census_mode ?
+                        path_recorder(paths[k], census_tms, census_comps) :
+                        path_recorder(paths[k], init_dims[0], init_dims[1]);
+
+                  for(int attempt=0; attempt < max_attempts && !success[k]; ++attempt) {
+                        if(use_nrm) {
+                              success[k] = nrm_path(recorder, rng, rates[thread], rate_inds[thread],
+                                                    flow, pars[thread], constants, tcov, t_max,
+                                                    init_states.row(k), rate_deps, tcovar_adjmat,
+                                                    tcovar_changemat, forcing_inds,
+                                                    forcing_tcov_inds, forcings_out, forcing_transfers,
+                                                    rate_fcn);
+                        } else {
+                              success[k] = gillespie_path(recorder, rng, rates[thread], rate_inds[thread],
+                                                          flow, pars[thread], constants, tcov, t_max,
+                                                          init_states.row(k), rate_deps, tcovar_adjmat,
+                                                          tcovar_changemat, forcing_inds,
+                                                          forcing_tcov_inds, forcings_out, forcing_transfers,
+                                                          rate_fcn);
+                        }
+                  }
+            } catch(std::exception &err) {
+                  success[k] = 0;
+                  errors[k]  = err.what();
+            } catch(...) {
+                  success[k] = 0;
+                  errors[k]  = "c++ exception (unknown reason)";
+            }
+      }
+
+      // raise the first error encountered in the replicates
+      try{
+            for(int k=0; k < nsim; ++k) {
+                  if(!errors[k].empty()) {
+                        throw std::runtime_error("replicate " + std::to_string(k + 1) + " failed: " + errors[k]);
+                  }
+            }
+      } catch(std::exception &err) {
+            forward_exception_to_r(err);
+      } catch(...) {
+            ::Rf_error("c++ exception (unknown reason)");
+      }
+
+      // collect the paths
+      Rcpp::List path_list(nsim);
+      for(int k=0; k < nsim; ++k) {
+            if(success[k]) {
+                  path_list[k] = Rcpp::wrap(paths[k]);
+                  paths[k].reset();
+            }
+      }
+
+      return path_list;
+}
@@ -28,11 +28,14 @@ Rcpp::NumericMatrix simulate_r_measure(Rcpp::NumericMatrix& censusmat, Rcpp::Log
         Rcpp::NumericMatrix obsmat(obsmat_dims[0], obsmat_dims[1] + 1);
         obsmat(_, 0) = censusmat(_, 0); // copy the observation times
 
+        // resolve the simulation function once, rather than for each observation time
+        ::r_measure_ptr fun = *Rcpp::XPtr< ::r_measure_ptr >(r_measure_ptr);
+
         // simulate the dataset
         for(int j=0; j < obsmat_dims[0]; ++j) {
               
-                // obsmat, emit_inds, record_ind, state, parameters, constants, tcovar, ptr
-                CALL_R_MEASURE(obsmat, measproc_indmat(j, _), j, censusmat.row(j), parameters, constants, tcovar(j, _), r_measure_ptr);
+                // obsmat, emit_inds, record_ind, state, parameters, constants, tcovar
+                fun(obsmat, measproc_indmat(j, _), j, censusmat.row(j), parameters, constants, tcovar(j, _));
         }
 
         return obsmat;
@@ -0,0 +1,473 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include "stemr_types.h"
+#include "stemr_utils.h"
+#include "stemr_rng.h"
+#include "stemr_forcings.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace arma;
+using namespace Rcpp;
+
+// Sparse representation of the flow matrix used in selecting the leap size.
+// For each event, the compartments it draws from and the (negative) flows out of
+// them, and for each compartment that some event draws from, the events that
+// change it along with the corresponding flows.
+struct tauleap_flows {
+      std::vector<std::vector<int> > reactant_comps;
+      std::vector<std::vector<double> > reactant_flows;
+      std::vector<int> leap_comps;
+      std::vector<std::vector<int> > comp_events;
+      std::vector<std::vector<double> > comp_flows;
+
+      tauleap_flows(const arma::mat& flow) : reactant_comps(flow.n_rows), reactant_flows(flow.n_rows) {
+
+            for(int i=0; i < static_cast<int>(flow.n_cols); ++i) {
+                  if(any(flow.col(i) < 0)) {
+                        leap_comps.push_back(i);
+                        comp_events.push_back(std::vector<int>());
+                        comp_flows.push_back(std::vector<double>());
+
+                        for(int j=0; j < static_cast<int>(flow.n_rows); ++j) {
+                              if(flow(j, i) != 0) {
+                                    comp_events.back().push_back(j);
+                                    comp_flows.back().push_back(flow(j, i));
+                              }
+                              if(flow(j, i) < 0) {
+                                    reactant_comps[j].push_back(i);
+                                    reactant_flows[j].push_back(flow(j, i));
+                              }
+                        }
+                  }
+            }
+      }
+};
+
+// Record the state at all census times up to and including t_cur.
+static inline void tauleap_census(arma::mat& census_path,
+                                  int& census_ind,
+                                  double t_cur,
+                                  const arma::rowvec& state,
+                                  const arma::uvec& census_comps) {
+
+      while(census_ind < static_cast<int>(census_path.n_rows) && census_path(census_ind, 0) <= t_cur) {
+            for(int c=0; c < static_cast<int>(census_comps.n_elem); ++c) {
+                  census_path(census_ind, c + 1) = state(census_comps[c]);
+            }
+            census_ind += 1;
+      }
+}
+
+// Advance the state from t_cur to t_end, within which the time-varying
+// covariates are constant, via tau-leaping with the step size selection of Cao,
+// Gillespie, and Petzold (2006). The leap size bounds the relative change in the
+// propensities via the changes in the compartments that events draw from, using
+// the conservative choice g_i = 2 for the highest order of event drawing from
+// each compartment. Events within n_critical firings of exhausting one of their
+// source compartments are critical; at most one critical event fires per leap.
+// If the leap size is smaller than a few multiples of the expected waiting time,
+// a short run of exact direct method steps is taken instead. Leaps that would
+// make a compartment negative are rejected and the leap size is halved.
+template <class RateFcn>
+static void tauleap_interval(arma::rowvec& state,
+                             double& t_cur,
+                             double t_end,
+                             philox_rng& rng,
+                             Rcpp::NumericVector& rates,
+                             Rcpp::LogicalVector& rate_inds,
+                             const arma::mat& flow,
+                             const tauleap_flows& flows,
+                             const Rcpp::NumericVector& parameters,
+                             const Rcpp::NumericVector& constants,
+                             const arma::rowvec& tcovs,
+                             double epsilon,
+                             int n_critical,
+                             const RateFcn& rate_fcn) {
+
+      int n_rates  = flow.n_rows;
+      int n_leap   = flows.leap_comps.size();
+      double inf   = std::numeric_limits<double>::infinity();
+
+      std::vector<char> critical(n_rates);
+      std::vector<double> n_fired(n_rates);
+      arma::rowvec state_new(state.n_elem);
+
+      std::fill(rate_inds.begin(), rate_inds.end(), true);
+
+      while(t_cur < t_end) {
+
+            rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+
+            double a0 = 0;
+            for(int j=0; j < n_rates; ++j) a0 += rates[j];
+
+            if(!(a0 > 0)) {
+                  t_cur = t_end;
+                  break;
+            }
+
+            // identify the critical events
+            double a0_crit = 0;
+            for(int j=0; j < n_rates; ++j) {
+                  critical[j] = false;
+                  if(rates[j] > 0) {
+                        double max_firings = inf;
+                        for(size_t r=0; r < flows.reactant_comps[j].size(); ++r) {
+                              max_firings = std::min(max_firings, std::floor(state(flows.reactant_comps[j][r]) / -flows.reactant_flows[j][r]));
+                        }
+                        if(max_firings < n_critical) {
+                              critical[j] = true;
+                              a0_crit += rates[j];
+                        }
+                  }
+            }
+
+            // leap size bounding the relative change in the propensities
+            double tau_leap = inf;
+            for(int i=0; i < n_leap; ++i) {
+                  double mu = 0, sigma2 = 0;
+                  for(size_t r=0; r < flows.comp_events[i].size(); ++r) {
+                        int j = flows.comp_events[i][r];
+                        if(!critical[j]) {
+                              mu     += flows.comp_flows[i][r] * rates[j];
+                              sigma2 += flows.comp_flows[i][r] * flows.comp_flows[i][r] * rates[j];
+                        }
+                  }
+
+                  double bound = std::max(epsilon * state(flows.leap_comps[i]) / 2, 1.0);
+                  if(mu != 0)     tau_leap = std::min(tau_leap, bound / std::fabs(mu));
+                  if(sigma2 != 0) tau_leap = std::min(tau_leap, bound * bound / sigma2);
+            }
+
+            if(tau_leap < 10 / a0) {
+
+                  // take a run of exact steps, recomputing all rates after each event
+                  for(int step=0; step < 100 && t_cur < t_end; ++step) {
+
+                        if(step != 0) {
+                              rate_fcn(rates, rate_inds, state, parameters, constants, tcovs);
+                              a0 = 0;
+                              for(int j=0; j < n_rates; ++j) a0 += rates[j];
+                              if(!(a0 > 0)) {
+                                    t_cur = t_end;
+                                    break;
+                              }
+                        }
+
+                        double t_next = t_cur + rng.exp(a0);
+                        if(t_next >= t_end) {
+                              t_cur = t_end;
+                              break;
+                        }
+
+                        // sample the event proportionally to the rates
+                        double u = rng.unif() * a0;
+                        int event = -1;
+                        for(int j=0; j < n_rates; ++j) {
+                              if(rates[j] > 0) {
+                                    event = j;
+                                    if(u < rates[j]) break;
+                                    u -= rates[j];
+                              }
+                        }
+
+                        state += flow.row(event);
+                        t_cur  = t_next;
+                  }
+
+                  continue;
+            }
+
+            // leap, halving the leap size until no compartment becomes negative
+            bool accepted = false;
+            while(!accepted) {
+
+                  double tau_crit = a0_crit > 0 ? rng.exp(a0_crit) : inf;
+                  double tau      = std::min(std::min(tau_leap, tau_crit), t_end - t_cur);
+
+                  for(int j=0; j < n_rates; ++j) {
+                        n_fired[j] = (!critical[j] && rates[j] > 0) ? rng.poisson(rates[j] * tau) : 0;
+                  }
+
+                  // fire one critical event if it occurs before the end of the leap
+                  if(tau_crit <= tau) {
+                        double u = rng.unif() * a0_crit;
+                        int event = -1;
+                        for(int j=0; j < n_rates; ++j) {
+                              if(critical[j]) {
+                                    event = j;
+                                    if(u < rates[j]) break;
+                                    u -= rates[j];
+                              }
+                        }
+                        n_fired[event] = 1;
+                  }
+
+                  state_new = state;
+                  for(int j=0; j < n_rates; ++j) {
+                        if(n_fired[j] != 0) state_new += n_fired[j] * flow.row(j);
+                  }
+
+                  if(any(state_new < 0)) {
+                        tau_leap /= 2;
+                  } else {
+                        accepted = true;
+                        state    = state_new;
+                        t_cur    = (tau == t_end - t_cur) ? t_end : t_cur + tau;
+                  }
+            }
+      }
+
+      std::fill(rate_inds.begin(), rate_inds.end(), false);
+}
+
+// Simulate a single path via tau-leaping and record the compartment counts at
+// the census times, which are never leapt over. As in build_census_path with a
+// Gillespie path, the counts at the initial time are recorded before forcings
+// are applied. Returns false if the path had negative compartment volumes after
+// a forcing was applied.
+template <class RateFcn>
+static bool tauleap_path(arma::mat& census_path,
+                         philox_rng& rng,
+                         Rcpp::NumericVector& rates,
+                         Rcpp::LogicalVector& rate_inds,
+                         const arma::mat& flow,
+                         const tauleap_flows& flows,
+                         const Rcpp::NumericVector& parameters,
+                         const Rcpp::NumericVector& constants,
+                         const arma::mat& tcovar,
+                         double t_max,
+                         const arma::rowvec& init_states,
+                         const arma::vec& census_times,
+                         const arma::uvec& census_comps,
+                         const Rcpp::LogicalVector& forcing_inds,
+                         const arma::uvec& forcing_tcov_inds,
+                         const arma::mat& forcings_out,
+                         const arma::cube& forcing_transfers,
+                         double epsilon,
+                         int n_critical,
+                         const RateFcn& rate_fcn) {
+
+      int n_census   = census_times.n_elem;
+
+      // forcings compiled into sparse transfer operators
+      forcing_engine forcings(forcing_tcov_inds, forcings_out, forcing_transfers, true);
+
+      // initialize the census matrix
+      census_path.set_size(census_times.n_elem, census_comps.n_elem + 1);
+      census_path.col(0) = census_times;
+      int census_ind = 0;
+
+      // initialize the time varying covariates and the interval endpoints
+      int tcov_ind = 0;
+      arma::rowvec tcovs = tcovar.row(tcov_ind);
+      double t_R = tcovar(tcov_ind + 1,0);
+      double t_cur = tcovar(tcov_ind,0);
+
+      arma::rowvec state = init_states;
+      tauleap_census(census_path, census_ind, t_cur, state, census_comps);
+
+      // apply forcings if necessary
+      if(forcing_inds[tcov_ind]) {
+            forcings.apply(state.memptr(), tcovar, tcov_ind);
+      }
+
+      while(true) {
+
+            // advance to the end of the interval, stopping at each census time within it
+            double t_end = std::min(t_R, t_max);
+            while(t_cur < t_end) {
+                  double t_stop = t_end;
+                  if(census_ind < n_census && census_times[census_ind] < t_stop) t_stop = census_times[census_ind];
+
+                  tauleap_interval(state, t_cur, t_stop, rng, rates, rate_inds, flow, flows,
+                                   parameters, constants, tcovs, epsilon, n_critical, rate_fcn);
+
+                  if(t_cur < t_end) tauleap_census(census_path, census_ind, t_cur, state, census_comps);
+            }
+
+            if(t_cur >= t_max) break;
+
+            // increment the time-homogeneous interval
+            tcov_ind += 1;
+            tcovs     = tcovar.row(tcov_ind);
+            t_R       = tcovar(tcov_ind + 1, 0);
+
+            // apply forcings if necessary
+            if(forcing_inds[tcov_ind]) {
+
+                  forcings.apply(state.memptr(), tcovar, tcov_ind);
+
+                  if(any(state < 0)) return false;
+            }
+
+            tauleap_census(census_path, census_ind, t_cur, state, census_comps);
+      }
+
+      // the state at t_max is recorded for all remaining census times
+      tauleap_census(census_path, census_ind, t_max, state, census_comps);
+
+      return true;
+}
+
+//' Simulate a batch of stochastic epidemic model paths via adaptive
+//' tau-leaping, distributing the replicates over a pool of threads.
+//'
+//' Only the compartment counts at the census times are stored, so memory usage
+//' does not grow with the number of events. The leap size is selected as in Cao,
+//' Gillespie, and Petzold (2006) with an error control parameter epsilon, events
+//' that are within n_critical firings of exhausting a compartment are simulated
+//' exactly, and leaps that would lead to negative compartment counts are
+//' rejected and retried with half the leap size. Each replicate draws from its
+//' own Philox stream, so paths are reproducible under \code{set.seed} regardless
+//' of the number of threads.
+//'
+//' @param flow Flow matrix
+//' @param parameters matrix of parameters, either with a single row shared by
+//'   all replicates or with one row per replicate
+//' @param constants vector of constants
+//' @param tcovar array of time-varying covariate matrices, either with a single
+//'   slice shared by all replicates or with one slice per replicate
+//' @param t_max time at which simulation is terminated
+//' @param init_states matrix of initial compartment counts, one row per
+//'   replicate
+//' @param census_times vector of census times.
+//' @param census_columns vector of column indices to be censused, indexed as
+//'   for the bookkeeping matrix of a Gillespie path, i.e., with the time and
+//'   event columns first (C++ indexing beginning at 0).
+//' @param forcing_inds logical vector of indicating at which times in the
+//'   time-varying covariance matrix a forcing is applied.
+//' @param forcing_tcov_inds indices of the forcings in the tcovar matrix
+//' @param forcings_out matrix indicating the compartments that forcings flow out
+//'   of
+//' @param forcing_transfers array of forcing transfer matrices
+//' @param rate_ptr external function pointer to the lumped rate functions.
+//' @param max_attempts maximum number of attempts to simulate each path
+//' @param epsilon error control parameter bounding the relative change in the
+//'   rates over each leap
+//' @param n_critical events that can fire fewer than n_critical times before
+//'   exhausting a compartment are simulated exactly
+//' @param n_threads number of threads
+//'
+//' @return list of census matrices, laid out as the output of
+//'   \code{build_census_path}, entries for replicates that failed in each of
+//'   the attempts are NULL. An error in a replicate is raised once the batch
+//'   has finished.
+//' @export
+// [[Rcpp::export]]
+Rcpp::List simulate_tauleap_batch(const arma::mat& flow,
+                                  const Rcpp::NumericMatrix& parameters,
+                                  const Rcpp::NumericVector& constants,
+                                  const arma::cube& tcovar,
+                                  double t_max,
+                                  const arma::mat& init_states,
+                                  const arma::vec& census_times,
+                                  const arma::uvec& census_columns,
+                                  const Rcpp::LogicalVector& forcing_inds,
+                                  const arma::uvec& forcing_tcov_inds,
+                                  const arma::mat& forcings_out,
+                                  const arma::cube& forcing_transfers,
+                                  SEXP rate_ptr,
+                                  int max_attempts = 1,
+                                  double epsilon = 0.03,
+                                  int n_critical = 10,
+                                  int n_threads = 1) {
+
+      int nsim     = init_states.n_rows;
+      int n_rates  = flow.n_rows;
+      int n_params = parameters.ncol();
+
+#ifdef _OPENMP
+      if(n_threads < 1) n_threads = omp_get_max_threads();
+#else
+      n_threads = 1;
+#endif
+      if(n_threads > nsim) n_threads = std::max(nsim, 1);
+
+      // resolve the rate function on the main thread
+      stem_rate_fcn rate_fcn(rate_ptr);
+
+      // per-thread rate and parameter vectors, allocated on the main thread
+      std::vector<Rcpp::NumericVector> rates(n_threads);
+      std::vector<Rcpp::LogicalVector> rate_inds(n_threads);
+      std::vector<Rcpp::NumericVector> pars(n_threads);
+      for(int t=0; t < n_threads; ++t) {
+            rates[t]     = Rcpp::NumericVector(n_rates);
+            rate_inds[t] = Rcpp::LogicalVector(n_rates);
+            pars[t]      = Rcpp::NumericVector(n_params);
+      }
+
+      // compartments that events draw from, and the compartments to census
+      tauleap_flows flows(flow);
+      arma::uvec census_comps = census_columns - 2;
+
+      // seed for the replicate streams
+      uint64_t seed = draw_rng_seed();
+
+      std::vector<arma::mat> paths(nsim);
+      std::vector<int> success(nsim, 0);
+      std::vector<std::string> errors(nsim);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic)
+#endif
+      for(int k=0; k < nsim; ++k) {
+
+#ifdef _OPENMP
+            int thread = omp_get_thread_num();
+#else
+            int thread = 0;
+#endif
+            philox_rng rng(seed, static_cast<uint64_t>(k));
+
+            // copy the parameters for this replicate
+            int par_row = parameters.nrow() == 1 ? 0 : k;
+            for(int j=0; j < n_params; ++j) pars[thread][j] = parameters(par_row, j);
+
+            const arma::mat& tcov = tcovar.slice(tcovar.n_slices == 1 ? 0 : k);
+
+            // an exception must not escape the parallel region, the replicate
+            // is marked as failed and the error is raised after the region
+            try{
+                  for(int attempt=0; attempt < max_attempts && !success[k]; ++attempt) {
+                        success[k] = tauleap_path(paths[k], rng, rates[thread], rate_inds[thread],
+                                                  flow, flows, pars[thread], constants, tcov, t_max,
+                                                  init_states.row(k), census_times, census_comps,
+                                                  forcing_inds, forcing_tcov_inds, forcings_out,
+                                                  forcing_transfers, epsilon, n_critical, rate_fcn);
+                  }
+            } catch(std::exception &err) {
+                  success[k] = 0;
+                  errors[k]  = err.what();
+            } catch(...) {
+                  success[k] = 0;
+                  errors[k]  = "c++ exception (unknown reason)";
+            }
+      }
+
+      // raise the first error encountered in the replicates
+      try{
+            for(int k=0; k < nsim; ++k) {
+                  if(!errors[k].empty()) {
+                        throw std::runtime_error("replicate " + std::to_string(k + 1) + " failed: " + errors[k]);
+                  }
+            }
+      } catch(std::exception &err) {
+            forward_exception_to_r(err);
+      } catch(...) {
+            ::Rf_error("c++ exception (unknown reason)");
+      }
+
+      // collect the census paths
+      Rcpp::List path_list(nsim);
+      for(int k=0; k < nsim; ++k) {
+            if(success[k]) {
+                  path_list[k] = Rcpp::wrap(paths[k]);
+                  paths[k].reset();
+            }
+      }
+
+      return path_list;
+}
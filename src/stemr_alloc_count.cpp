@@ -0,0 +1,91 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include <RcppArmadillo.h>
+#include "stemr_alloc_count.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace Rcpp;
+using namespace arma;
+
+#ifdef STEMR_COUNT_ALLOCS
+
+static std::atomic<bool> alloc_counting(false);
+static std::atomic<unsigned long long> alloc_count(0);
+
+static inline void count_alloc() {
+        if(alloc_counting.load(std::memory_order_relaxed)) alloc_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void* stemr_counted_malloc(std::size_t n_bytes) {
+        count_alloc();
+        return std::malloc(n_bytes);
+}
+
+extern "C" void stemr_counted_free(void* ptr) {
+        std::free(ptr);
+}
+
+void* operator new(std::size_t n_bytes) {
+        count_alloc();
+        void* ptr = std::malloc(n_bytes != 0 ? n_bytes : 1);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+}
+
+void* operator new[](std::size_t n_bytes) {
+        return ::operator new(n_bytes);
+}
+
+void operator delete(void* ptr) noexcept {
+        std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+        std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+        std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+        std::free(ptr);
+}
+
+#endif
+
+//' Count the heap allocations made by the C++ code of stemr.
+//'
+//' Counts the allocations through operator new and by armadillo in the C++
+//' code of the package, e.g., to check that a kernel does not allocate once
+//' its workspace is set up. Allocations in the compiled model code, e.g., by
+//' the ODE integrators, are not counted. The counter is only available if the
+//' package was installed with the allocation counter, see
+//' \code{inst/bench/run_benchmarks.R}.
+//'
+//' @param enable should allocations be counted after the call
+//'
+//' @return number of allocations counted since the previous call, which
+//'   resets the count, or NA if the counter is not available
+//' @export
+// [[Rcpp::export]]
+double stemr_alloc_count(bool enable = true) {
+
+#ifdef STEMR_COUNT_ALLOCS
+        // check that the replacement operator new is the one called from the
+        // package, another one may be bound first if libstdc++ is loaded globally
+        alloc_counting = true;
+        unsigned long long before = alloc_count.load();
+        ::operator delete(::operator new(sizeof(double)));
+        bool counted = alloc_count.load() > before;
+
+        alloc_counting = enable;
+        unsigned long long count = alloc_count.exchange(0) - (counted ? 1 : 0);
+
+        if(!counted) return NA_REAL;
+        return static_cast<double>(count);
+#else
+        return NA_REAL;
+#endif
+}
@@ -0,0 +1,26 @@
+#ifndef stemr_alloc_count_h
+#define stemr_alloc_count_h
+
+// Counting of the heap allocations made by the C++ code of the package, for
+// the benchmarks in inst/bench. The counter is only built if the package is
+// installed with
+//
+//   STEMR_ALLOC_CPPFLAGS="-DSTEMR_COUNT_ALLOCS -include stemr_alloc_count.h"
+//
+// in the environment, which includes this header in every translation unit so
+// that armadillo allocates its memory through the counting functions below.
+// Allocations through operator new are counted by the replacements in
+// stemr_alloc_count.cpp.
+#ifdef STEMR_COUNT_ALLOCS
+
+#include <cstddef>
+
+extern "C" void* stemr_counted_malloc(std::size_t n_bytes);
+extern "C" void stemr_counted_free(void* ptr);
+
+#define ARMA_ALIEN_MEM_ALLOC_FUNCTION stemr_counted_malloc
+#define ARMA_ALIEN_MEM_FREE_FUNCTION stemr_counted_free
+
+#endif
+
+#endif
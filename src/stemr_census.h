@@ -0,0 +1,59 @@
+#ifndef stemr_CENSUS_H
+#define stemr_CENSUS_H
+
+#include <algorithm>
+
+// Row indices of the census times in a path whose times are sorted, i.e., for
+// each census time the last row at or before it, as
+// findInterval(census_times, path_times) - 1. The search for each census time
+// gallops forward from the row found for the previous one and is finished by
+// a binary search over the bracketing rows, so sorted census times are merged
+// with the path times in a single pass that costs O(log(gap)) per census time
+// rather than O(log(n_rows)). An out of order census time restarts the
+// search from the first row. If all_inside, the indices are clamped to
+// 0, ..., n_rows - 2, as findInterval(..., all.inside = TRUE) - 1.
+inline void census_row_inds(const double* path_times,
+                            int n_rows,
+                            const double* census_times,
+                            int n_census,
+                            bool all_inside,
+                            int* inds) {
+
+        int j = 0;
+
+        for(int k = 0; k < n_census; ++k) {
+
+                double t = census_times[k];
+                if(k > 0 && t < census_times[k-1]) j = 0;
+
+                // rows before j are at or before t, gallop until a row after t is bracketed
+                int lo = j, step = 1;
+                while(lo + step < n_rows && path_times[lo + step] <= t) {
+                        lo   += step;
+                        step *= 2;
+                }
+
+                j = std::upper_bound(path_times + lo, path_times + std::min(lo + step, n_rows), t) - path_times;
+
+                inds[k] = all_inside ? std::min(std::max(j, 1), n_rows - 1) - 1 : j - 1;
+        }
+}
+
+// copy the census columns of the path at the census rows into the columns
+// 1, ..., n_cols of a column-major census matrix with n_census rows
+inline void census_gather(const double* path,
+                          int n_rows,
+                          const int* census_columns,
+                          int n_cols,
+                          const int* inds,
+                          int n_census,
+                          double* censusmat) {
+
+        for(int c = 0; c < n_cols; ++c) {
+                const double* path_col = path + (size_t)census_columns[c] * n_rows;
+                double* census_col     = censusmat + (size_t)(c + 1) * n_census;
+                for(int k = 0; k < n_census; ++k) census_col[k] = path_col[inds[k]];
+        }
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef stemr_EVENTQUEUE_H
+#define stemr_EVENTQUEUE_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+// Indexed binary min-heap of event firing times for the next reaction method.
+// The event with the earliest firing time is at the top, and the firing time of
+// any event can be changed in O(log R) since the heap position of each event is
+// tracked. Events that cannot fire have a firing time of Inf.
+class event_queue {
+public:
+        event_queue(int n_events) : heap(n_events), pos(n_events),
+        times(n_events, std::numeric_limits<double>::infinity()) {
+                for(int k = 0; k < n_events; ++k) {
+                        heap[k] = k;
+                        pos[k]  = k;
+                }
+        }
+
+        // set the firing time of an event
+        void set(int event, double time) {
+                double old_time = times[event];
+                times[event] = time;
+                if(time < old_time) {
+                        sift_up(pos[event]);
+                } else {
+                        sift_down(pos[event]);
+                }
+        }
+
+        // event with the earliest firing time and its firing time
+        int top() const {
+                return heap[0];
+        }
+
+        double top_time() const {
+                return times[heap[0]];
+        }
+
+        // firing time of an event
+        double time(int event) const {
+                return times[event];
+        }
+
+private:
+        std::vector<int> heap;     // events, in heap order
+        std::vector<int> pos;      // position of each event in the heap
+        std::vector<double> times; // firing times, indexed by event
+
+        void swap_nodes(int i, int j) {
+                std::swap(heap[i], heap[j]);
+                pos[heap[i]] = i;
+                pos[heap[j]] = j;
+        }
+
+        void sift_up(int i) {
+                while(i > 0 && times[heap[(i - 1) / 2]] > times[heap[i]]) {
+                        swap_nodes(i, (i - 1) / 2);
+                        i = (i - 1) / 2;
+                }
+        }
+
+        void sift_down(int i) {
+                int n = heap.size();
+                while(true) {
+                        int smallest = i;
+                        int left     = 2 * i + 1;
+                        int right    = left + 1;
+                        if(left < n && times[heap[left]] < times[heap[smallest]]) smallest = left;
+                        if(right < n && times[heap[right]] < times[heap[smallest]]) smallest = right;
+                        if(smallest == i) break;
+                        swap_nodes(i, smallest);
+                        i = smallest;
+                }
+        }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef stemr_FORCINGS_H
+#define stemr_FORCINGS_H
+
+#include <RcppArmadillo.h>
+#include <vector>
+#include <cmath>
+
+// Forcings compiled into sparse lists of their source compartments and of the
+// compartments their transfers move flow into. A forcing s distributes its
+// flow over the source compartments in proportion to their volumes, i.e.,
+// volumes += forcing_transfers.slice(s) * (flow * normalise(forcings_out.col(s) % volumes, 1)),
+// which touches only the nonzero entries of forcings_out.col(s) and of the
+// columns of the transfer matrix at those compartments. The forcings at a time
+// are applied in order in a single call without allocating. Forcings of
+// integer valued paths are rounded to whole counts, as for Gillespie paths.
+class forcing_engine {
+public:
+        forcing_engine(const arma::uvec& forcing_tcov_inds,
+                       const arma::mat& forcings_out,
+                       const arma::cube& forcing_transfers,
+                       bool integer_flows = false) :
+                integer(integer_flows) {
+
+                int n_forcings = forcing_tcov_inds.n_elem;
+                int n_comps    = forcings_out.n_rows;
+
+                src_start.push_back(0);
+                dst_start.push_back(0);
+
+                for(int s = 0; s < n_forcings; ++s) {
+                        tcov_inds.push_back(forcing_tcov_inds[s]);
+
+                        for(int k = 0; k < n_comps; ++k) {
+                                if(forcings_out(k, s) == 0) continue;
+
+                                src_comps.push_back(k);
+                                src_weights.push_back(forcings_out(k, s));
+
+                                for(int c = 0; c < n_comps; ++c) {
+                                        if(forcing_transfers(c, k, s) != 0) {
+                                                dst_comps.push_back(c);
+                                                dst_values.push_back(forcing_transfers(c, k, s));
+                                        }
+                                }
+                                dst_start.push_back(dst_comps.size());
+                        }
+
+                        src_start.push_back(src_comps.size());
+                }
+
+                distvec.resize(src_comps.size());
+        }
+
+        // apply the forcings with their flows in row of pars, e.g., the time
+        // varying covariate or parameter matrix. The distribution of each
+        // forcing is computed from volumes and is also added to volumes_2, if
+        // supplied.
+        template <class P>
+        inline void apply(double* volumes, const P& pars, int row, double* volumes_2 = nullptr) {
+
+                int n_forcings = tcov_inds.size();
+
+                for(int s = 0; s < n_forcings; ++s) {
+
+                        double flow      = pars(row, tcov_inds[s]);
+                        double dist_norm = 0;
+
+                        for(int j = src_start[s]; j < src_start[s+1]; ++j) {
+                                distvec[j]  = src_weights[j] * volumes[src_comps[j]];
+                                dist_norm  += std::abs(distvec[j]);
+                        }
+
+                        double scale = dist_norm != 0 ? flow / dist_norm : flow;
+
+                        for(int j = src_start[s]; j < src_start[s+1]; ++j) {
+                                double flow_j = scale * distvec[j];
+                                if(integer) flow_j = std::round(flow_j);
+                                if(flow_j == 0) continue;
+
+                                for(int d = dst_start[j]; d < dst_start[j+1]; ++d) {
+                                        volumes[dst_comps[d]] += dst_values[d] * flow_j;
+                                        if(volumes_2 != nullptr) volumes_2[dst_comps[d]] += dst_values[d] * flow_j;
+                                }
+                        }
+                }
+        }
+
+private:
+        bool integer;
+        std::vector<int> tcov_inds;      // columns of the forcing flows
+        std::vector<int> src_start;      // first source of each forcing
+        std::vector<int> src_comps;      // source compartments
+        std::vector<double> src_weights; // entries of forcings_out at the sources
+        std::vector<int> dst_start;      // first transfer of each source
+        std::vector<int> dst_comps;      // compartments receiving the transfers
+        std::vector<double> dst_values;  // entries of the transfer matrices
+        std::vector<double> distvec;     // distribution of the flow over the sources
+};
+
+#endif
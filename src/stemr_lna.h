@@ -0,0 +1,514 @@
+#ifndef stemr_LNA_H
+#define stemr_LNA_H
+
+#include <RcppArmadillo.h>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "stemr_profile.h"
+#include "stemr_types.h"
+#include "stemr_forcings.h"
+
+// Compute a square root, S, of the LNA diffusion matrix, such that S * S^T is
+// equal to the diffusion matrix, which is symmetric positive semidefinite. The
+// square root is stored in svd_U, and svd_d and svd_V are used as workspace.
+// The method is one of
+//
+//   "svd":   symmetric square root, U * diag(sqrt(d)) * V^T, via the SVD,
+//   "eigen": symmetric square root, V * diag(sqrt(d)) * V^T, via the symmetric
+//            eigendecomposition, which is cheaper than the SVD,
+//   "chol":  row-permuted lower triangular factor via the pivoted Cholesky
+//            decomposition, which is cheapest and stops at the numerical rank.
+//
+// Negative singular values and eigenvalues (numerical errors) are zeroed out.
+// The symmetric square roots have zeros wherever the diffusion matrix does.
+// sqrt_work and perm are workspace of the same dimensions as svd_U and svd_d,
+// with them the computations outside of the LAPACK decompositions do not
+// allocate. Returns false if the decomposition failed.
+inline bool lna_diffusion_sqrt_dense(arma::mat& svd_U,
+                                     arma::vec& svd_d,
+                                     arma::mat& svd_V,
+                                     const arma::mat& lna_diffusion,
+                                     const std::string& sqrt_method,
+                                     arma::mat& sqrt_work,
+                                     arma::uvec& perm) {
+
+        int n = lna_diffusion.n_rows;
+
+        if(sqrt_method == "chol") {
+
+                // pivoted Cholesky, the factor is built in svd_U with rows in pivoted order
+                svd_V = lna_diffusion;
+                svd_U.zeros(n, n);
+                perm.set_size(n);
+                for(int i = 0; i < n; ++i) perm[i] = i;
+
+                double tol = n * arma::datum::eps * std::max(svd_V.diag().max(), 0.0);
+
+                for(int k = 0; k < n; ++k) {
+
+                        // pivot on the largest remaining diagonal element
+                        int q = k;
+                        for(int i = k + 1; i < n; ++i) {
+                                if(svd_V(i, i) > svd_V(q, q)) q = i;
+                        }
+                        if(!(svd_V(q, q) > tol)) break;
+
+                        if(q != k) {
+                                svd_V.swap_rows(k, q);
+                                svd_V.swap_cols(k, q);
+                                svd_U.swap_rows(k, q);
+                                std::swap(perm[k], perm[q]);
+                        }
+
+                        double pivot = std::sqrt(svd_V(k, k));
+                        svd_U(k, k)  = pivot;
+                        for(int i = k + 1; i < n; ++i) svd_U(i, k) = svd_V(i, k) / pivot;
+
+                        // update the trailing submatrix
+                        for(int j = k + 1; j < n; ++j) {
+                                for(int i = j; i < n; ++i) {
+                                        svd_V(i, j) -= svd_U(i, k) * svd_U(j, k);
+                                        svd_V(j, i)  = svd_V(i, j);
+                                }
+                        }
+                }
+
+                // undo the pivoting on the rows
+                for(int i = 0; i < n; ++i) svd_V.row(perm[i]) = svd_U.row(i);
+                svd_U = svd_V;
+
+                return svd_U.is_finite();
+
+        }
+
+        if(sqrt_method == "eigen") {
+
+                if(!arma::eig_sym(svd_d, svd_V, lna_diffusion)) return false;
+                svd_U = svd_V;
+
+        } else {
+
+                if(!arma::svd(svd_U, svd_d, svd_V, lna_diffusion)) return false;
+        }
+
+        // multiply the columns of V by the square roots of the singular values or
+        // eigenvalues, zeroing out negative values (numerical errors)
+        for(int k = 0; k < n; ++k) {
+                double sqrt_d = svd_d[k] > 0 ? std::sqrt(svd_d[k]) : 0.0;
+                for(int i = 0; i < n; ++i) svd_V(i, k) *= sqrt_d;
+        }
+
+        // complete the square root
+        sqrt_work = svd_U * svd_V.t();
+        svd_U     = sqrt_work;
+
+        // zero out numerical errors
+        for(int k = 0; k < n * n; ++k) {
+                if(lna_diffusion[k] == 0) svd_U[k] = 0;
+        }
+
+        return true;
+}
+
+// Label the blocks of a symmetric matrix, i.e., the connected components of
+// the graph of its nonzero entries, in labels. stack is workspace, which only
+// allocates the first time it is used. Returns the number of blocks.
+inline int lna_diffusion_blocks(const arma::mat& lna_diffusion, arma::uvec& labels, std::vector<int>& stack) {
+
+        int n = lna_diffusion.n_rows;
+        int n_blocks = 0;
+
+        labels.set_size(n);
+        labels.fill(n);
+
+        stack.clear();
+        stack.reserve(n);
+
+        for(int r = 0; r < n; ++r) {
+                if(labels[r] != static_cast<arma::uword>(n)) continue;
+
+                labels[r] = n_blocks;
+                stack.push_back(r);
+
+                while(!stack.empty()) {
+                        int c = stack.back();
+                        stack.pop_back();
+
+                        const double* col = lna_diffusion.colptr(c);
+                        for(int i = 0; i < n; ++i) {
+                                if(col[i] != 0 && labels[i] == static_cast<arma::uword>(n)) {
+                                        labels[i] = n_blocks;
+                                        stack.push_back(i);
+                                }
+                        }
+                }
+
+                ++n_blocks;
+        }
+
+        return n_blocks;
+}
+
+// Buffers for the square roots of the blocks of a block diagonal diffusion
+// matrix, one set per block. The blocks have the same sizes in every interval,
+// so the buffers are sized in the first interval and then reused without
+// allocating.
+struct lna_sqrt_blocks {
+        arma::uvec labels;                  // block of each event
+        std::vector<int> stack;             // workspace for labelling the blocks
+        std::vector<arma::uvec> index;      // events in each block
+        std::vector<arma::mat> diffusion;   // diffusion of each block
+        std::vector<arma::mat> root;        // square root of each block
+        std::vector<arma::mat> V;           // workspace for each block
+        std::vector<arma::mat> work;        // workspace for each block
+        std::vector<arma::vec> d;           // workspace for each block
+        std::vector<arma::uvec> perm;       // workspace for each block
+
+        void reserve(int n_blocks) {
+                if(static_cast<int>(index.size()) >= n_blocks) return;
+                index.resize(n_blocks);
+                diffusion.resize(n_blocks);
+                root.resize(n_blocks);
+                V.resize(n_blocks);
+                work.resize(n_blocks);
+                d.resize(n_blocks);
+                perm.resize(n_blocks);
+        }
+};
+
+// Square root of the LNA diffusion matrix, as in lna_diffusion_sqrt_dense. If
+// the diffusion is block diagonal (up to a permutation), e.g., when the LNA is
+// integrated in blocks, the square root of each block is computed separately,
+// which is O(sum of n_b^3) instead of O(n^3). The blocks are decomposed in the
+// buffers of blocks.
+inline bool lna_diffusion_sqrt(arma::mat& svd_U,
+                               arma::vec& svd_d,
+                               arma::mat& svd_V,
+                               const arma::mat& lna_diffusion,
+                               const std::string& sqrt_method,
+                               arma::mat& sqrt_work,
+                               arma::uvec& perm,
+                               lna_sqrt_blocks& blocks) {
+
+        int n = lna_diffusion.n_rows;
+
+        int n_blocks = n > 16 ? lna_diffusion_blocks(lna_diffusion, blocks.labels, blocks.stack) : 1;
+
+        if(n_blocks == 1) {
+                if(lna_diffusion_sqrt_dense(svd_U, svd_d, svd_V, lna_diffusion, sqrt_method, sqrt_work, perm)) return true;
+
+                profile_count(stemr_profile().svd_failures);
+                return false;
+        }
+
+        blocks.reserve(n_blocks);
+
+        // count the events in each block, then list them
+        for(int b = 0; b < n_blocks; ++b) perm[b] = 0;
+        for(int i = 0; i < n; ++i) ++perm[blocks.labels[i]];
+
+        for(int b = 0; b < n_blocks; ++b) {
+                blocks.index[b].set_size(perm[b]);
+                perm[b] = 0;
+        }
+        for(int i = 0; i < n; ++i) {
+                int b = blocks.labels[i];
+                blocks.index[b][perm[b]++] = i;
+        }
+
+        svd_U.zeros(n, n);
+
+        for(int b = 0; b < n_blocks; ++b) {
+
+                const arma::uvec& block = blocks.index[b];
+                int n_b = block.n_elem;
+
+                arma::mat& diffusion_b = blocks.diffusion[b];
+                arma::mat& U_b         = blocks.root[b];
+                diffusion_b.set_size(n_b, n_b);
+                U_b.set_size(n_b, n_b);
+                blocks.V[b].set_size(n_b, n_b);
+                blocks.work[b].set_size(n_b, n_b);
+                blocks.d[b].set_size(n_b);
+                blocks.perm[b].set_size(n_b);
+
+                for(int j = 0; j < n_b; ++j) {
+                        for(int i = 0; i < n_b; ++i) diffusion_b(i, j) = lna_diffusion(block[i], block[j]);
+                }
+
+                if(!lna_diffusion_sqrt_dense(U_b, blocks.d[b], blocks.V[b], diffusion_b, sqrt_method,
+                                             blocks.work[b], blocks.perm[b])) {
+                        profile_count(stemr_profile().svd_failures);
+                        return false;
+                }
+
+                for(int j = 0; j < n_b; ++j) {
+                        for(int i = 0; i < n_b; ++i) svd_U(block[i], block[j]) = U_b(i, j);
+                }
+        }
+
+        return true;
+}
+
+inline bool lna_diffusion_sqrt(arma::mat& svd_U,
+                               arma::vec& svd_d,
+                               arma::mat& svd_V,
+                               const arma::mat& lna_diffusion,
+                               const std::string& sqrt_method,
+                               arma::mat& sqrt_work,
+                               arma::uvec& perm) {
+
+        lna_sqrt_blocks blocks;
+
+        return lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, sqrt_method, sqrt_work, perm, blocks);
+}
+
+inline bool lna_diffusion_sqrt(arma::mat& svd_U,
+                               arma::vec& svd_d,
+                               arma::mat& svd_V,
+                               const arma::mat& lna_diffusion,
+                               const std::string& sqrt_method) {
+
+        arma::mat sqrt_work(lna_diffusion.n_rows, lna_diffusion.n_cols);
+        arma::uvec perm(lna_diffusion.n_rows);
+
+        return lna_diffusion_sqrt(svd_U, svd_d, svd_V, lna_diffusion, sqrt_method, sqrt_work, perm);
+}
+
+// Whether two armadillo objects have the same dimensions and elements, used to
+// check that the objects held by a workspace were derived from the arguments.
+template<typename T>
+inline bool same_contents(const T& a, const T& b) {
+        return arma::size(a) == arma::size(b) && std::equal(a.begin(), a.end(), b.begin());
+}
+
+// Scratch objects for mapping perturbations to an LNA path. A workspace is
+// allocated once per fit (see make_lna_workspace) and reused by every call, so
+// that the per-interval computations do not allocate. It also holds the
+// objects derived from the model that are invariant over the fit.
+struct lna_scratch {
+        lna_scratch(int n_events, int n_comps) :
+        lna_state(n_events + n_events * n_events, arma::fill::zeros),
+        lna_drift(n_events, arma::fill::zeros),
+        lna_diffusion(n_events, n_events, arma::fill::zeros),
+        log_lna(n_events, arma::fill::zeros),
+        nat_lna(n_events, arma::fill::zeros),
+        init_volumes(n_comps, arma::fill::zeros),
+        sqrt_work(n_events, n_events, arma::fill::zeros),
+        perm(n_events, arma::fill::zeros),
+        block_threads(1) { }
+
+        // does the workspace have the dimensions of the model
+        bool matches(int n_events, int n_comps) const {
+                return static_cast<int>(lna_drift.n_elem) == n_events &&
+                       static_cast<int>(init_volumes.n_elem) == n_comps;
+        }
+
+        arma::vec  lna_state;       // state of the LNA ODEs
+        arma::vec  lna_drift;       // incidence mean vector (log scale)
+        arma::mat  lna_diffusion;   // diffusion matrix
+        arma::vec  log_lna;         // LNA increment, log scale
+        arma::vec  nat_lna;         // LNA increment, natural scale
+        arma::vec  init_volumes;    // compartment volumes
+        arma::mat  sqrt_work;       // workspace for the diffusion square root
+        arma::uvec perm;            // pivots for the pivoted Cholesky
+        lna_sqrt_blocks sqrt_blocks; // buffers for block diagonal diffusions
+        arma::sp_mat stoich_sparse; // stoichiometry matrix, set by stoich_ops
+        arma::mat  stoich_src;      // stoichiometry matrix stoich_sparse was built from
+        std::unique_ptr<forcing_engine> forcings; // forcing operators, set on first use
+        arma::uvec forcing_tcov_src;      // inputs the forcing operators were compiled from
+        arma::mat  forcings_out_src;
+        arma::cube forcing_transfers_src;
+        std::unique_ptr<ode_context> ctx;         // integrator context, set on first use
+        int block_threads;                        // threads over the blocks of the LNA ODEs
+        arma::mat  census_increments;     // event increments over the census intervals
+        arma::vec  census_state;          // compartment volumes at the census times
+        std::vector<char> census_needed;  // events whose increments are censused
+
+        // the forcing operators, compiled on first use. The forcings are
+        // invariant over a fit, so a workspace allocated for the fit compiles
+        // them once rather than in every call that maps a path. The operators
+        // are recompiled if a later call passes different forcings.
+        forcing_engine& forcing_ops(const arma::uvec& forcing_tcov_inds,
+                                    const arma::mat& forcings_out,
+                                    const arma::cube& forcing_transfers) {
+                if(!forcings ||
+                   !same_contents(forcing_tcov_src, forcing_tcov_inds) ||
+                   !same_contents(forcings_out_src, forcings_out) ||
+                   !same_contents(forcing_transfers_src, forcing_transfers)) {
+                        forcings.reset(new forcing_engine(forcing_tcov_inds, forcings_out, forcing_transfers));
+                        forcing_tcov_src      = forcing_tcov_inds;
+                        forcings_out_src      = forcings_out;
+                        forcing_transfers_src = forcing_transfers;
+                }
+                return *forcings;
+        }
+
+        // the sparse stoichiometry matrix, built on first use and rebuilt if
+        // a later call passes a different stoichiometry matrix.
+        const arma::sp_mat& stoich_ops(const arma::mat& stoich_matrix) {
+                if(stoich_src.is_empty() || !same_contents(stoich_src, stoich_matrix)) {
+                        stoich_sparse = arma::sp_mat(stoich_matrix);
+                        stoich_src    = stoich_matrix;
+                }
+                return stoich_sparse;
+        }
+
+        // the integrator context, allocated on first use and kept with its
+        // stepper and state for the subsequent calls. A context for another
+        // compiled system is replaced. The blocks of the LNA ODEs are
+        // integrated over block_threads threads.
+        ode_context& context(SEXP lna_pointer, SEXP set_pars_pointer, SEXP ctx_pointer) {
+                if(!ctx || ctx->integrator != *Rcpp::XPtr<ode_ptr>(lna_pointer)) {
+                        ctx.reset(new ode_context(lna_pointer, set_pars_pointer, ctx_pointer));
+                        ctx->set_threads(block_threads);
+                }
+                return *ctx;
+        }
+};
+
+// Get the workspace from an optional external pointer returned by
+// make_lna_workspace. If the pointer is NULL a workspace is allocated in
+// ws_local. Throws a std::runtime_error if the dimensions do not match.
+inline lna_scratch& lna_workspace_ref(SEXP lna_workspace,
+                                      std::unique_ptr<lna_scratch>& ws_local,
+                                      int n_events,
+                                      int n_comps) {
+
+        if(Rf_isNull(lna_workspace)) {
+                ws_local.reset(new lna_scratch(n_events, n_comps));
+                return *ws_local;
+        }
+
+        Rcpp::XPtr<lna_scratch> ws(lna_workspace);
+        if(!ws->matches(n_events, n_comps)) {
+                throw std::runtime_error("The LNA workspace does not match the dimensions of the model.");
+        }
+
+        return *ws;
+}
+
+// Cache of the LNA drift and diffusion square root in each interval, backed by
+// the memory of an R list so that it persists across calls. The drift and the
+// diffusion over an interval depend only on the interval endpoints and on the
+// LNA parameter vector at its left endpoint (parameters, current compartment
+// volumes, constants, and time-varying covariates), which are stored as the key
+// for each interval. If the key matches, the moments for the interval are
+// reused instead of integrating the LNA ODEs and decomposing the diffusion
+// matrix. Once an interval misses, the path has diverged from the one in the
+// cache and all subsequent intervals are recomputed. The list elements are
+//
+//   keys:           matrix with one column per interval (t_L, t_R, parameters),
+//   drift:          matrix with one column per interval,
+//   diffusion_sqrt: matrix with n_events columns per interval,
+//   n_valid:        integer, number of leading intervals with stored entries.
+//
+// The cache is disabled if the list is NULL. The storage types of the list
+// elements, double for the matrices and integer for n_valid, are checked, as
+// are the dimensions of the matrices against the length of the LNA parameter
+// vector, the number of events, and the number of intervals. A
+// std::runtime_error is thrown if they do not match.
+class lna_moment_cache {
+public:
+        lna_moment_cache(const Rcpp::Nullable<Rcpp::List>& lna_cache,
+                         int n_params,
+                         int n_events_,
+                         int n_intervals) :
+        enabled(lna_cache.isNotNull()), diverged(false),
+        keys(0), drift(0), sqrts(0), n_valid(0), key_len(0), n_events(0) {
+
+                if(enabled) {
+                        cache = Rcpp::List(lna_cache.get());
+
+                        // the elements are written in place, so they must have the
+                        // storage types of the views rather than be coerced copies
+                        SEXP keys_sexp  = cache["keys"];
+                        SEXP drift_sexp = cache["drift"];
+                        SEXP sqrt_sexp  = cache["diffusion_sqrt"];
+                        SEXP valid_sexp = cache["n_valid"];
+
+                        if(TYPEOF(keys_sexp) != REALSXP || TYPEOF(drift_sexp) != REALSXP || TYPEOF(sqrt_sexp) != REALSXP) {
+                                throw std::runtime_error("The keys, drift, and diffusion_sqrt of the LNA cache must be double matrices.");
+                        }
+                        if(TYPEOF(valid_sexp) != INTSXP) {
+                                throw std::runtime_error("n_valid in the LNA cache must be an integer.");
+                        }
+
+                        Rcpp::NumericMatrix keys_mat  = cache["keys"];
+                        Rcpp::NumericMatrix drift_mat = cache["drift"];
+                        Rcpp::NumericMatrix sqrt_mat  = cache["diffusion_sqrt"];
+                        Rcpp::IntegerVector valid_vec = cache["n_valid"];
+
+                        if(keys_mat.nrow() != n_params + 2 || keys_mat.ncol() < n_intervals) {
+                                throw std::runtime_error("The keys of the LNA cache must have a row per parameter plus two and a column per interval.");
+                        }
+                        if(drift_mat.nrow() != n_events_ || drift_mat.ncol() < n_intervals) {
+                                throw std::runtime_error("The drift in the LNA cache must have a row per event and a column per interval.");
+                        }
+                        if(sqrt_mat.nrow() != n_events_ || sqrt_mat.ncol() < n_events_ * n_intervals) {
+                                throw std::runtime_error("The diffusion square roots in the LNA cache must have a row per event and n_events columns per interval.");
+                        }
+                        if(valid_vec.size() != 1 || valid_vec[0] < 0 || valid_vec[0] > n_intervals) {
+                                throw std::runtime_error("The number of valid intervals in the LNA cache must be between 0 and the number of intervals.");
+                        }
+
+                        keys     = keys_mat.begin();
+                        drift    = drift_mat.begin();
+                        sqrts    = sqrt_mat.begin();
+                        n_valid  = valid_vec.begin();
+                        key_len  = keys_mat.nrow();
+                        n_events = drift_mat.nrow();
+                }
+        }
+
+        // look up the moments for interval j, returns true on a hit
+        bool lookup(int j, double t_L, double t_R, const double* pars,
+                    arma::vec& lna_drift, arma::mat& diffusion_sqrt) {
+
+                if(!enabled || diverged || j >= *n_valid || !matches(j, t_L, t_R, pars)) {
+                        diverged = true;
+                        return false;
+                }
+
+                std::copy(drift + j * n_events, drift + (j + 1) * n_events, lna_drift.begin());
+                std::copy(sqrts + j * n_events * n_events, sqrts + (j + 1) * n_events * n_events,
+                          diffusion_sqrt.begin());
+                return true;
+        }
+
+        // store the moments for interval j, later entries are discarded
+        void store(int j, double t_L, double t_R, const double* pars,
+                   const arma::vec& lna_drift, const arma::mat& diffusion_sqrt) {
+
+                if(!enabled) return;
+
+                double* key = keys + j * key_len;
+                key[0] = t_L;
+                key[1] = t_R;
+                std::copy(pars, pars + key_len - 2, key + 2);
+
+                std::copy(lna_drift.begin(), lna_drift.end(), drift + j * n_events);
+                std::copy(diffusion_sqrt.begin(), diffusion_sqrt.end(), sqrts + j * n_events * n_events);
+                *n_valid = j + 1;
+        }
+
+private:
+        Rcpp::List cache;
+        bool enabled;
+        bool diverged;
+        double* keys;
+        double* drift;
+        double* sqrts;
+        int* n_valid;
+        int key_len;
+        int n_events;
+
+        bool matches(int j, double t_L, double t_R, const double* pars) const {
+                const double* key = keys + j * key_len;
+                return key[0] == t_L && key[1] == t_R && std::equal(pars, pars + key_len - 2, key + 2);
+        }
+};
+
+#endif
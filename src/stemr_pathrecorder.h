@@ -0,0 +1,100 @@
+#ifndef stemr_PATHRECORDER_H
+#define stemr_PATHRECORDER_H
+
+#include <RcppArmadillo.h>
+
+// Records a path simulated via an exact algorithm, either as the full
+// bookkeeping matrix with one row per event (time, event code, state), or, in
+// census mode, as the compartment counts at a sequence of census times. In
+// census mode the output is laid out as the output of build_census_path applied
+// to the full path, i.e., the first column contains the census times and the
+// count at each census time is that of the last event at or before it, but
+// memory usage does not grow with the number of events. The bookkeeping matrix
+// grows geometrically, so filling it costs amortized O(1) per event.
+class path_recorder {
+public:
+        // full path mode, initial dimensions of the bookkeeping matrix
+        path_recorder(arma::mat& path_, int init_rows_, int n_cols_) :
+        path(path_), census_mode(false), init_rows(std::max(init_rows_, 2)), n_cols(n_cols_),
+        census_times(0), census_comps(0), ind_cur(0) { }
+
+        // census mode, census times and the compartments (columns of the state
+        // vector) to be censused
+        path_recorder(arma::mat& census_path, const arma::vec& census_times_, const arma::uvec& census_comps_) :
+        path(census_path), census_mode(true), init_rows(0), n_cols(0),
+        census_times(&census_times_), census_comps(&census_comps_), ind_cur(0) { }
+
+        // record the initial state
+        void start(double t, const arma::rowvec& state) {
+                if(census_mode) {
+                        path.set_size(census_times->n_elem, census_comps->n_elem + 1);
+                        path.col(0) = *census_times;
+                        last_state  = state;
+                        ind_cur     = 0;
+                        census(t, true);
+                } else {
+                        path.set_size(init_rows, n_cols);
+                        path(0, 0) = t;
+                        path(0, 1) = -1;
+                        path(0, arma::span(2, n_cols - 1)) = state;
+                        ind_cur = 1;
+                }
+        }
+
+        // record an event (or -1 for a change in the time-varying covariates)
+        // at time t that leads to the given state
+        void add(double t, int event, const arma::rowvec& state) {
+                if(census_mode) {
+                        census(t, false);
+                        last_state = state;
+                } else {
+                        path(ind_cur, 0) = t;
+                        path(ind_cur, 1) = event;
+                        path(ind_cur, arma::span(2, n_cols - 1)) = state;
+
+                        ind_cur += 1;
+                        if(ind_cur == static_cast<int>(path.n_rows)) path.resize(2 * path.n_rows, n_cols);
+                }
+        }
+
+        // close out the path at t_max
+        void finish(double t_max) {
+                if(census_mode) {
+                        census(arma::datum::inf, true);
+                } else {
+                        path.shed_rows(ind_cur, path.n_rows - 1);
+
+                        // ensure that t_max is the time of the last row in path. if not, add it
+                        if(path(path.n_rows-1, 0) != t_max) {
+                                arma::rowvec last_row = path.row(path.n_rows - 1);
+                                last_row(0) = t_max;
+                                last_row(1) = -1;
+                                path.insert_rows(path.n_rows, last_row);
+                        }
+                }
+        }
+
+private:
+        arma::mat& path;
+        bool census_mode;
+        int init_rows;
+        int n_cols;
+        const arma::vec* census_times;
+        const arma::uvec* census_comps;
+        arma::rowvec last_state;
+        int ind_cur;
+
+        // record the last state at the census times before (or at) time t
+        void census(double t, bool inclusive) {
+                int n_census = census_times->n_elem;
+                while(ind_cur < n_census &&
+                      ((*census_times)[ind_cur] < t || (inclusive && (*census_times)[ind_cur] == t))) {
+                        for(int c=0; c < static_cast<int>(census_comps->n_elem); ++c) {
+                                path(ind_cur, c + 1) = last_state((*census_comps)[c]);
+                        }
+                        ind_cur += 1;
+                }
+        }
+};
+
+#endif
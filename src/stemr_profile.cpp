@@ -0,0 +1,68 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include <RcppArmadillo.h>
+#include "stemr_profile.h"
+
+using namespace Rcpp;
+using namespace arma;
+
+//' Enable or disable the profiling counters.
+//'
+//' When enabled, the C++ entry points of the MCMC kernels count their calls and
+//' accumulate their wall time, and the integrator contexts report the number of
+//' evaluations of the ODE right hand sides and of accepted steps after each
+//' call, for contexts kept in a workspace, or when they are released. The
+//' counters are not reset, see \code{stemr_profile_reset}.
+//'
+//' @param enable should the counters be updated
+//'
+//' @return logical indicating whether profiling was enabled before the call
+//' @export
+// [[Rcpp::export]]
+bool stemr_profile_enable(bool enable = true) {
+        return stemr_profile().enabled.exchange(enable);
+}
+
+//' Reset the profiling counters.
+//'
+//' @return sets all profiling counters to zero
+//' @export
+// [[Rcpp::export]]
+void stemr_profile_reset() {
+        stemr_profile().reset();
+}
+
+//' Retrieve the profiling counters.
+//'
+//' @return list with a data frame containing the number of calls and the
+//'   cumulative time in seconds spent in each of the instrumented C++ entry
+//'   points, the time in seconds spent in entry points that were not called
+//'   from another instrumented entry point, and the numbers of evaluations of
+//'   the ODE right hand sides, of accepted ODE steps, and of failed square
+//'   roots of the LNA diffusion matrix.
+//' @export
+// [[Rcpp::export]]
+Rcpp::List stemr_profile_counters() {
+
+        profile_counters& counters = stemr_profile();
+
+        Rcpp::CharacterVector phase(PROFILE_N_PHASES);
+        Rcpp::NumericVector calls(PROFILE_N_PHASES);
+        Rcpp::NumericVector seconds(PROFILE_N_PHASES);
+
+        for(int p = 0; p < PROFILE_N_PHASES; ++p) {
+                phase[p]   = PROFILE_PHASE_NAMES[p];
+                calls[p]   = (double)counters.calls[p].load();
+                seconds[p] = 1e-9 * (double)counters.nanosec[p].load();
+        }
+
+        Rcpp::DataFrame phases = Rcpp::DataFrame::create(Rcpp::Named("phase")   = phase,
+                                                         Rcpp::Named("calls")   = calls,
+                                                         Rcpp::Named("seconds") = seconds,
+                                                         Rcpp::Named("stringsAsFactors") = false);
+
+        return Rcpp::List::create(Rcpp::Named("phases")       = phases,
+                                  Rcpp::Named("cpp_seconds")  = 1e-9 * (double)counters.outer_nanosec.load(),
+                                  Rcpp::Named("rhs_evals")    = (double)counters.rhs_evals.load(),
+                                  Rcpp::Named("ode_steps")    = (double)counters.ode_steps.load(),
+                                  Rcpp::Named("svd_failures") = (double)counters.svd_failures.load());
+}
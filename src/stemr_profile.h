@@ -0,0 +1,108 @@
+#ifndef stemr_profile_h
+#define stemr_profile_h
+
+#include <atomic>
+#include <chrono>
+
+// Opt-in instrumentation of the hot paths. The counters are process-wide and
+// are only updated while profiling is enabled, see stemr_profile_enable, so
+// that the cost when disabled is a single relaxed load per call. Counters are
+// atomic since the integrator contexts are released on worker threads.
+enum profile_phase {
+        PROFILE_MAP_DRAWS_2_LNA,
+        PROFILE_CENSUS_LATENT_PATH,
+        PROFILE_EVALUATE_D_MEASURE_LNA,
+        PROFILE_LNA_ESS_BLOCK_UPDATE,
+        PROFILE_LNA_PARTICLE_FILTER,
+        PROFILE_INTEGRATE_ODES,
+        PROFILE_PROPOSE_MVNMH,
+        PROFILE_MAP_PARS_2_SENS,
+        PROFILE_N_PHASES
+};
+
+static const char* const PROFILE_PHASE_NAMES[PROFILE_N_PHASES] = {
+        "map_draws_2_lna",
+        "census_latent_path",
+        "evaluate_d_measure_LNA",
+        "lna_ess_block_update",
+        "lna_particle_filter",
+        "integrate_odes",
+        "propose_mvnmh",
+        "map_pars_2_sens"
+};
+
+struct profile_counters {
+        std::atomic<bool> enabled;
+        std::atomic<unsigned long long> calls[PROFILE_N_PHASES];
+        std::atomic<unsigned long long> nanosec[PROFILE_N_PHASES];
+        std::atomic<unsigned long long> outer_nanosec; // time in phases not nested in another phase
+        std::atomic<unsigned long long> rhs_evals;     // evaluations of the ODE right hand sides
+        std::atomic<unsigned long long> ode_steps;     // accepted steps of the ODE steppers
+        std::atomic<unsigned long long> svd_failures;  // failed square roots of the LNA diffusion
+
+        void reset() {
+                for(int p = 0; p < PROFILE_N_PHASES; ++p) {
+                        calls[p]   = 0;
+                        nanosec[p] = 0;
+                }
+                outer_nanosec = 0;
+                rhs_evals     = 0;
+                ode_steps     = 0;
+                svd_failures  = 0;
+        }
+};
+
+// the counters shared by all translation units, zero initialized
+inline profile_counters& stemr_profile() {
+        static profile_counters counters;
+        return counters;
+}
+
+inline bool profile_enabled() {
+        return stemr_profile().enabled.load(std::memory_order_relaxed);
+}
+
+// add to a counter if profiling is enabled
+inline void profile_count(std::atomic<unsigned long long>& counter, unsigned long long n = 1) {
+        if(profile_enabled()) counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+// depth of the nested phases on the calling thread
+inline int& profile_depth() {
+        static thread_local int depth = 0;
+        return depth;
+}
+
+// counts a call to a phase and accumulates the wall time until the scope exits
+class profile_scope {
+public:
+        explicit profile_scope(profile_phase phase_) : phase(phase_), active(profile_enabled()) {
+                if(active) {
+                        ++profile_depth();
+                        start = std::chrono::steady_clock::now();
+                }
+        }
+
+        ~profile_scope() {
+                if(active) {
+                        profile_counters& counters = stemr_profile();
+                        std::chrono::nanoseconds elapsed =
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                        counters.calls[phase].fetch_add(1, std::memory_order_relaxed);
+                        counters.nanosec[phase].fetch_add(elapsed.count(), std::memory_order_relaxed);
+                        if(--profile_depth() == 0) {
+                                counters.outer_nanosec.fetch_add(elapsed.count(), std::memory_order_relaxed);
+                        }
+                }
+        }
+
+private:
+        profile_phase phase;
+        bool active;
+        std::chrono::steady_clock::time_point start;
+
+        profile_scope(const profile_scope&);
+        profile_scope& operator=(const profile_scope&);
+};
+
+#endif
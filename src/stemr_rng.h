@@ -0,0 +1,219 @@
+#ifndef stemr_RNG_H
+#define stemr_RNG_H
+
+#include <RcppArmadillo.h>
+#include <stdint.h>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Tables for the 128-layer ziggurat method of Marsaglia and Tsang (2000).
+// The tables are computed on first use, which is thread-safe.
+struct ziggurat_tables {
+        uint32_t kn[128];
+        double   wn[128];
+        double   fn[128];
+
+        ziggurat_tables() {
+                const double m1 = 2147483648.0;
+                const double vn = 9.91256303526217e-3;
+                double dn = 3.442619855899, tn = dn;
+                double q  = vn / std::exp(-0.5 * dn * dn);
+
+                kn[0]   = static_cast<uint32_t>((dn / q) * m1);
+                kn[1]   = 0;
+                wn[0]   = q / m1;
+                wn[127] = dn / m1;
+                fn[0]   = 1.0;
+                fn[127] = std::exp(-0.5 * dn * dn);
+
+                for(int i = 126; i >= 1; --i) {
+                        dn        = std::sqrt(-2.0 * std::log(vn / dn + std::exp(-0.5 * dn * dn)));
+                        kn[i + 1] = static_cast<uint32_t>((dn / tn) * m1);
+                        tn        = dn;
+                        fn[i]     = std::exp(-0.5 * dn * dn);
+                        wn[i]     = dn / m1;
+                }
+        }
+};
+
+inline const ziggurat_tables& ziggurat() {
+        static const ziggurat_tables tables;
+        return tables;
+}
+
+// Counter-based Philox4x32-10 generator (Salmon et al., 2011). Each stream is
+// identified by a 64-bit key and a 64-bit stream id, so that draws for a given
+// replicate do not depend on which thread simulates it or in what order. The
+// generator does not touch R's RNG and is safe to use from worker threads.
+class philox_rng {
+public:
+        philox_rng(uint64_t seed, uint64_t stream) {
+                key[0] = static_cast<uint32_t>(seed);
+                key[1] = static_cast<uint32_t>(seed >> 32);
+                ctr[0] = 0;
+                ctr[1] = 0;
+                ctr[2] = static_cast<uint32_t>(stream);
+                ctr[3] = static_cast<uint32_t>(stream >> 32);
+                pos    = 4;
+        }
+
+        // next 32 random bits
+        uint32_t next_u32() {
+                if(pos == 4) {
+                        generate();
+                        pos = 0;
+                }
+                return buf[pos++];
+        }
+
+        // uniform draw on the open interval (0,1) with 53 bits of precision
+        double unif() {
+                uint64_t a = next_u32() >> 5;
+                uint64_t b = next_u32() >> 6;
+                return (a * 67108864.0 + b + 0.5) / 9007199254740992.0;
+        }
+
+        // standard normal draw via the ziggurat method, the layer is taken from
+        // separate bits so that it is independent of the value
+        double normal() {
+                const ziggurat_tables& zig = ziggurat();
+
+                while(true) {
+                        int32_t hz = static_cast<int32_t>(next_u32());
+                        int iz     = next_u32() & 127;
+
+                        uint32_t abs_hz = hz < 0 ? 0u - static_cast<uint32_t>(hz) : static_cast<uint32_t>(hz);
+                        if(abs_hz < zig.kn[iz]) return hz * zig.wn[iz];
+
+                        double x = hz * zig.wn[iz];
+
+                        // the base layer, sample from the tail
+                        if(iz == 0) {
+                                const double r = 3.442619855899;
+                                double y;
+                                do {
+                                        x = -std::log(unif()) / r;
+                                        y = -std::log(unif());
+                                } while(y + y < x * x);
+                                return hz > 0 ? r + x : -r - x;
+                        }
+
+                        // the wedge of the layer
+                        if(zig.fn[iz] + unif() * (zig.fn[iz - 1] - zig.fn[iz]) < std::exp(-0.5 * x * x)) return x;
+                }
+        }
+
+        // exponential draw with rate lambda
+        double exp(double lambda) {
+                return -std::log(unif()) / lambda;
+        }
+
+        // Poisson draw with mean mu, by inversion for small means and by the
+        // transformed rejection method of Hormann (1993) otherwise
+        double poisson(double mu) {
+                if(!(mu > 0)) return 0;
+
+                if(mu < 10) {
+                        double p = std::exp(-mu), F = p, u = unif(), k = 0;
+                        while(u > F && k < 1000) {
+                                k += 1;
+                                p *= mu / k;
+                                F += p;
+                        }
+                        return k;
+                }
+
+                double slam     = std::sqrt(mu);
+                double loglam   = std::log(mu);
+                double b        = 0.931 + 2.53 * slam;
+                double a        = -0.059 + 0.02483 * b;
+                double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+                double vr       = 0.9277 - 3.6224 / (b - 2);
+
+                while(true) {
+                        double U  = unif() - 0.5;
+                        double V  = unif();
+                        double us = 0.5 - std::fabs(U);
+                        double k  = std::floor((2 * a / us + b) * U + mu + 0.43);
+
+                        if(us >= 0.07 && V <= vr) return k;
+                        if(k < 0 || (us < 0.013 && V > us)) continue;
+                        if(std::log(V) + std::log(invalpha) - std::log(a / (us * us) + b) <=
+                           -mu + k * loglam - std::lgamma(k + 1)) return k;
+                }
+        }
+
+private:
+        uint32_t key[2];
+        uint32_t ctr[4];
+        uint32_t buf[4];
+        int pos;
+
+        static void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+                uint64_t prod = static_cast<uint64_t>(a) * static_cast<uint64_t>(b);
+                hi = static_cast<uint32_t>(prod >> 32);
+                lo = static_cast<uint32_t>(prod);
+        }
+
+        void generate() {
+                uint32_t c[4] = {ctr[0], ctr[1], ctr[2], ctr[3]};
+                uint32_t k[2] = {key[0], key[1]};
+                uint32_t hi0, lo0, hi1, lo1;
+
+                for(int r = 0; r < 10; ++r) {
+                        mulhilo(0xD2511F53u, c[0], hi0, lo0);
+                        mulhilo(0xCD9E8D57u, c[2], hi1, lo1);
+                        c[0] = hi1 ^ c[1] ^ k[0];
+                        c[1] = lo1;
+                        c[2] = hi0 ^ c[3] ^ k[1];
+                        c[3] = lo0;
+                        k[0] += 0x9E3779B9u;
+                        k[1] += 0xBB67AE85u;
+                }
+
+                buf[0] = c[0]; buf[1] = c[1]; buf[2] = c[2]; buf[3] = c[3];
+
+                // increment the 64-bit block counter
+                if(++ctr[0] == 0) ++ctr[1];
+        }
+};
+
+// draw a 64-bit seed from R's RNG, must be called from the main thread with the
+// R RNG state loaded (e.g., within an exported function)
+inline uint64_t draw_rng_seed() {
+        uint64_t hi = static_cast<uint64_t>(R::unif_rand() * 4294967296.0);
+        uint64_t lo = static_cast<uint64_t>(R::unif_rand() * 4294967296.0);
+        return (hi << 32) | lo;
+}
+
+// Fill x with n N(0,1) draws. The draws are taken in chunks, each from its
+// own stream keyed by the seed and the chunk index, so the chunks may be filled
+// by a pool of threads and the draws do not depend on the number of threads.
+inline void fill_normals(double* x, arma::uword n, uint64_t seed, int n_threads = 1) {
+
+        const arma::uword chunk = 4096;
+        int n_chunks = static_cast<int>((n + chunk - 1) / chunk);
+
+#ifdef _OPENMP
+        if(n_threads < 1) n_threads = omp_get_max_threads();
+        if(n_threads > n_chunks) n_threads = std::max(n_chunks, 1);
+#pragma omp parallel for num_threads(n_threads) schedule(static) if(n_threads > 1)
+#endif
+        for(int c = 0; c < n_chunks; ++c) {
+                philox_rng rng(seed, static_cast<uint64_t>(c));
+
+                arma::uword end = std::min(n, (c + 1) * chunk);
+                for(arma::uword i = c * chunk; i < end; ++i) x[i] = rng.normal();
+        }
+}
+
+// Fill x with n N(0,1) draws from streams seeded by R's RNG, so that the draws
+// are reproducible under set.seed. Must be called from the main thread.
+inline void fill_normals(double* x, arma::uword n) {
+        fill_normals(x, n, draw_rng_seed());
+}
+
+#endif
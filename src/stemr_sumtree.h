@@ -0,0 +1,76 @@
+#ifndef stemr_SUMTREE_H
+#define stemr_SUMTREE_H
+
+#include <RcppArmadillo.h>
+#include <vector>
+
+// Binary sum tree over the event rates. Leaves hold the rates and each internal
+// node holds the sum of its children, so that updating a rate and sampling an
+// event proportionally to the rates both cost O(log R), and the total rate is
+// available in O(1). Internal nodes are recomputed from their children on each
+// update, so no rounding error accumulates in the total.
+class rate_sumtree {
+public:
+        rate_sumtree(int n_rates) : n_leaves(1) {
+                while(n_leaves < n_rates) n_leaves *= 2;
+                tree.assign(2 * n_leaves, 0.0);
+        }
+
+        // rebuild the tree from a vector of rates, O(R)
+        template<typename T>
+        void fill(const T& rates) {
+                std::fill(tree.begin(), tree.end(), 0.0);
+                for(int k = 0; k < static_cast<int>(rates.size()); ++k) tree[n_leaves + k] = rates[k];
+                for(int node = n_leaves - 1; node > 0; --node) tree[node] = tree[2*node] + tree[2*node + 1];
+        }
+
+        // set the rate of an event, O(log R)
+        void set(int event, double rate) {
+                int node = n_leaves + event;
+                tree[node] = rate;
+                for(node /= 2; node > 0; node /= 2) tree[node] = tree[2*node] + tree[2*node + 1];
+        }
+
+        // total rate
+        double total() const {
+                return tree[1];
+        }
+
+        // are any of the rates non-zero
+        bool any() const {
+                return tree[1] > 0;
+        }
+
+        // find the event for a draw u ~ Unif(0, total()), never returns an event
+        // with rate zero as long as total() > 0
+        int sample(double u) const {
+                int node = 1;
+                while(node < n_leaves) {
+                        node *= 2;
+                        if(!(u < tree[node] || tree[node + 1] == 0)) {
+                                u -= tree[node];
+                                node += 1;
+                        }
+                }
+                return node - n_leaves;
+        }
+
+private:
+        int n_leaves;
+        std::vector<double> tree;
+};
+
+// indices of the rates that need to be updated after each event, built from the
+// logical rate adjacency matrix (column j gives rates that depend on event j)
+inline std::vector<std::vector<int> > build_rate_deps(const Rcpp::LogicalMatrix& rate_adjmat) {
+        int n_rates = rate_adjmat.nrow();
+        std::vector<std::vector<int> > rate_deps(rate_adjmat.ncol());
+        for(int j = 0; j < rate_adjmat.ncol(); ++j) {
+                for(int k = 0; k < n_rates; ++k) {
+                        if(rate_adjmat(k, j)) rate_deps[j].push_back(k);
+                }
+        }
+        return rate_deps;
+}
+
+#endif
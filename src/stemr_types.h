@@ -2,6 +2,7 @@
 #define stemr_types_h
 
 #include <RcppArmadillo.h>
+#include "stemr_profile.h"
 
 using namespace arma;
 using namespace Rcpp;
@@ -10,17 +11,212 @@ typedef void(*ratefcn_ptr)(Rcpp::NumericVector& rates, const Rcpp::LogicalVector
              const arma::rowvec& state, const Rcpp::NumericVector& parameters,
              const Rcpp::NumericVector& constants, const arma::rowvec& tcovar);
 
+// rate functions on raw arrays, inds holds the R logicals flagging the rates to
+// be updated. Compiled rate code attaches a pointer to this function as the tag
+// of its rate function pointer, so no Rcpp vectors are touched per call.
+typedef void(*ratefcn_raw_ptr)(double* rates, const int* inds, const double* state,
+             const double* parameters, const double* constants, const double* tcovar);
+
+// Rate function resolved once from its external pointer, on the main thread,
+// and then safe to call from worker threads. Calls go through the raw array
+// ABI if the compiled code provides it. The engines that call rate functions
+// are templated on the rate function, so a functor with an inline call
+// operator may be substituted to have the rates inlined into the engine.
+class stem_rate_fcn {
+public:
+        explicit stem_rate_fcn(SEXP rate_ptr) {
+                Rcpp::XPtr<ratefcn_ptr> xp_fun(rate_ptr);
+                fun = *xp_fun;
+
+                SEXP raw_tag = R_ExternalPtrTag(rate_ptr);
+                raw_fun      = nullptr;
+                if(TYPEOF(raw_tag) == EXTPTRSXP) {
+                        raw_fun = *Rcpp::XPtr<ratefcn_raw_ptr>(raw_tag);
+                }
+        }
+
+        inline void operator()(Rcpp::NumericVector& rates, const Rcpp::LogicalVector& inds,
+                               const arma::rowvec& state, const Rcpp::NumericVector& parameters,
+                               const Rcpp::NumericVector& constants, const arma::rowvec& tcovar) const {
+                if(raw_fun != nullptr) {
+                        raw_fun(rates.begin(), inds.begin(), state.memptr(), parameters.begin(),
+                                constants.begin(), tcovar.memptr());
+                } else {
+                        fun(rates, inds, state, parameters, constants, tcovar);
+                }
+        }
+
+        ratefcn_ptr     fun;
+        ratefcn_raw_ptr raw_fun;
+};
+
 typedef void(*d_measure_ptr)(Rcpp::NumericMatrix& emitmat, const Rcpp::LogicalVector& emit_inds,
              const int record_ind, const Rcpp::NumericVector& record, const Rcpp::NumericVector& state,
              const Rcpp::NumericVector& parameters, const Rcpp::NumericVector& constants,
              const Rcpp::NumericVector& tcovar);
 
+// column-batched measurement process density, evaluates each measurement
+// variable at all times from start_ind on. The time-varying covariates at time j
+// are found in row tcovar_rows[j] of tcovar_pars. External pointers to batched
+// densities are tagged with the symbol d_measure_batch.
+typedef void(*d_measure_batch_ptr)(Rcpp::NumericMatrix& emitmat, const Rcpp::LogicalMatrix& emit_inds,
+             const Rcpp::NumericMatrix& record, const Rcpp::NumericMatrix& state,
+             const double* parameters, const double* constants, const Rcpp::NumericMatrix& tcovar_pars,
+             const int* tcovar_rows, const int* tcovar_inds, const int start_ind);
+
 typedef void(*r_measure_ptr)(Rcpp::NumericMatrix& obsmat, const Rcpp::LogicalVector& emit_inds,
              const int record_ind, const Rcpp::NumericVector& state, const Rcpp::NumericVector& parameters,
              const Rcpp::NumericVector& constants, const Rcpp::NumericVector& tcovar);
 
-// odeintr pointers
-typedef void(*ode_ptr)(Rcpp::NumericVector& init, double start, double end, double step_size);
-typedef void(*set_pars_ptr)(Rcpp::NumericVector& p);
+// ODE integrator pointers - the integrator state lives in a context object that
+// is allocated by the compiled LNA or ODE code, so that several paths can be
+// integrated at once
+typedef void(*ode_ptr)(void* ctx, double* init, double start, double end, double step_size);
+typedef void(*set_pars_ptr)(void* ctx, const double* p);
+
+// integrate in a single sweep over a sequence of times, storing the state at
+// each time in the columns of path. Compiled ODE code attaches a pointer to
+// this function as the tag of its integrator pointer.
+typedef void(*ode_times_ptr)(void* ctx, double* init, const double* times, int n_times, double step_size, double* path);
+
+// number of right hand side evaluations and accepted steps since a context was
+// allocated, stored in counts. Compiled LNA and ODE code attaches a pointer to
+// this function as the tag of its context pointer.
+typedef void(*ode_counts_ptr)(void* ctx, double* counts);
+
+// set the number of threads over which the blocks of a compiled LNA system are
+// integrated concurrently in a context, one by default. Compiled LNA code with
+// more than one block attaches a pointer to this function as the tag of its
+// parameter setting pointer.
+typedef void(*ode_threads_ptr)(void* ctx, int n_threads);
+
+// integrate the ODEs over [start, end] together with their forward
+// sensitivities in n_dirs directions in the space of the parameters, given by
+// the columns of the n_params x n_dirs matrix dpars. The n_odes x n_dirs
+// sensitivities in sens are overwritten along with the state in init.
+// Compiled LNA and ODE code returns a pointer to this function from a separate
+// external pointer function if the derivatives of the hazards are available.
+typedef void(*ode_sens_ptr)(void* ctx, double* init, double* sens, const double* dpars, int n_dirs,
+             double start, double end, double step_size);
+
+// functions for allocating and releasing an integrator context
+struct ode_ctx_fcns {
+        void*(*create)();
+        void(*destroy)(void* ctx);
+};
+
+// Integrator context for a compiled LNA or ODE system. Holds the parameters,
+// ODE state, stepper, and scratch matrices for a single integration, and frees
+// them when it goes out of scope. The XPtr constructor must be called from the
+// main thread. Worker threads are given the resolved function pointers.
+class ode_context {
+public:
+        ode_context(SEXP ode_pointer, SEXP set_pars_pointer, SEXP ctx_pointer) {
+                Rcpp::XPtr<ode_ptr> xp_ode(ode_pointer);
+                Rcpp::XPtr<set_pars_ptr> xp_pars(set_pars_pointer);
+                Rcpp::XPtr<ode_ctx_fcns> xp_ctx(ctx_pointer);
+                integrator = *xp_ode;
+                par_setter = *xp_pars;
+                ctx_fcns   = *xp_ctx;
+                ctx        = ctx_fcns.create();
+
+                // single sweep integrator, if the compiled code provides one
+                SEXP times_tag   = R_ExternalPtrTag(ode_pointer);
+                times_integrator = nullptr;
+                if(TYPEOF(times_tag) == EXTPTRSXP) {
+                        times_integrator = *Rcpp::XPtr<ode_times_ptr>(times_tag);
+                }
+
+                // integrator counts, if the compiled code provides them
+                SEXP counts_tag = R_ExternalPtrTag(ctx_pointer);
+                counter         = nullptr;
+                if(TYPEOF(counts_tag) == EXTPTRSXP) {
+                        counter = *Rcpp::XPtr<ode_counts_ptr>(counts_tag);
+                }
+
+                // setter for the threads over the blocks, if the compiled code has blocks
+                SEXP threads_tag = R_ExternalPtrTag(set_pars_pointer);
+                threads_setter   = nullptr;
+                if(TYPEOF(threads_tag) == EXTPTRSXP) {
+                        threads_setter = *Rcpp::XPtr<ode_threads_ptr>(threads_tag);
+                }
+        }
+
+        ode_context(ode_ptr integrator_, set_pars_ptr par_setter_, const ode_ctx_fcns& ctx_fcns_,
+                    ode_times_ptr times_integrator_ = nullptr, ode_counts_ptr counter_ = nullptr) :
+                integrator(integrator_), par_setter(par_setter_), ctx_fcns(ctx_fcns_),
+                times_integrator(times_integrator_), counter(counter_), threads_setter(nullptr) {
+                ctx = ctx_fcns.create();
+        }
+
+        // the integrator counts are added to the profile when the context is released
+        ~ode_context() {
+                report_counts();
+                ctx_fcns.destroy(ctx);
+        }
+
+        // add the integrator counts since the last report to the profile, for
+        // contexts that are kept across calls
+        void report_counts() {
+                if(counter == nullptr) return;
+
+                double counts[2];
+                counter(ctx, counts);
+                if(profile_enabled()) {
+                        profile_count(stemr_profile().rhs_evals, counts[0] - reported[0]);
+                        profile_count(stemr_profile().ode_steps, counts[1] - reported[1]);
+                }
+                reported[0] = counts[0];
+                reported[1] = counts[1];
+        }
+
+        // set the parameters
+        void set_pars(const double* p) {
+                par_setter(ctx, p);
+        }
+
+        // set the number of threads over which the blocks of the system are
+        // integrated, ignored if the system is not split into blocks
+        void set_threads(int n_threads) {
+                if(threads_setter != nullptr) threads_setter(ctx, n_threads);
+        }
+
+        // integrate the ODEs over [start, end], init is overwritten with the result
+        void integrate(double* init, double start, double end, double step_size) {
+                integrator(ctx, init, start, end, step_size);
+        }
+
+        // can the ODEs be integrated over a sequence of times in a single sweep
+        bool can_integrate_times() const {
+                return times_integrator != nullptr;
+        }
+
+        // integrate the ODEs over times[0], ..., times[n_times-1] without
+        // restarting the stepper, path is filled with the state at each time
+        void integrate_times(double* init, const double* times, int n_times, double step_size, double* path) {
+                times_integrator(ctx, init, times, n_times, step_size, path);
+        }
+
+        // integrate the ODEs and their sensitivities over [start, end], see ode_sens_ptr
+        void integrate_sens(ode_sens_ptr sens_integrator, double* init, double* sens, const double* dpars,
+                            int n_dirs, double start, double end, double step_size) {
+                sens_integrator(ctx, init, sens, dpars, n_dirs, start, end, step_size);
+        }
+
+        ode_ptr       integrator;
+        set_pars_ptr  par_setter;
+        ode_ctx_fcns  ctx_fcns;
+        ode_times_ptr times_integrator;
+        ode_counts_ptr counter;
+        ode_threads_ptr threads_setter;
+
+private:
+        void* ctx;
+        double reported[2] = {0, 0}; // integrator counts already added to the profile
+
+        // contexts own their scratch, so they are not copyable
+        ode_context(const ode_context&);
+        ode_context& operator=(const ode_context&);
+};
 
 #endif
\ No newline at end of file
@@ -42,14 +42,13 @@ void CALL_R_MEASURE(Rcpp::NumericMatrix& obsmat,
 
 // integrate the LNA odes, call via XPtr
 void CALL_INTEGRATE_STEM_ODE(Rcpp::NumericVector& init,
+                             const Rcpp::NumericVector& pars,
                              double start,
                              double end,
                              double step_size,
-                             SEXP stem_ode_ptr);
-
-// set the LNA parameters, call via XPtr
-void CALL_SET_ODE_PARAMS(Rcpp::NumericVector& p,
-                         SEXP set_ode_params_ptr);
+                             SEXP stem_ode_ptr,
+                             SEXP set_ode_params_ptr,
+                             SEXP ode_ctx_ptr);
 
 // update rates based on transition events or changes in time-varying covariates
 void rate_update_tcovar(Rcpp::LogicalVector& rate_inds,
@@ -85,7 +84,8 @@ Rcpp::NumericMatrix simulate_r_measure(const Rcpp::NumericMatrix& censusmat,
 // build a census matrix with compartment counts at observation times
 arma::mat build_census_path(Rcpp::NumericMatrix& path,
                             Rcpp::NumericVector& census_times,
-                            Rcpp::IntegerVector& census_columns);
+                            Rcpp::IntegerVector& census_columns,
+                            const Rcpp::Nullable<Rcpp::IntegerVector>& census_inds);
 
 // census the lna path matrix, possibly computing prevalence and filling out cumulative incidence
 void census_latent_path(
@@ -103,11 +103,50 @@ void census_latent_path(
         const arma::cube& forcing_transfers,
         arma::uvec row0 = 0);
 
+// evaluate the log-density of the measurement process at the observation times
+void evaluate_d_measure_LNA(
+        Rcpp::NumericMatrix& emitmat, const Rcpp::NumericMatrix& obsmat,
+        const Rcpp::NumericMatrix& censusmat, const Rcpp::LogicalMatrix& measproc_indmat,
+        const Rcpp::NumericMatrix& parameters, const Rcpp::IntegerVector& param_inds,
+        const Rcpp::IntegerVector& const_inds, const Rcpp::IntegerVector& tcovar_inds,
+        const Rcpp::LogicalVector& param_update_inds, const Rcpp::IntegerVector& census_indices,
+        Rcpp::NumericVector& param_vec, SEXP d_meas_ptr, int start_ind);
+
+// map N(0,1) draws to an LNA path, throws a std::runtime_error if the path is
+// invalid. ws is the workspace for the objects used in each interval, see stemr_lna.h
+struct lna_scratch;
+void lna_path_from_draws(arma::mat& pathmat,
+                         const arma::mat& draws,
+                         const arma::rowvec& lna_times,
+                         const Rcpp::NumericMatrix& lna_pars,
+                         Rcpp::NumericVector& lna_param_vec,
+                         const Rcpp::IntegerVector& lna_param_inds,
+                         const Rcpp::IntegerVector& lna_tcovar_inds,
+                         const int init_start,
+                         const Rcpp::LogicalVector& param_update_inds,
+                         const arma::mat& stoich_matrix,
+                         const Rcpp::LogicalVector& forcing_inds,
+                         const arma::uvec& forcing_tcov_inds,
+                         const arma::mat& forcings_out,
+                         const arma::cube& forcing_transfers,
+                         arma::vec& svd_d,
+                         arma::mat& svd_U,
+                         arma::mat& svd_V,
+                         double step_size,
+                         SEXP lna_pointer,
+                         SEXP set_pars_pointer,
+                         SEXP ctx_pointer,
+                         std::string diffusion_sqrt,
+                         Rcpp::Nullable<Rcpp::List> lna_cache,
+                         int start_ind,
+                         lna_scratch& ws);
+
 // update a census matrix with compartment counts at observation times
 void retrieve_census_path(arma::mat& cencusmat,
                           Rcpp::NumericMatrix& path,
                           Rcpp::NumericVector& census_times,
-                          Rcpp::IntegerVector& census_columns);
+                          Rcpp::IntegerVector& census_columns,
+                          const Rcpp::Nullable<Rcpp::IntegerVector>& census_inds);
 
 // update the incidence in an existing census matrix
 void compute_incidence(arma::mat& censusmat,